@@ -0,0 +1,38 @@
+/* Measures how fast a scanner turns its input into tokens.
+ * Usage: scanner_benchmark input.vsl
+ * The same file is linked with both the hand-written scanner and the flex scanner, so their speeds can be compared.
+ * Reading or mapping the input is not included in the time.
+ */
+#include "vslc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double seconds ( void )
+{
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+int main ( int argc, char **argv )
+{
+    source_open ( argc > 1 ? argv[1] : NULL );
+
+    yyscan_t scanner;
+    yylex_init ( &scanner );
+    YYSTYPE value;
+    size_t n_tokens = 0;
+    double start = seconds ( );
+    while ( yylex ( &value, scanner ) != 0 )
+        n_tokens++;
+    double elapsed = seconds ( ) - start;
+    yylex_destroy ( scanner );
+
+    double megabytes = source_length / 1e6;
+    printf ( "%zu tokens, %.1f MB in %.3f s: %.1f MB/s, %.1f ns per token\n",
+             n_tokens, megabytes, elapsed, megabytes / elapsed, elapsed * 1e9 / n_tokens );
+    source_close ( );
+    return EXIT_SUCCESS;
+}
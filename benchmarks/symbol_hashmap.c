@@ -0,0 +1,73 @@
+/* Measures insertions and lookups in the symbol hashmap, with millions of symbols.
+ * Usage: symbol_hashmap_benchmark [number of symbols]
+ */
+#include "symbols.h"
+#include "intern.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static double seconds ( void )
+{
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+static void report ( const char *what, size_t count, double elapsed )
+{
+    printf ( "%-16s %10zu %8.1f ns each\n", what, count, elapsed * 1e9 / count );
+}
+
+int main ( int argc, char **argv )
+{
+    size_t n_symbols = argc > 1 ? strtoul ( argv[1], NULL, 10 ) : 4000000;
+
+    // Interned names for the symbols, and as many names that are never inserted
+    char **names = malloc ( n_symbols * 2 * sizeof(char*) );
+    for ( size_t i = 0; i < n_symbols * 2; i++ )
+    {
+        char text[32];
+        int length = snprintf ( text, sizeof(text), "symbol_%zu", i );
+        names[i] = intern ( text, length );
+    }
+
+    // The symbols are allocated up front, so that only the insertions are timed
+    symbol_t **symbols = malloc ( n_symbols * sizeof(symbol_t*) );
+    for ( size_t i = 0; i < n_symbols; i++ )
+    {
+        symbols[i] = malloc ( sizeof(symbol_t) );
+        *symbols[i] = (symbol_t) { .name = names[i], .type = SYMBOL_GLOBAL_VAR };
+    }
+
+    symbol_table_t *table = symbol_table_init ( );
+    double start = seconds ( );
+    for ( size_t i = 0; i < n_symbols; i++ )
+        symbol_table_insert ( table, symbols[i] );
+    report ( "insert", n_symbols, seconds ( ) - start );
+
+    // Look the names up in a scattered order, like a program using its names
+    size_t found = 0;
+    start = seconds ( );
+    for ( size_t i = 0; i < n_symbols; i++ )
+        found += symbol_hashmap_lookup ( table->hashmap, names[( i * 7919 ) % n_symbols] ) != NULL;
+    report ( "lookup (found)", n_symbols, seconds ( ) - start );
+
+    size_t missing = 0;
+    start = seconds ( );
+    for ( size_t i = 0; i < n_symbols; i++ )
+        missing += symbol_hashmap_lookup ( table->hashmap, names[n_symbols + i] ) == NULL;
+    report ( "lookup (missing)", n_symbols, seconds ( ) - start );
+
+    if ( found != n_symbols || missing != n_symbols )
+    {
+        fprintf ( stderr, "error: lookups gave wrong results\n" );
+        exit ( EXIT_FAILURE );
+    }
+
+    symbol_table_destroy ( table );
+    destroy_interned_strings ( );
+    free ( symbols );
+    free ( names );
+}
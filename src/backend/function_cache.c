@@ -0,0 +1,479 @@
+#include "vslc.h"
+#include "function_cache.h"
+#include "profile.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Entries start with this and the hash of their key. Change it when the format of entries changes
+#define ENTRY_FORMAT "vslc function cache 1"
+#define ENTRY_HEADER_SIZE ( sizeof(ENTRY_FORMAT) + 32 + 1 )
+
+// The first two hex digits of the hash
+#define N_SUBDIRECTORIES 256
+#define SUBDIRECTORY(key) ( (unsigned) ( (key)->hash[0] >> 56 ) )
+
+// How often the modification time of an entry is updated when it is used, in seconds
+#define TOUCH_INTERVAL 3600
+
+// When a subdirectory is over its part of the size limit, entries are removed until it is this much below it
+#define TRIM_PERCENT 90
+
+#ifdef __APPLE__
+#define TARGET "macho"
+#define st_mtim st_mtimespec
+#else
+#define TARGET "elf"
+#endif
+
+struct function_cache
+{
+    char *directory;
+    size_t max_size;
+    bool report;
+
+    // Several threads may generate functions of the same compilation
+    atomic_size_t hits, misses, removed;
+    atomic_bool stored_in[N_SUBDIRECTORIES]; // The subdirectories that may have gone over their limit
+};
+
+_Thread_local function_cache_t *function_cache;
+
+static void make_key ( symbol_t *function, function_cache_key_t *key );
+static void hash_node ( function_cache_key_t *key, node_t *node );
+static char* entry_path ( function_cache_key_t *key, bool temporary );
+static bool read_entry ( const char *path, function_cache_key_t *key, char **data, const char **code, size_t *length );
+static void write_entry_header ( char *header, function_cache_key_t *key );
+static void relocate ( const char *code, size_t length, size_t from_function, size_t to_function,
+                       const size_t *from_strings, const size_t *to_strings, size_t n_strings, FILE *stream );
+static void trim_subdirectory ( int subdirectory );
+
+/* External interface */
+
+void function_cache_open ( const char *directory, size_t max_size, bool report )
+{
+    if ( mkdir ( directory, 0777 ) != 0 && errno != EEXIST )
+        compile_error ( "error: could not create the cache directory '%s': %s", directory, strerror ( errno ) );
+
+    function_cache = calloc ( 1, sizeof(function_cache_t) );
+    function_cache->directory = strdup ( directory );
+    function_cache->max_size = max_size > 0 ? max_size : FUNCTION_CACHE_DEFAULT_SIZE;
+    function_cache->report = report;
+}
+
+void function_cache_close ( void )
+{
+    if ( function_cache == NULL )
+        return;
+
+    for ( int i = 0; i < N_SUBDIRECTORIES; i++ )
+        if ( function_cache->stored_in[i] )
+            trim_subdirectory ( i );
+
+    if ( function_cache->report )
+    {
+        size_t hits = function_cache->hits, misses = function_cache->misses;
+        fprintf ( report_stream, "function cache: %zu hits, %zu misses, %.1f%% hit rate, %zu entries removed\n",
+                  hits, misses, hits + misses > 0 ? 100.0 * hits / ( hits + misses ) : 0.0,
+                  (size_t) function_cache->removed );
+    }
+
+    free ( function_cache->directory );
+    free ( function_cache );
+    function_cache = NULL;
+}
+
+bool function_cache_lookup ( symbol_t *function, function_cache_key_t *key )
+{
+    make_key ( function, key );
+
+    char *path = entry_path ( key, false );
+    char *data;
+    const char *code;
+    size_t length;
+    bool hit = read_entry ( path, key, &data, &code, &length );
+    free ( path );
+
+    if ( !hit )
+    {
+        function_cache->misses++;
+        return false;
+    }
+
+    function_cache->hits++;
+    size_t ordinals[key->n_strings + 1];
+    for ( size_t i = 0; i < key->n_strings; i++ )
+        ordinals[i] = i;
+    relocate ( code, length, 0, function->sequence_number, ordinals, key->strings, key->n_strings, output_stream );
+    free ( data );
+    function_cache_discard ( key );
+    return true;
+}
+
+void function_cache_store ( function_cache_key_t *key, symbol_t *function, const char *code, size_t length )
+{
+    // The code is stored as if the function was number 0, and its strings were numbered from 0
+    char *entry;
+    size_t entry_length;
+    FILE *stream = open_memstream ( &entry, &entry_length );
+    char header[ENTRY_HEADER_SIZE + 1];
+    write_entry_header ( header, key );
+    fputs ( header, stream );
+    size_t ordinals[key->n_strings + 1];
+    for ( size_t i = 0; i < key->n_strings; i++ )
+        ordinals[i] = i;
+    relocate ( code, length, function->sequence_number, 0, key->strings, ordinals, key->n_strings, stream );
+    fclose ( stream );
+
+    // Failing to store an entry only makes it a miss the next time, so errors are ignored
+    char *subdirectory = entry_path ( key, false );
+    *strrchr ( subdirectory, '/' ) = '\0';
+    mkdir ( subdirectory, 0777 );
+    free ( subdirectory );
+
+    char *temporary = entry_path ( key, true );
+    int fd = mkstemp ( temporary );
+    if ( fd >= 0 )
+    {
+        bool written = write ( fd, entry, entry_length ) == (ssize_t) entry_length;
+        close ( fd );
+        char *path = entry_path ( key, false );
+        if ( !written || rename ( temporary, path ) != 0 )
+            unlink ( temporary );
+        free ( path );
+        function_cache->stored_in[SUBDIRECTORY ( key )] = true;
+    }
+    free ( temporary );
+    free ( entry );
+    function_cache_discard ( key );
+}
+
+void function_cache_discard ( function_cache_key_t *key )
+{
+    free ( key->strings );
+    *key = (function_cache_key_t) { 0 };
+}
+
+/* Internal matters */
+
+/* Mixes a word into both halves of the hash. Each half uses its own multiplier, and the rotation
+ * carries the high bits of each product down into the next one */
+static void hash_number ( function_cache_key_t *key, uint64_t number )
+{
+    uint64_t a = ( key->hash[0] ^ number ) * 0x9e3779b97f4a7c15;
+    uint64_t b = ( key->hash[1] + number ) * 0xc2b2ae3d27d4eb4f;
+    key->hash[0] = a << 31 | a >> 33;
+    key->hash[1] = b << 29 | b >> 35;
+}
+
+static void hash_bytes ( function_cache_key_t *key, const char *bytes, size_t length )
+{
+    uint64_t word;
+    for ( ; length >= sizeof(word); bytes += sizeof(word), length -= sizeof(word) )
+    {
+        memcpy ( &word, bytes, sizeof(word) );
+        hash_number ( key, word );
+    }
+    word = 0;
+    memcpy ( &word, bytes, length );
+    hash_number ( key, word );
+}
+
+/* The last step of MurmurHash3, so that every bit of the input affects every bit of the hash */
+static uint64_t finish_hash ( uint64_t hash )
+{
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccd;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53;
+    return hash ^ hash >> 33;
+}
+
+/* Strings are hashed with their length, so that two strings can't hash like one */
+static void hash_string ( function_cache_key_t *key, const char *string, size_t length )
+{
+    hash_number ( key, length );
+    hash_bytes ( key, string, length );
+}
+
+/* Hashes everything the code of the function depends on */
+static void make_key ( symbol_t *function, function_cache_key_t *key )
+{
+    *key = (function_cache_key_t) { .hash = { 0xcbf29ce484222325, 0x84222325cbf29ce4 } };
+
+    hash_string ( key, VSLC_BUILD_ID " " TARGET, strlen ( VSLC_BUILD_ID " " TARGET ) );
+    hash_number ( key, use_freestanding_runtime );
+    hash_number ( key, generate_profiling );
+    hash_number ( key, compile_as_module );
+    hash_string ( key, function->name, strlen ( function->name ) );
+    symbol_table_t *symbols = function->function_symtable;
+    hash_number ( key, symbols->n_symbols );
+    for ( size_t i = 0; i < symbols->n_symbols; i++ )
+        hash_number ( key, symbols->symbols[i]->type );
+    hash_node ( key, function->node->children[1] );
+    hash_node ( key, function->node->children[2] );
+    key->hash[0] = finish_hash ( key->hash[0] );
+    key->hash[1] = finish_hash ( key->hash[1] );
+}
+
+static void hash_node ( function_cache_key_t *key, node_t *node )
+{
+    hash_number ( key, node->type );
+    hash_number ( key, node->n_children );
+    switch ( node->type )
+    {
+        case IDENTIFIER_DATA: {
+            hash_string ( key, node->data, strlen ( node->data ) );
+            symbol_t *symbol = node->symbol;
+            if ( symbol == NULL )
+                break;
+            hash_number ( key, symbol->type );
+            // Locals are found by their place in the function, and the calls depend on the number of parameters
+            if ( symbol->type == SYMBOL_PARAMETER || symbol->type == SYMBOL_LOCAL_VAR )
+                hash_number ( key, symbol->sequence_number );
+            // With -stream, functions called before they are declared have no node yet, and are checked later
+            else if ( ( symbol->type == SYMBOL_FUNCTION || symbol->type == SYMBOL_EXTERN_FUNCTION ) && symbol->node != NULL )
+                hash_number ( key, symbol->node->children[1]->n_children );
+            break;
+        }
+        case NUMBER_DATA:
+            hash_number ( key, node->value );
+            break;
+        case EXPRESSION:
+        case RELATION:
+            hash_number ( key, node->operator );
+            break;
+        case IF_STATEMENT:
+        case WHILE_STATEMENT:
+            // The layout chosen with -fprofile-use
+            if ( node->data != NULL )
+                hash_number ( key, PROFILE_LAYOUT ( node ) );
+            break;
+        case STRING_LIST_REFERENCE: {
+            size_t position = (size_t) node->data;
+            key->strings = realloc ( key->strings, ( key->n_strings + 1 ) * sizeof(size_t) );
+            key->strings[key->n_strings++] = position;
+            source_slice_t string = string_list[position];
+            hash_string ( key, SLICE_TEXT ( string ), string.length );
+            break;
+        }
+        default:
+            break;
+    }
+    for ( size_t i = 0; i < node->n_children; i++ )
+        hash_node ( key, node->children[i] );
+}
+
+/* Returns the path of the entry with the key, or a template for mkstemp next to it */
+static char* entry_path ( function_cache_key_t *key, bool temporary )
+{
+    size_t size = strlen ( function_cache->directory ) + 64;
+    char *path = malloc ( size );
+    snprintf ( path, size, "%s/%02x/%014" PRIx64 "%s", function_cache->directory, SUBDIRECTORY ( key ),
+               key->hash[0] & 0xffffffffffffff, temporary ? ".tmpXXXXXX" : "" );
+    return path;
+}
+
+/* Reads the entry at path, and checks that it has the key.
+ * On success, code points to the code inside data, which must be freed.
+ * Entries are removed in the order they were last used, so a hit updates the modification time,
+ * unless it was updated recently */
+static bool read_entry ( const char *path, function_cache_key_t *key, char **data, const char **code, size_t *length )
+{
+    int fd = open ( path, O_RDONLY );
+    if ( fd < 0 )
+        return false;
+
+    struct stat entry_stat;
+    *data = NULL;
+    bool success = fstat ( fd, &entry_stat ) == 0;
+    if ( success )
+    {
+        *data = malloc ( entry_stat.st_size + 1 );
+        success = read ( fd, *data, entry_stat.st_size ) == entry_stat.st_size;
+    }
+    if ( success )
+    {
+        ( *data )[entry_stat.st_size] = '\0';
+        char header[ENTRY_HEADER_SIZE + 1];
+        write_entry_header ( header, key );
+        success = (size_t) entry_stat.st_size >= ENTRY_HEADER_SIZE && memcmp ( *data, header, ENTRY_HEADER_SIZE ) == 0;
+    }
+    if ( success )
+    {
+        *code = *data + ENTRY_HEADER_SIZE;
+        *length = entry_stat.st_size - ENTRY_HEADER_SIZE;
+        if ( time ( NULL ) - entry_stat.st_mtime > TOUCH_INTERVAL )
+            futimens ( fd, NULL );
+    }
+    close ( fd );
+    if ( !success )
+        free ( *data );
+    return success;
+}
+
+/* Writes the first line of the entry with the key, which is the format and the whole hash */
+static void write_entry_header ( char *header, function_cache_key_t *key )
+{
+    snprintf ( header, ENTRY_HEADER_SIZE + 1, "%s %016" PRIx64 "%016" PRIx64 "\n", ENTRY_FORMAT,
+               key->hash[0], key->hash[1] );
+}
+
+static bool is_label_character ( char c )
+{
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) ||
+           c == '_' || c == '.';
+}
+
+/* Reads the number at *text, if there is one, and moves past it */
+static bool read_number ( const char **text, const char *end, size_t *number )
+{
+    const char *start = *text;
+    *number = 0;
+    while ( *text < end && **text >= '0' && **text <= '9' )
+        *number = *number * 10 + *( *text )++ - '0';
+    return *text > start;
+}
+
+/* Prints the code with its labels and string references renumbered.
+ * The generator names the labels of a function F<function number>_<name>, and strings string<position>.
+ * Other labels start with a '.', and string literals in the code are left alone. A $ before a label makes it an immediate */
+static void relocate ( const char *code, size_t length, size_t from_function, size_t to_function,
+                       const size_t *from_strings, const size_t *to_strings, size_t n_strings, FILE *stream )
+{
+    const char *end = code + length;
+    const char *copied = code; // Everything before this has been printed
+    bool in_string = false;
+    for ( const char *c = code; c < end; c++ )
+    {
+        if ( *c != '"' && *c != '\\' && *c != 'F' && *c != 's' )
+            continue;
+        if ( in_string )
+        {
+            if ( *c == '\\' )
+                c++;
+            else if ( *c == '"' )
+                in_string = false;
+            continue;
+        }
+        if ( *c == '"' )
+        {
+            in_string = true;
+            continue;
+        }
+        if ( c > code && is_label_character ( c[-1] ) )
+            continue;
+
+        const char *number_start = NULL, *number_end = c;
+        size_t number;
+        if ( *c == 'F' )
+        {
+            number_end = c + 1;
+            if ( read_number ( &number_end, end, &number ) && number_end < end && *number_end == '_' &&
+                 number == from_function )
+            {
+                number_start = c + 1;
+                number = to_function;
+            }
+        }
+        else if ( end - c > 6 && strncmp ( c, "string", 6 ) == 0 )
+        {
+            number_end = c + 6;
+            if ( read_number ( &number_end, end, &number ) &&
+                 ( number_end == end || !is_label_character ( *number_end ) ) )
+            {
+                for ( size_t i = 0; i < n_strings && number_start == NULL; i++ )
+                {
+                    if ( from_strings[i] == number )
+                    {
+                        number_start = c + 6;
+                        number = to_strings[i];
+                    }
+                }
+            }
+        }
+
+        if ( number_start != NULL )
+        {
+            fwrite ( copied, 1, number_start - copied, stream );
+            fprintf ( stream, "%zu", number );
+            copied = number_end;
+        }
+        c = number_end > c ? number_end - 1 : c;
+    }
+    fwrite ( copied, 1, end - copied, stream );
+}
+
+typedef struct
+{
+    char *name;
+    off_t size;
+    struct timespec used;
+} cached_file_t;
+
+static int compare_last_used ( const void *a, const void *b )
+{
+    const struct timespec *x = &( (const cached_file_t *) a )->used, *y = &( (const cached_file_t *) b )->used;
+    if ( x->tv_sec != y->tv_sec )
+        return x->tv_sec < y->tv_sec ? -1 : 1;
+    return ( x->tv_nsec > y->tv_nsec ) - ( x->tv_nsec < y->tv_nsec );
+}
+
+/* Removes the least recently used entries of the subdirectory, if it is over its part of the size limit.
+ * Other compilations may remove the same files at the same time, so failing to remove one is fine */
+static void trim_subdirectory ( int subdirectory )
+{
+    size_t size = strlen ( function_cache->directory ) + 300;
+    char *path = malloc ( size );
+    snprintf ( path, size, "%s/%02x", function_cache->directory, subdirectory );
+    DIR *directory = opendir ( path );
+    if ( directory == NULL )
+    {
+        free ( path );
+        return;
+    }
+
+    cached_file_t *files = NULL;
+    size_t n_files = 0, capacity = 0;
+    off_t total_size = 0;
+    struct dirent *entry;
+    while ( ( entry = readdir ( directory ) ) != NULL )
+    {
+        struct stat file_stat;
+        snprintf ( path, size, "%s/%02x/%s", function_cache->directory, subdirectory, entry->d_name );
+        if ( stat ( path, &file_stat ) != 0 || !S_ISREG ( file_stat.st_mode ) )
+            continue;
+        if ( n_files == capacity )
+        {
+            capacity = capacity * 2 + 16;
+            files = realloc ( files, capacity * sizeof(cached_file_t) );
+        }
+        files[n_files++] = (cached_file_t) { strdup ( entry->d_name ), file_stat.st_size, file_stat.st_mtim };
+        total_size += file_stat.st_size;
+    }
+    closedir ( directory );
+
+    off_t limit = function_cache->max_size / N_SUBDIRECTORIES;
+    if ( total_size > limit )
+    {
+        qsort ( files, n_files, sizeof(cached_file_t), compare_last_used );
+        for ( size_t i = 0; i < n_files && total_size > limit / 100 * TRIM_PERCENT; i++ )
+        {
+            snprintf ( path, size, "%s/%02x/%s", function_cache->directory, subdirectory, files[i].name );
+            if ( unlink ( path ) == 0 )
+                function_cache->removed++;
+            total_size -= files[i].size;
+        }
+    }
+
+    for ( size_t i = 0; i < n_files; i++ )
+        free ( files[i].name );
+    free ( files );
+    free ( path );
+}
@@ -1,6 +1,11 @@
 #include "vslc.h"
+#include "source.h"
 
-// This header defines a bunch of macros we can use to emit assembly to stdout
+#include "parallel.h"
+#include "function_cache.h"
+#include "profile.h"
+
+// This header defines a bunch of macros we can use to emit assembly to the output stream
 #include "emit.h"
 
 // In the System V calling convention, the first 6 integer parameters are passed in registers
@@ -11,50 +16,140 @@ static const char *REGISTER_PARAMS[6] = {RDI, RSI, RDX, RCX, R8, R9};
 #define FUNC_PARAM_COUNT(func) ((func)->node->children[1]->n_children)
 
 static void generate_stringtable ( void );
+static void generate_strings ( size_t first );
 static void generate_global_variables ( void );
+static void generate_global_variable ( symbol_t *symbol );
 static void generate_function ( symbol_t *function );
+static void generate_or_reuse_function ( symbol_t *function );
+static void generate_or_reuse_code ( symbol_t *function );
 static void generate_expression ( node_t *expression );
 static void generate_statement ( node_t *node );
 static void generate_main ( symbol_t *first );
+static void generate_module_end ( void );
+static bool generate_functions_in_parallel ( int jobs );
+static void generate_profile_entry ( void );
+static void generate_profile_exit ( void );
+static void generate_profile_call_count ( symbol_t *callee );
+static void generate_profile_data ( symbol_t *function );
+static void generate_profile_dump ( void );
+
+_Thread_local bool use_freestanding_runtime = false;
+_Thread_local bool generate_profiling = false;
+
+// Labels inside a function are numbered from 0 in each function, and start with F and the function's sequence number,
+// like F3_THEN0. That way the code of a function doesn't depend on the functions generated before it
+
+// Counter used to give each piece of text printed by print statements a unique label
+static _Thread_local int print_label_counter = 0;
+
+// Counters used to give each if-statement and while-loop unique labels
+static _Thread_local int if_label_counter = 0;
+static _Thread_local int while_label_counter = 0;
+
+// Global variable to store the label of the innermost while-loop
+static _Thread_local const char* innermost_while_label = NULL;
 
 /* Entry point for code generation */
-void generate_program ( void )
+void generate_program ( int jobs )
 {
     generate_stringtable ( );
     generate_global_variables ( );
+    // A module uses the runtime of the program it is linked with
+    if ( use_freestanding_runtime && !compile_as_module )
+        generate_runtime_data ( );
 
     DIRECTIVE ( ".text" );
     symbol_t *first_function = NULL;
-    for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+    for ( size_t i = 0; i < global_symbols->n_symbols && first_function == NULL; i++ )
+        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+            first_function = global_symbols->symbols[i];
+
+    if ( first_function == NULL && !compile_as_module )
     {
-        symbol_t *symbol = global_symbols->symbols[i];
-        if ( symbol->type != SYMBOL_FUNCTION )
-            continue;
-        if ( !first_function )
-            first_function = symbol;
-        generate_function ( symbol );
+        compile_error ( "error: program contained no functions" );
     }
 
-    if ( first_function == NULL )
+    if ( jobs <= 1 || !generate_functions_in_parallel ( jobs ) )
+        for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+            if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+                generate_or_reuse_function ( global_symbols->symbols[i] );
+
+    if ( compile_as_module )
+        generate_module_end ( );
+    else
+        generate_main ( first_function );
+}
+
+/* With -stream, the program is generated one global at a time, as each is parsed, see libvslc.c.
+ * The strings and global variables are placed in their sections along with the function or declaration they belong to */
+
+// The strings in the string list that have been generated
+static _Thread_local size_t n_streamed_strings;
+
+void begin_streamed_program ( void )
+{
+    n_streamed_strings = 0;
+    DIRECTIVE ( ".section %s", ASM_STRING_SECTION );
+    if ( !compile_as_module )
+        DIRECTIVE ( "errout: .asciz \"%s\"", "Wrong number of arguments" );
+    if ( use_freestanding_runtime && !compile_as_module )
+        generate_runtime_data ( );
+    DIRECTIVE ( ".text" );
+}
+
+void generate_streamed_function ( symbol_t *function )
+{
+    if ( n_streamed_strings < string_list_len )
+    {
+        DIRECTIVE ( ".section %s", ASM_STRING_SECTION );
+        generate_strings ( n_streamed_strings );
+        DIRECTIVE ( ".text" );
+        n_streamed_strings = string_list_len;
+    }
+    generate_or_reuse_function ( function );
+}
+
+void generate_streamed_declaration ( node_t *declaration )
+{
+    DIRECTIVE ( ".section %s", ASM_BSS_SECTION );
+    DIRECTIVE ( ".align 8" );
+    node_t *variables = declaration->children[0];
+    for ( size_t i = 0; i < variables->n_children; i++ )
     {
-        fprintf ( stderr, "error: program contained no functions\n" );
-        exit ( EXIT_FAILURE );
+        node_t *variable = variables->children[i];
+        char *name = variable->type == ARRAY_INDEXING ? variable->children[0]->data : variable->data;
+        generate_global_variable ( symbol_hashmap_lookup ( global_symbols->hashmap, name ) );
     }
-    generate_main ( first_function );
+    DIRECTIVE ( ".text" );
+}
+
+void end_streamed_program ( symbol_t *first_function )
+{
+    if ( first_function == NULL && !compile_as_module )
+        compile_error ( "error: program contained no functions" );
+
+    if ( compile_as_module )
+        generate_module_end ( );
+    else
+        generate_main ( first_function );
 }
 
 /* Prints one .asciz entry for each string in the global string_list */
 static void generate_stringtable ( void )
 {
     DIRECTIVE ( ".section %s", ASM_STRING_SECTION );
-    // These strings are used by printf
-    DIRECTIVE ( "intout: .asciz \"%s\"", "%ld" );
-    DIRECTIVE ( "strout: .asciz \"%s\"", "%s" );
-    // This string is used by the entry point-wrapper
-    DIRECTIVE ( "errout: .asciz \"%s\"", "Wrong number of arguments" );
+    // This string is used by the entry point-wrapper, which modules don't have
+    if ( !compile_as_module )
+        DIRECTIVE ( "errout: .asciz \"%s\"", "Wrong number of arguments" );
 
-    for ( size_t i = 0; i < string_list_len; i++ )
-        DIRECTIVE ( "string%ld: \t.asciz %s", i, string_list[i] );
+    generate_strings ( 0 );
+}
+
+/* Prints the strings of the string list from the first one on */
+static void generate_strings ( size_t first )
+{
+    for ( size_t i = first; i < string_list_len; i++ )
+        DIRECTIVE ( "string%ld: \t.asciz %.*s", i, (int) string_list[i].length, SLICE_TEXT ( string_list[i] ) );
 }
 
 /* Prints .zero entries in the .bss section to allocate room for global variables and arrays */
@@ -63,73 +158,147 @@ static void generate_global_variables ( void )
     DIRECTIVE ( ".section %s", ASM_BSS_SECTION );
     DIRECTIVE ( ".align 8" );
     for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+        generate_global_variable ( global_symbols->symbols[i] );
+}
+
+/* Prints the .zero entry of a global variable or array. Other symbols are skipped */
+static void generate_global_variable ( symbol_t *symbol )
+{
+    if ( symbol->type == SYMBOL_GLOBAL_VAR )
     {
-        symbol_t *symbol = global_symbols->symbols[i];
-        if ( symbol->type == SYMBOL_GLOBAL_VAR )
-        {
-            DIRECTIVE ( ".%s: \t.zero 8", symbol->name );
-        }
-        else if ( symbol->type == SYMBOL_GLOBAL_ARRAY )
-        {
-            if ( symbol->node->children[1]->type != NUMBER_DATA)
-            {
-                fprintf ( stderr, "error: length of array '%s' is not compile time known", symbol->name );
-                exit ( EXIT_FAILURE );
-            }
-            int64_t length = *(int64_t*) symbol->node->children[1]->data;
-            DIRECTIVE ( ".%s: \t.zero %ld", symbol->name, length*8 );
-        }
+        DIRECTIVE ( ".%s: \t.zero 8", symbol->name );
+    }
+    else if ( symbol->type == SYMBOL_GLOBAL_ARRAY )
+    {
+        // Lengths that aren't numbers are reported when the symbol is made
+        assert ( symbol->node->children[1]->type == NUMBER_DATA );
+        int64_t length = symbol->node->children[1]->value;
+        DIRECTIVE ( ".%s: \t.zero %ld", symbol->name, length*8 );
     }
 }
 
 /* Global variable used to make the functon currently being generated accessible from anywhere */
-static symbol_t *current_function;
+static _Thread_local symbol_t *current_function;
+
+// How many parameters and local variables of the current function are on the stack below %rbp
+static _Thread_local size_t n_frame_slots;
 
 /* Prints the entry point. preamble, statements and epilouge of the given function */
 static void generate_function ( symbol_t *function )
 {
+    // Functions in a module are global symbols, so that other modules can call them
+    if ( compile_as_module )
+        DIRECTIVE ( ".global .%s", function->name );
     LABEL( ".%s", function->name );
     current_function = function;
+    print_label_counter = 0;
+    if_label_counter = 0;
+    while_label_counter = 0;
+    innermost_while_label = NULL;
 
     PUSHQ ( RBP );
     MOVQ ( RSP, RBP );
 
     // Up to 6 prameters have been passed in registers. Place them on the stack instead
-    for ( size_t i = 0; i < FUNC_PARAM_COUNT(function) && i < NUM_REGISTER_PARAMS; i++ )
+    n_frame_slots = 0;
+    for ( size_t i = 0; i < FUNC_PARAM_COUNT(function) && i < NUM_REGISTER_PARAMS; i++, n_frame_slots++ )
         PUSHQ ( REGISTER_PARAMS[i] );
 
     // Now, for each local variable, push 8-byte 0 values to the stack
     for ( size_t i = 0; i < function->function_symtable->n_symbols; i++ )
         if ( function->function_symtable->symbols[i]->type == SYMBOL_LOCAL_VAR )
+        {
             PUSHQ("$0");
+            n_frame_slots++;
+        }
+
+    if ( generate_profiling )
+        generate_profile_entry ( );
 
     generate_statement( function->node->children[2] );
 
     // In case the function didn't return, return 0 here
     MOVQ ( "$0", RAX );
+    if ( generate_profiling )
+        generate_profile_exit ( );
     // leaveq is written out manually, to increase clarity of what happens
     MOVQ ( RBP, RSP );
     POPQ ( RBP );
     RET;
+
+    if ( generate_profiling )
+        generate_profile_data ( function );
 }
 
-static void generate_function_call ( node_t *call )
+// Catches errors in a function being generated for the cache, see generate_or_reuse_code.
+// It is not a local variable, since those may lose changes made between setjmp and longjmp
+static _Thread_local error_handler_t cache_handler;
+
+/* Generates the function, or reuses its code, in the section it belongs to.
+ * With -fprofile-use, hot functions and the ones that never ran get sections of their own, see profile.h */
+static void generate_or_reuse_function ( symbol_t *function )
 {
-    symbol_t *symbol = call->children[0]->symbol;
-    if ( symbol->type != SYMBOL_FUNCTION ) {
-        fprintf ( stderr, "error: '%s' is not a function\n", symbol->name );
-        exit ( EXIT_FAILURE );
+    layout_t layout = PROFILE_LAYOUT ( function->node );
+    if ( layout != LAYOUT_HOT && layout != LAYOUT_COLD )
+    {
+        generate_or_reuse_code ( function );
+        return;
     }
+    DIRECTIVE ( ".section %s", layout == LAYOUT_HOT ? ASM_HOT_TEXT_SECTION : ASM_COLD_TEXT_SECTION );
+    generate_or_reuse_code ( function );
+    DIRECTIVE ( ".text" );
+}
 
-    node_t *argument_list = call->children[1];
-
-    int parameter_count = FUNC_PARAM_COUNT( symbol );
-    if ( parameter_count != argument_list->n_children )
+/* Generates the function, or copies its code from the function cache if there is one.
+ * Newly generated code is written to a buffer first, and stored in the cache */
+static void generate_or_reuse_code ( symbol_t *function )
+{
+    function_cache_key_t key;
+    if ( function_cache == NULL )
     {
-        fprintf ( stderr, "error: function '%s' expects '%d' arguments, but '%ld' were given\n",
-                  symbol->name, parameter_count, argument_list->n_children );
-        exit(EXIT_FAILURE);
+        generate_function ( function );
+        return;
     }
+    if ( function_cache_lookup ( function, &key ) )
+        return;
+
+    char *code;
+    size_t code_length;
+    FILE *stream = output_stream;
+    output_stream = open_memstream ( &code, &code_length );
+
+    // Errors are caught to put back the output stream, and then passed on
+    error_handler_t *outer_handler = error_handler;
+    cache_handler.message = NULL;
+    error_handler = &cache_handler;
+    if ( setjmp ( cache_handler.jump ) == 0 )
+        generate_function ( function );
+    error_handler = outer_handler;
+
+    fclose ( output_stream );
+    output_stream = stream;
+    // Whatever was generated before an error is output too
+    fwrite ( code, 1, code_length, output_stream );
+    if ( cache_handler.message == NULL )
+        function_cache_store ( &key, function, code, code_length );
+    else
+        function_cache_discard ( &key );
+    free ( code );
+
+    if ( cache_handler.message != NULL )
+        rethrow_error ( cache_handler.message );
+}
+
+static void generate_function_call ( node_t *call )
+{
+    symbol_t *symbol = call->children[0]->symbol;
+    // Functions in other modules are called just like the ones in this module, and the linker finds them.
+    // Calls to other things, or with the wrong number of arguments, are reported when names are bound
+    assert ( symbol->type == SYMBOL_FUNCTION || symbol->type == SYMBOL_EXTERN_FUNCTION );
+
+    // With -stream, a function may be called before it is declared, so the arguments are counted instead
+    node_t *argument_list = call->children[1];
+    int parameter_count = argument_list->n_children;
 
     // We evaluate all parameters from right to left, pushing them to the stack
     for ( int i = parameter_count-1; i >= 0; i-- ) {
@@ -141,6 +310,8 @@ static void generate_function_call ( node_t *call )
     for ( size_t i = 0; i < parameter_count && i < NUM_REGISTER_PARAMS; i++ )
         POPQ ( REGISTER_PARAMS[i] );
 
+    if ( generate_profiling )
+        generate_profile_call_count ( symbol );
     EMIT ( "call .%s", symbol->name );
 
     // Now pop away any stack passed parameters still left on the stack, by moving %rsp upwards
@@ -151,7 +322,7 @@ static void generate_function_call ( node_t *call )
 /* Returns a string for accessing the quadword referenced by node */
 static const char* generate_variable_access ( node_t* node )
 {
-    static char result[100];
+    static _Thread_local char result[100];
 
     assert ( node->type == IDENTIFIER_DATA );
 
@@ -185,14 +356,10 @@ static const char* generate_variable_access ( node_t* node )
             snprintf ( result, sizeof(result), "%d(%s)", call_frame_offset, RBP );
             return result;
         }
-        case SYMBOL_FUNCTION:
-            fprintf ( stderr, "error: symbol '%s' is a function, not a variable\n", symbol->name );
-            exit(EXIT_FAILURE);
-        case SYMBOL_GLOBAL_ARRAY:
-            fprintf ( stderr, "error: symbol '%s' is an array, not a variable\n", symbol->name );
-            exit(EXIT_FAILURE);
+        // Functions and arrays used as variables are reported when names are bound
         default: assert ( false && "Unknown variable symbol type" );
     }
+    return NULL;
 }
 
 /* Takes in an ARRAY_INDEXING node, such as array[x]
@@ -204,10 +371,7 @@ static const char* generate_array_access ( node_t* node ) {
     assert ( node->type == ARRAY_INDEXING );
 
     symbol_t *symbol = node->children[0]->symbol;
-    if ( symbol->type != SYMBOL_GLOBAL_ARRAY ) {
-        fprintf ( stderr, "error: symbol '%s' is not an array\n", symbol->name );
-        exit (EXIT_FAILURE);
-    }
+    assert ( symbol->type == SYMBOL_GLOBAL_ARRAY ); // Other symbols are reported when names are bound
 
     // Calculate the index of the array into %rax
     generate_expression ( node->children[1] );
@@ -222,6 +386,15 @@ static const char* generate_array_access ( node_t* node ) {
     return MEM(RCX);
 }
 
+/* Returns true if the node is a constant 2^k, with k between 1 and 62 */
+static bool is_power_of_two_constant ( node_t *node )
+{
+    if ( node->type != NUMBER_DATA )
+        return false;
+    int64_t value = node->value;
+    return value > 1 && ( value & ( value - 1 ) ) == 0;
+}
+
 /* Generates code to evaluate the expression, and place the result in %rax */
 static void generate_expression ( node_t *expression )
 {
@@ -229,7 +402,7 @@ static void generate_expression ( node_t *expression )
     {
         case NUMBER_DATA:
             // Simply place the number into %rax
-            EMIT ( "movq $%ld, %s", *(int64_t*)expression->data, RAX );
+            EMIT ( "movq $%ld, %s", expression->value, RAX );
             break;
         case IDENTIFIER_DATA:
             // Load the variable, and put the result in RAX
@@ -240,8 +413,8 @@ static void generate_expression ( node_t *expression )
             MOVQ ( generate_array_access ( expression ), RAX );
             break;
         case EXPRESSION: {
-            char* data = expression->data;
-            if ( strcmp ( data, "+" ) == 0 )
+            operator_t op = expression->operator;
+            if ( op == OPERATOR_ADD )
             {
                 generate_expression ( expression->children[0] );
                 PUSHQ ( RAX );
@@ -249,7 +422,7 @@ static void generate_expression ( node_t *expression )
                 POPQ ( RCX );
                 ADDQ ( RCX, RAX );
             }
-            else if ( strcmp ( data, "-" ) == 0)
+            else if ( op == OPERATOR_SUBTRACT )
             {
                 if ( expression->n_children == 1 ) {
                     // Unary minus
@@ -266,7 +439,7 @@ static void generate_expression ( node_t *expression )
                     SUBQ ( RCX, RAX );
                 }
             }
-            else if ( strcmp ( data, "*" ) == 0 )
+            else if ( op == OPERATOR_MULTIPLY )
             {
                 // Multiplication does not need to do sign extend
                 generate_expression ( expression->children[0] );
@@ -275,7 +448,19 @@ static void generate_expression ( node_t *expression )
                 POPQ ( RCX );
                 IMULQ ( RCX, RAX );
             }
-            else if ( strcmp ( data, "/" ) == 0 )
+            else if ( op == OPERATOR_DIVIDE && is_power_of_two_constant ( expression->children[1] ) )
+            {
+                // Signed division by 2^k is a right shift, after adding 2^k-1 to negative numbers,
+                // so that the result is rounded towards zero like idivq does
+                int shift = __builtin_ctzll ( expression->children[1]->value );
+                generate_expression ( expression->children[0] );
+                MOVQ ( RAX, RDX );
+                SAR ( "$63", RDX ); // RDX = -1 if RAX is negative, else 0
+                EMIT ( "shrq $%d, %s", 64 - shift, RDX ); // RDX = 2^k-1 if RAX is negative, else 0
+                ADDQ ( RDX, RAX );
+                EMIT ( "sarq $%d, %s", shift, RAX );
+            }
+            else if ( op == OPERATOR_DIVIDE )
             {
                 generate_expression ( expression->children[1] );
                 PUSHQ ( RAX );
@@ -284,7 +469,7 @@ static void generate_expression ( node_t *expression )
                 POPQ ( RCX );
                 IDIVQ ( RCX ); // Didivde RDX:RAX by RCX, placing the result in RAX
             }
-            else if ( strcmp ( data, "<<" ) == 0 )
+            else if ( op == OPERATOR_SHIFT_LEFT )
             {
                 // Evaluate the shift amount first, and push it to stack
                 generate_expression ( expression->children[1] );
@@ -293,7 +478,7 @@ static void generate_expression ( node_t *expression )
                 POPQ ( RCX ); // Pop the shift amount
                 SAL ( CL, RAX ); // RAX = RAX<<CL
             }
-            else if ( strcmp ( data, ">>" ) == 0 )
+            else if ( op == OPERATOR_SHIFT_RIGHT )
             {
                 // Evaluate the shift amount first, and push it to stack
                 generate_expression ( expression->children[1] );
@@ -333,33 +518,203 @@ static void generate_assignment_statement ( node_t *statement )
     }
 }
 
-static void generate_print_statement ( node_t *statement )
+/* Returns true if the string literal can be copied verbatim into a printf format string.
+ * Octal and hex escapes are rejected, since they could encode a '%' that we can't escape.
+ */
+static bool string_is_fusable ( source_slice_t literal )
+{
+    const char *end = SLICE_TEXT ( literal ) + literal.length;
+    for ( const char *c = SLICE_TEXT ( literal ); c < end; c++ )
+    {
+        if ( *c != '\\' )
+            continue;
+        c++;
+        if ( *c == 'x' || ( *c >= '0' && *c <= '9' ) )
+            return false;
+    }
+    return true;
+}
+
+/* Returns true if evaluating the expression may have side effects, such as printing */
+static bool expression_has_call ( node_t *expression )
+{
+    if ( expression->type == FUNCTION_CALL )
+        return true;
+    for ( size_t i = 0; i < expression->n_children; i++ )
+        if ( expression_has_call ( expression->children[i] ) )
+            return true;
+    return false;
+}
+
+/* If the print item is known at compile time, appends its text to the stream and returns true.
+ * With escape_percent set, the text is meant for a printf format string, so '%' is doubled,
+ * and string literals that can't be escaped are not considered constant.
+ */
+static bool append_constant_print_item ( FILE *stream, node_t *item, bool escape_percent )
+{
+    if ( item->type == NUMBER_DATA )
+    {
+        fprintf ( stream, "%ld", item->value );
+        return true;
+    }
+
+    if ( item->type != STRING_LIST_REFERENCE )
+        return false;
+
+    source_slice_t literal = string_list[(size_t) item->data];
+    if ( escape_percent && !string_is_fusable ( literal ) )
+        return false;
+
+    // Copy the literal without its quotes
+    const char *end = SLICE_TEXT ( literal ) + literal.length - 1;
+    for ( const char *c = SLICE_TEXT ( literal ) + 1; c != end; c++ )
+    {
+        if ( *c == '%' && escape_percent )
+            fputc ( '%', stream );
+        fputc ( *c, stream );
+    }
+    return true;
+}
+
+// printf takes the format string in RDI, leaving the other 5 registers for values
+#define MAX_PRINTF_VALUES (NUM_REGISTER_PARAMS - 1)
+
+/*
+* Generates code for print statements.
+* Compile time constant items (string literals and numbers) are merged into a printf format string,
+* and the remaining items are passed as arguments, so a print statement usually becomes a single printf call.
+* The print list is split into several calls when there are more values than argument registers,
+* or when an item contains a function call, to make sure everything is printed in the original order.
+*/
+static void generate_printf_statement ( node_t *statement )
 {
     node_t *print_items = statement->children[0];
-    for ( size_t i = 0; i < print_items->n_children; i++ )
+
+    size_t i = 0;
+    do
     {
-        node_t *item = print_items->children[i];
-        if ( item->type == STRING_LIST_REFERENCE )
+        // Build the format string for as many items as we can fit into one printf call
+        char *format;
+        size_t format_length;
+        FILE *format_stream = open_memstream ( &format, &format_length );
+
+        node_t *values[MAX_PRINTF_VALUES];
+        size_t n_values = 0;
+        bool chunk_is_empty = true;
+
+        for ( ; i < print_items->n_children; i++ )
         {
-            EMIT ( "leaq strout(%s), %s", RIP, RDI );
-            EMIT ( "leaq string%zu(%s), %s", (size_t) item->data, RIP, RSI );
+            node_t *item = print_items->children[i];
+            if ( !append_constant_print_item ( format_stream, item, true ) )
+            {
+                // Anything with a call must be evaluated after everything before it is printed
+                bool has_call = item->type != STRING_LIST_REFERENCE && expression_has_call ( item );
+                if ( n_values == MAX_PRINTF_VALUES || ( has_call && !chunk_is_empty ) )
+                    break;
+                values[n_values++] = item;
+                fputs ( item->type == STRING_LIST_REFERENCE ? "%s" : "%ld", format_stream );
+            }
+            chunk_is_empty = false;
         }
-        else
+
+        // The final printf call also prints the newline
+        if ( i == print_items->n_children )
+            fputs ( "\\n", format_stream );
+        fclose ( format_stream );
+
+        // Pushed and popped, since the function may be in a text section of its own, see generate_or_reuse_function
+        int format_label = print_label_counter++;
+        DIRECTIVE ( ".pushsection %s", ASM_STRING_SECTION );
+        DIRECTIVE ( "F%zu_format%d: \t.asciz \"%s\"", current_function->sequence_number, format_label, format );
+        DIRECTIVE ( ".popsection" );
+        free ( format );
+
+        // Evaluate the values from left to right, keeping them on the stack
+        for ( size_t j = 0; j < n_values; j++ )
         {
-            generate_expression ( item );
-            MOVQ ( RAX, RSI );
-            EMIT ( "leaq intout(%s), %s", RIP, RDI );
+            if ( values[j]->type == STRING_LIST_REFERENCE )
+                EMIT ( "leaq string%zu(%s), %s", (size_t) values[j]->data, RIP, RAX );
+            else
+                generate_expression ( values[j] );
+            PUSHQ ( RAX );
         }
+
+        // Pop the values into the argument registers following the format string
+        for ( size_t j = n_values; j > 0; j-- )
+            POPQ ( REGISTER_PARAMS[j] );
+
+        EMIT ( "leaq F%zu_format%d(%s), %s", current_function->sequence_number, format_label, RIP, RDI );
         EMIT ( "call safe_printf" );
+    } while ( i < print_items->n_children );
+}
+
+/* Emits the text as a string in the string section, and a call to write it to the runtime's output buffer */
+static void generate_runtime_text_write ( const char *text )
+{
+    size_t function_number = current_function->sequence_number;
+    int text_label = print_label_counter++;
+    DIRECTIVE ( ".pushsection %s", ASM_STRING_SECTION );
+    DIRECTIVE ( "F%zu_text%d: \t.ascii \"%s\"", function_number, text_label, text );
+    LABEL ( "F%zu_text%d_end", function_number, text_label );
+    DIRECTIVE ( ".popsection" );
+
+    EMIT ( "leaq F%zu_text%d(%s), %s", function_number, text_label, RIP, RSI );
+    // Let the assembler calculate the length, since the text may contain escape sequences
+    EMIT ( "movq $F%zu_text%d_end-F%zu_text%d, %s", function_number, text_label, function_number, text_label, RDX );
+    EMIT ( "call rt_write" );
+}
+
+/*
+* Generates code for print statements when using the freestanding runtime.
+* Runs of constant items are merged into a single piece of text,
+* while other items are evaluated and formatted by the runtime, in order.
+* The runtime only copies into its output buffer, so no system calls are made here.
+*/
+static void generate_runtime_print_statement ( node_t *statement )
+{
+    node_t *print_items = statement->children[0];
+
+    char *text;
+    size_t text_length;
+    FILE *text_stream = open_memstream ( &text, &text_length );
+
+    for ( size_t i = 0; i < print_items->n_children; i++ )
+    {
+        node_t *item = print_items->children[i];
+        if ( append_constant_print_item ( text_stream, item, false ) )
+            continue;
+
+        // Write out the text collected so far, before evaluating the value.
+        // The stream is closed while the value is generated, since an error there leaves this function
+        fclose ( text_stream );
+        if ( text_length > 0 )
+            generate_runtime_text_write ( text );
+        free ( text );
+
+        generate_expression ( item );
+        EMIT ( "call rt_write_int" );
+        text_stream = open_memstream ( &text, &text_length );
     }
 
-    MOVQ ( "$'\\n'", RDI );
-    EMIT ( "call putchar" );
+    fputs ( "\\n", text_stream );
+    fclose ( text_stream );
+    generate_runtime_text_write ( text );
+    free ( text );
+}
+
+static void generate_print_statement ( node_t *statement )
+{
+    if ( use_freestanding_runtime )
+        generate_runtime_print_statement ( statement );
+    else
+        generate_printf_statement ( statement );
 }
 
 static void generate_return_statement ( node_t *statement )
 {
     generate_expression ( statement->children[0] );
+    if ( generate_profiling )
+        generate_profile_exit ( );
     MOVQ ( RBP, RSP );
     POPQ ( RBP );
     RET;
@@ -387,10 +742,26 @@ static void generate_relation ( node_t *relation )
     CMPQ(RCX, RAX);
 }
 
+/* Jumps to the label if the relation in the processor flags is true, or if it is false when when_true is not set */
+static void generate_conditional_jump ( operator_t relation, bool when_true, const char *label )
+{
+    switch ( relation ) {
+        case OPERATOR_EQUAL: if ( when_true ) JE(label); else JNE(label); break;
+        case OPERATOR_NOT_EQUAL: if ( when_true ) JNE(label); else JE(label); break;
+        case OPERATOR_LESS: if ( when_true ) JL(label); else JGE(label); break;
+        case OPERATOR_GREATER: if ( when_true ) JG(label); else JLE(label); break;
+        case OPERATOR_LESS_EQUAL: if ( when_true ) JLE(label); else JG(label); break;
+        case OPERATOR_GREATER_EQUAL: if ( when_true ) JGE(label); else JL(label); break;
+        default:
+            compile_error ( "error: Unknown relation operator" );
+    }
+}
+
 /*
 * Generates code for emitting if-then and if-then-else statements.
 * Checks the number of children to determine which type of if statement it is.
 * Also generates unique labels for each if statement by using a global counter.
+* With -fprofile-use, the block that runs most often follows the condition, see profile.h
 */
 static void generate_if_statement ( node_t *statement )
 {
@@ -403,37 +774,59 @@ static void generate_if_statement ( node_t *statement )
     if (statement->n_children == 3)
         else_statement = statement->children[2];
 
+    // Generate labels for then-block and else-block (if present)
+    size_t function_number = current_function->sequence_number;
+    int if_label = if_label_counter++;
+    char then_label[50];
+    char else_label[50];
+    char end_if_label[50];
+    snprintf(then_label, sizeof(then_label), "F%zu_THEN%d", function_number, if_label);
+    snprintf(else_label, sizeof(else_label), "F%zu_ELSE%d", function_number, if_label);
+    snprintf(end_if_label, sizeof(end_if_label), "F%zu_ENDIF%d", function_number, if_label);
+
+    // With -p, count the runs of the statement, and of the then-block
+    if ( generate_profiling )
+        EMIT ( "incq .prof_if.%s.%d(%s)", current_function->name, if_label, RIP );
+
     // Generate code for the relation
     generate_relation(relation_node);
 
-    // Generate labels for then-block and else-block (if present)
-    static int if_label_counter = 0;
-    int if_label = if_label_counter++;
-    char then_label[20];
-    char else_label[20];
-    char end_if_label[20];
-    snprintf(then_label, sizeof(then_label), "THEN%d", if_label);
-    snprintf(else_label, sizeof(else_label), "ELSE%d", if_label);
-    snprintf(end_if_label, sizeof(end_if_label), "ENDIF%d", if_label);
+    layout_t layout = PROFILE_LAYOUT ( statement );
+    if ( layout == LAYOUT_THEN_FIRST )
+    {
+        // Skip the then-block when the relation is false
+        generate_conditional_jump ( relation_node->operator, false, else_statement != NULL ? else_label : end_if_label );
+        LABEL("%s", then_label);
+        if ( generate_profiling )
+            EMIT ( "incq .prof_if.%s.%d+8(%s)", current_function->name, if_label, RIP );
+        generate_statement(then_statement);
+        if (else_statement != NULL) {
+            JMP(end_if_label);
+            LABEL("%s", else_label);
+            generate_statement(else_statement);
+        }
+        LABEL("%s", end_if_label);
+        return;
+    }
+    if ( layout == LAYOUT_ELSE_FIRST )
+    {
+        // The then-block is placed last, and the rest follows the condition
+        generate_conditional_jump ( relation_node->operator, true, then_label );
+        if (else_statement != NULL) {
+            LABEL("%s", else_label);
+            generate_statement(else_statement);
+        }
+        JMP(end_if_label);
+        LABEL("%s", then_label);
+        if ( generate_profiling )
+            EMIT ( "incq .prof_if.%s.%d+8(%s)", current_function->name, if_label, RIP );
+        generate_statement(then_statement);
+        LABEL("%s", end_if_label);
+        return;
+    }
 
     // Use conditional branching based on the relation
-    if (strcmp(relation_node->data, "=") == 0) {
-        JE(then_label);
-    } else if (strcmp(relation_node->data, "!=") == 0) {
-        JNE(then_label);
-    } else if (strcmp(relation_node->data, "<") == 0) {
-        JL(then_label);
-    } else if (strcmp(relation_node->data, ">") == 0) {
-        JG(then_label);
-    } else if (strcmp(relation_node->data, "<=") == 0) {
-        JLE(then_label);
-    } else if (strcmp(relation_node->data, ">=") == 0) {
-        JGE(then_label);
-    } else {
-        fprintf(stderr, "error: Unknown relation operator\n");
-        // fprintf(stderr, "error: '%s' is not a valid relation operator\n", relation_node->data);
-        exit(EXIT_FAILURE);
-    }
+    generate_conditional_jump ( relation_node->operator, true, then_label );
 
     // If there's an else-statement, jump to the else block
     if (else_statement != NULL)
@@ -443,6 +836,8 @@ static void generate_if_statement ( node_t *statement )
 
     // Emit label for then-block
     LABEL("%s", then_label);
+    if ( generate_profiling )
+        EMIT ( "incq .prof_if.%s.%d+8(%s)", current_function->name, if_label, RIP );
 
     // Generate code for then-statement
     generate_statement(then_statement);
@@ -460,52 +855,70 @@ static void generate_if_statement ( node_t *statement )
     LABEL("%s", end_if_label);
 }
 
-// Global variable to store the label of the innermost while-loop
-static const char* innermost_while_label = NULL;
-
 /*
 * Generates code for while loops.
 * Generates unique labels for the start and end of the while loop to allow for nested while loops.
+* With -fprofile-use, loops that usually iterate test their condition at the bottom, and the hot ones
+* with small bodies have the body generated twice, see profile.h
 */
 static void generate_while_statement ( node_t *statement )
 {
     // Generate a unique label for the start of the while loop
-    static int while_label_counter = 0;
+    size_t function_number = current_function->sequence_number;
     int while_label = while_label_counter++;
-    char while_start_label[20];
-    snprintf(while_start_label, sizeof(while_start_label), "WHILE%d", while_label);
+    char while_start_label[50];
+    snprintf(while_start_label, sizeof(while_start_label), "F%zu_WHILE%d", function_number, while_label);
 
     // Generate a unique label for the end of the while loop
-    char while_end_label[20];
-    snprintf(while_end_label, sizeof(while_end_label), "ENDWHILE%d", while_label);
+    char while_end_label[50];
+    snprintf(while_end_label, sizeof(while_end_label), "F%zu_ENDWHILE%d", function_number, while_label);
 
     // Save the label of the current innermost while-loop
     const char* outer_while_label = innermost_while_label;
     innermost_while_label = while_end_label;
 
+    // With -p, count the runs of the loop, and its iterations
+    if ( generate_profiling )
+        EMIT ( "incq .prof_while.%s.%d(%s)", current_function->name, while_label, RIP );
+
+    node_t *relation = statement->children[0];
+    layout_t layout = PROFILE_LAYOUT ( statement );
+    if ( layout == LAYOUT_ROTATED || layout == LAYOUT_UNROLLED )
+    {
+        char while_test_label[50];
+        snprintf(while_test_label, sizeof(while_test_label), "F%zu_WHILETEST%d", function_number, while_label);
+
+        JMP(while_test_label);
+        LABEL("%s", while_start_label);
+        if ( generate_profiling )
+            EMIT ( "incq .prof_while.%s.%d+8(%s)", current_function->name, while_label, RIP );
+        generate_statement(statement->children[1]);
+        if ( layout == LAYOUT_UNROLLED )
+        {
+            generate_relation(relation);
+            generate_conditional_jump ( relation->operator, false, while_end_label );
+            if ( generate_profiling )
+                EMIT ( "incq .prof_while.%s.%d+8(%s)", current_function->name, while_label, RIP );
+            generate_statement(statement->children[1]);
+        }
+        LABEL("%s", while_test_label);
+        generate_relation(relation);
+        generate_conditional_jump ( relation->operator, true, while_start_label );
+        LABEL("%s", while_end_label);
+        innermost_while_label = outer_while_label;
+        return;
+    }
+
     // Emit the label marking the start of the while loop
     LABEL("%s", while_start_label);
 
     // Generate code for the relation
-    generate_relation(statement->children[0]);
+    generate_relation(relation);
 
     // Use conditional branching based on the relation
-    if (strcmp(statement->children[0]->data, "=") == 0) {
-        JNE(while_end_label);
-    } else if (strcmp(statement->children[0]->data, "!=") == 0) {
-        JE(while_end_label);
-    } else if (strcmp(statement->children[0]->data, "<") == 0) {
-        JGE(while_end_label);
-    } else if (strcmp(statement->children[0]->data, ">") == 0) {
-        JLE(while_end_label);
-    } else if (strcmp(statement->children[0]->data, "<=") == 0) {
-        JG(while_end_label);
-    } else if (strcmp(statement->children[0]->data, ">=") == 0) {
-        JL(while_end_label);
-    } else {
-        fprintf(stderr, "error: Unknown relation operator\n");
-        exit(EXIT_FAILURE);
-    }
+    generate_conditional_jump ( relation->operator, false, while_end_label );
+    if ( generate_profiling )
+        EMIT ( "incq .prof_while.%s.%d+8(%s)", current_function->name, while_label, RIP );
 
     // Generate code for the loop body
     generate_statement(statement->children[1]);
@@ -526,11 +939,8 @@ static void generate_while_statement ( node_t *statement )
 */
 static void generate_break_statement ( )
 {
-    // Ensure that we are inside a while-loop
-    if (innermost_while_label == NULL) {
-        fprintf(stderr, "error: 'break' statement used outside of a while-loop\n");
-        exit(EXIT_FAILURE);
-    }
+    // Breaks outside of while-loops are reported when names are bound
+    assert ( innermost_while_label != NULL );
 
     // Emit code to jump to the end of the innermost while-loop
     JMP(innermost_while_label);
@@ -592,6 +1002,15 @@ static void generate_safe_printf ( void )
 
 static void generate_main ( symbol_t *first )
 {
+    // Without libc, the program starts at _start, with argc and argv on the stack.
+    // Move them into the registers where main expects them
+    if ( use_freestanding_runtime )
+    {
+        LABEL ( "_start" );
+        MOVQ ( MEM(RSP), RDI );
+        EMIT ( "leaq 8(%s), %s", RSP, RSI );
+    }
+
     // Make the globally available main function
     LABEL ( "main" );
 
@@ -599,6 +1018,17 @@ static void generate_main ( symbol_t *first )
     PUSHQ ( RBP );
     MOVQ ( RSP, RBP );
 
+    // With -p, the profile is written however the program exits. The stack is aligned for the call here
+    if ( generate_profiling )
+    {
+        PUSHQ ( RDI );
+        PUSHQ ( RSI );
+        EMIT ( "leaq vslc_profile_dump(%s), %s", RIP, RDI );
+        EMIT ( "call atexit" );
+        POPQ ( RSI );
+        POPQ ( RDI );
+    }
+
     // Which registers argc and argv are passed in
     const char* argc = RDI;
     const char* argv = RSI;
@@ -626,9 +1056,16 @@ static void generate_main ( symbol_t *first )
 
     // Now call strtol to parse the argument
     EMIT ( "movq (%s), %s", argv, RDI ); // 1st argument, the char *
-    MOVQ ( "$0", RSI ); // 2nd argument, a null pointer
-    MOVQ ( "$10", RDX ); //3rd argument, we want base 10
-    EMIT ( "call strtol" );
+    if ( use_freestanding_runtime )
+    {
+        EMIT ( "call rt_parse_int" );
+    }
+    else
+    {
+        MOVQ ( "$0", RSI ); // 2nd argument, a null pointer
+        MOVQ ( "$10", RDX ); //3rd argument, we want base 10
+        EMIT ( "call strtol" );
+    }
 
     // Restore caller saved registers
     POPQ ( RCX );
@@ -644,18 +1081,404 @@ static void generate_main ( symbol_t *first )
 
     skip_args:
 
+    const char *exit_function = use_freestanding_runtime ? "rt_exit" : "exit";
+
     EMIT ( "call .%s", first->name );
     MOVQ ( RAX, RDI ); // Move the return value of the function into RDI
-    EMIT ( "call exit" ); // Exit with the return value as exit code
+    EMIT ( "call %s", exit_function ); // Exit with the return value as exit code
 
     LABEL ( "ABORT" ); // In case of incorrect number of arguments
-    EMIT ( "leaq errout(%s), %s", RIP, RDI );
-    EMIT ( "call puts" ); // print the errout string
+    if ( use_freestanding_runtime )
+    {
+        EMIT ( "leaq errout(%s), %s", RIP, RSI );
+        EMIT ( "call rt_write_cstr" ); // print the errout string
+        EMIT ( "leaq rt_newline(%s), %s", RIP, RSI );
+        MOVQ ( "$1", RDX );
+        EMIT ( "call rt_write" );
+    }
+    else
+    {
+        EMIT ( "leaq errout(%s), %s", RIP, RDI );
+        EMIT ( "call puts" ); // print the errout string
+    }
     MOVQ ( "$1", RDI );
-    EMIT ( "call exit" ); // Exit with return code 1
+    EMIT ( "call %s", exit_function ); // Exit with return code 1
+
+    if ( use_freestanding_runtime )
+    {
+        generate_runtime ( );
+        // The linker looks for _start when there is no libc
+        DIRECTIVE ( ".global _start" );
+        return;
+    }
 
     generate_safe_printf();
+    if ( generate_profiling )
+        generate_profile_dump ( );
 
     // Declares global symbols we use or emit, such as main, printf and putchar
     DIRECTIVE ( "%s", ASM_DECLARE_SYMBOLS );
 }
+
+/* A module has no main, and without libc it uses the runtime routines of the main program */
+static void generate_module_end ( void )
+{
+    if ( use_freestanding_runtime )
+        return;
+
+    // The profile of the module's functions is written by the main program
+    if ( generate_profiling )
+        DIRECTIVE ( ".comm vslc_profile_children, 8, 8" );
+
+    generate_safe_printf();
+#ifdef ASM_DECLARE_LIBC_SYMBOLS
+    DIRECTIVE ( "%s", ASM_DECLARE_LIBC_SYMBOLS );
+#endif
+}
+
+/*
+* Profiling with -p.
+* Each function has a record of 3 quadwords in .bss: its number of calls, the cycles spent in it including the
+* functions it calls, and the cycles spent in the function itself. Each function it calls has a quadword counting
+* those calls. The time comes from rdtsc, and is kept on the stack below the local variables, along with the time
+* the caller had spent in other calls so far, which vslc_profile_children holds for the function running.
+*
+* Each if statement and while loop has 2 quadwords: the times it was reached, and the runs of its then-block,
+* or the iterations of the loop.
+*
+* Each function describes its counters in the vslc_profile section, 4 quadwords per counter: its kind, the name of
+* the function, the name of the function called or the label of the statement, and the counters.
+* The linker gathers them from every module, between __start_vslc_profile and __stop_vslc_profile,
+* and vslc_profile_dump writes them at exit to the file named by $VSLC_PROFILE, or vslc.prof, one line each:
+*     function <name> <calls> <cycles> <self cycles>
+*     call <caller> <callee> <calls>
+*     branch <function> THEN<number> <runs> <runs of the then-block>
+*     loop <function> WHILE<number> <runs> <iterations>
+* -fprofile-use reads them back, see profile.h
+*/
+
+// The kinds of counters in the vslc_profile section, in the order of their formats in vslc_profile_dump
+enum { PROFILE_FUNCTION, PROFILE_CALL, PROFILE_BRANCH, PROFILE_LOOP };
+
+// The functions called by the function being generated, each of which has a counter
+static _Thread_local symbol_t **profile_callees = NULL;
+static _Thread_local size_t n_profile_callees = 0;
+static _Thread_local size_t profile_callees_capacity = 0;
+
+/* Returns the place of the given quadword below the parameters and local variables */
+static const char* profile_slot ( size_t slot )
+{
+    static _Thread_local char result[32];
+    snprintf ( result, sizeof(result), "%ld(%s)", -(long) ( n_frame_slots + slot + 1 ) * 8, RBP );
+    return result;
+}
+
+/* Reads the time stamp counter into RAX. Clobbers RDX */
+static void generate_read_time ( void )
+{
+    EMIT ( "rdtsc" );
+    EMIT ( "shlq $32, %s", RDX );
+    EMIT ( "orq %s, %s", RDX, RAX );
+}
+
+/* Counts the call, and saves the time it started and the time the caller had spent in other calls.
+ * The parameters are on the stack by now, so RDX is free */
+static void generate_profile_entry ( void )
+{
+    n_profile_callees = 0;
+    EMIT ( "incq .prof.%s(%s)", current_function->name, RIP );
+    generate_read_time ( );
+    PUSHQ ( RAX );
+    EMIT ( "pushq vslc_profile_children(%s)", RIP );
+    EMIT ( "movq $0, vslc_profile_children(%s)", RIP );
+}
+
+/* Adds the time since the entry to the function's counters, and to the time the caller has spent in calls.
+ * Keeps the return value in RAX */
+static void generate_profile_exit ( void )
+{
+    MOVQ ( RAX, RCX );
+    generate_read_time ( );
+    SUBQ ( profile_slot ( 0 ), RAX );
+    EMIT ( "addq %s, .prof.%s+8(%s)", RAX, current_function->name, RIP );
+    MOVQ ( RAX, RDX );
+    EMIT ( "subq vslc_profile_children(%s), %s", RIP, RDX );
+    EMIT ( "addq %s, .prof.%s+16(%s)", RDX, current_function->name, RIP );
+    ADDQ ( profile_slot ( 1 ), RAX );
+    EMIT ( "movq %s, vslc_profile_children(%s)", RAX, RIP );
+    MOVQ ( RCX, RAX );
+}
+
+/* Counts a call from the current function to the callee, which gets a counter the first time */
+static void generate_profile_call_count ( symbol_t *callee )
+{
+    size_t i = 0;
+    while ( i < n_profile_callees && profile_callees[i] != callee )
+        i++;
+    if ( i == n_profile_callees )
+    {
+        if ( n_profile_callees == profile_callees_capacity )
+        {
+            profile_callees_capacity = profile_callees_capacity > 0 ? profile_callees_capacity * 2 : 8;
+            profile_callees = realloc ( profile_callees, profile_callees_capacity * sizeof(symbol_t*) );
+        }
+        profile_callees[n_profile_callees++] = callee;
+    }
+    EMIT ( "incq .prof.%s.%s(%s)", current_function->name, callee->name, RIP );
+}
+
+/* Places the counters of the function, their descriptions, and the names they use */
+static void generate_profile_data ( symbol_t *function )
+{
+    DIRECTIVE ( ".section %s", ASM_BSS_SECTION );
+    DIRECTIVE ( ".align 8" );
+    DIRECTIVE ( ".prof.%s: \t.zero 24", function->name );
+    for ( size_t i = 0; i < n_profile_callees; i++ )
+        DIRECTIVE ( ".prof.%s.%s: \t.zero 8", function->name, profile_callees[i]->name );
+    for ( int i = 0; i < if_label_counter; i++ )
+        DIRECTIVE ( ".prof_if.%s.%d: \t.zero 16", function->name, i );
+    for ( int i = 0; i < while_label_counter; i++ )
+        DIRECTIVE ( ".prof_while.%s.%d: \t.zero 16", function->name, i );
+
+    DIRECTIVE ( ".section %s", ASM_STRING_SECTION );
+    DIRECTIVE ( ".prof_name.%s: \t.asciz \"%s\"", function->name, function->name );
+    for ( size_t i = 0; i < n_profile_callees; i++ )
+        DIRECTIVE ( ".prof_name.%s.%s: \t.asciz \"%s\"", function->name, profile_callees[i]->name,
+                    profile_callees[i]->name );
+    for ( int i = 0; i < if_label_counter; i++ )
+        DIRECTIVE ( ".prof_if_name.%s.%d: \t.asciz \"THEN%d\"", function->name, i, i );
+    for ( int i = 0; i < while_label_counter; i++ )
+        DIRECTIVE ( ".prof_while_name.%s.%d: \t.asciz \"WHILE%d\"", function->name, i, i );
+
+    DIRECTIVE ( ".section vslc_profile, \"aw\"" );
+    DIRECTIVE ( ".align 8" );
+    DIRECTIVE ( "\t.quad %d, .prof_name.%s, 0, .prof.%s", PROFILE_FUNCTION, function->name, function->name );
+    for ( size_t i = 0; i < n_profile_callees; i++ )
+        DIRECTIVE ( "\t.quad %d, .prof_name.%s, .prof_name.%s.%s, .prof.%s.%s", PROFILE_CALL, function->name,
+                    function->name, profile_callees[i]->name, function->name, profile_callees[i]->name );
+    for ( int i = 0; i < if_label_counter; i++ )
+        DIRECTIVE ( "\t.quad %d, .prof_name.%s, .prof_if_name.%s.%d, .prof_if.%s.%d", PROFILE_BRANCH,
+                    function->name, function->name, i, function->name, i );
+    for ( int i = 0; i < while_label_counter; i++ )
+        DIRECTIVE ( "\t.quad %d, .prof_name.%s, .prof_while_name.%s.%d, .prof_while.%s.%d", PROFILE_LOOP,
+                    function->name, function->name, i, function->name, i );
+    DIRECTIVE ( ".text" );
+
+    free ( profile_callees );
+    profile_callees = NULL;
+    n_profile_callees = profile_callees_capacity = 0;
+}
+
+/* Emits vslc_profile_dump, which the main program registers with atexit */
+static void generate_profile_dump ( void )
+{
+    DIRECTIVE ( ".comm vslc_profile_children, 8, 8" );
+    DIRECTIVE ( ".section %s", ASM_STRING_SECTION );
+    DIRECTIVE ( "profile_variable: \t.asciz \"VSLC_PROFILE\"" );
+    DIRECTIVE ( "profile_default_path: \t.asciz \"vslc.prof\"" );
+    DIRECTIVE ( "profile_mode: \t.asciz \"w\"" );
+    DIRECTIVE ( "profile_function_format: \t.asciz \"function %%s %%ld %%ld %%ld\\n\"" );
+    DIRECTIVE ( "profile_call_format: \t.asciz \"call %%s %%s %%ld\\n\"" );
+    DIRECTIVE ( "profile_branch_format: \t.asciz \"branch %%s %%s %%ld %%ld\\n\"" );
+    DIRECTIVE ( "profile_loop_format: \t.asciz \"loop %%s %%s %%ld %%ld\\n\"" );
+    DIRECTIVE ( ".data" );
+    DIRECTIVE ( ".align 8" );
+    DIRECTIVE ( "profile_formats: \t.quad profile_function_format, profile_call_format, profile_branch_format, "
+                "profile_loop_format" );
+    DIRECTIVE ( ".text" );
+
+    LABEL ( "vslc_profile_dump" );
+    PUSHQ ( RBP );
+    MOVQ ( RSP, RBP );
+    // RBX walks through the descriptions, and R12 holds the file. Both are callee saved, and keep the stack aligned
+    PUSHQ ( RBX );
+    PUSHQ ( R12 );
+
+    EMIT ( "leaq profile_variable(%s), %s", RIP, RDI );
+    EMIT ( "call getenv" );
+    EMIT ( "testq %s, %s", RAX, RAX );
+    JNE ( "PROFILE_OPEN" );
+    EMIT ( "leaq profile_default_path(%s), %s", RIP, RAX );
+    LABEL ( "PROFILE_OPEN" );
+    MOVQ ( RAX, RDI );
+    EMIT ( "leaq profile_mode(%s), %s", RIP, RSI );
+    EMIT ( "call fopen" );
+    EMIT ( "testq %s, %s", RAX, RAX );
+    JE ( "PROFILE_DONE" );
+    MOVQ ( RAX, R12 );
+
+    EMIT ( "leaq __start_vslc_profile(%s), %s", RIP, RBX );
+    LABEL ( "PROFILE_LOOP" );
+    EMIT ( "leaq __stop_vslc_profile(%s), %s", RIP, RAX );
+    CMPQ ( RAX, RBX );
+    EMIT ( "jae PROFILE_CLOSE" );
+    // The format of the kind of counter
+    MOVQ ( MEM(RBX), RCX );
+    EMIT ( "leaq profile_formats(%s), %s", RIP, RSI );
+    MOVQ ( ARRAY_MEM(RSI, RCX, "8"), RSI );
+    MOVQ ( "24(" RBX ")", RAX ); // The counters
+    MOVQ ( R12, RDI );
+    MOVQ ( "8(" RBX ")", RDX );
+    EMIT ( "cmpq $%d, (%s)", PROFILE_FUNCTION, RBX );
+    JNE ( "PROFILE_OTHER" );
+
+    MOVQ ( MEM(RAX), RCX );
+    MOVQ ( "8(" RAX ")", R8 );
+    MOVQ ( "16(" RAX ")", R9 );
+    JMP ( "PROFILE_PRINT" );
+
+    // The others have a second name, and a call has one counter, while the rest have two
+    LABEL ( "PROFILE_OTHER" );
+    MOVQ ( "16(" RBX ")", RCX );
+    MOVQ ( MEM(RAX), R8 );
+    EMIT ( "cmpq $%d, (%s)", PROFILE_CALL, RBX );
+    JE ( "PROFILE_PRINT" );
+    MOVQ ( "8(" RAX ")", R9 );
+
+    LABEL ( "PROFILE_PRINT" );
+    MOVQ ( "$0", RAX ); // No vector registers are used by the variadic call
+    EMIT ( "call fprintf" );
+    ADDQ ( "$32", RBX );
+    JMP ( "PROFILE_LOOP" );
+
+    LABEL ( "PROFILE_CLOSE" );
+    MOVQ ( R12, RDI );
+    EMIT ( "call fclose" );
+    LABEL ( "PROFILE_DONE" );
+    POPQ ( R12 );
+    POPQ ( RBX );
+    POPQ ( RBP );
+    RET;
+}
+
+/*
+* Generating functions on several threads, see parallel.h.
+* Each thread generates functions into its own output buffer.
+* Afterwards, the code of each function is copied from the buffers in symbol table order,
+* so the output is exactly the same as when the functions are generated one at a time.
+*/
+
+// Where the code of one function ended up
+typedef struct
+{
+    int thread;        // The thread that generated it
+    size_t start, end; // Its place in the thread's output
+} function_output_t;
+
+// One thread's output, from open_memstream
+typedef struct
+{
+    char *data;
+    size_t length;
+} thread_output_t;
+
+typedef struct
+{
+    symbol_t **functions;
+    function_output_t *function_outputs;
+    thread_output_t *thread_outputs;
+
+    // The parts of the compilation's state that code generation reads.
+    // They belong to the thread calling generate_program, and are copied to the other threads
+    const char *source;
+    size_t source_length;
+    source_slice_t *string_list;
+    size_t string_list_len;
+    bool use_freestanding_runtime;
+    bool generate_profiling;
+    bool compile_as_module;
+    function_cache_t *function_cache; // Shared by all threads
+} generation_t;
+
+static void start_generation_thread ( void *context, int thread )
+{
+    generation_t *generation = context;
+    source = generation->source;
+    source_length = generation->source_length;
+    string_list = generation->string_list;
+    string_list_len = generation->string_list_len;
+    use_freestanding_runtime = generation->use_freestanding_runtime;
+    generate_profiling = generation->generate_profiling;
+    compile_as_module = generation->compile_as_module;
+    function_cache = generation->function_cache;
+
+    thread_output_t *output = &generation->thread_outputs[thread];
+    output_stream = open_memstream ( &output->data, &output->length );
+}
+
+static void stop_generation_thread ( void *context, int thread )
+{
+    fclose ( output_stream );
+    output_stream = NULL;
+    // The borrowed state is still owned by the calling thread
+    source = NULL;
+    string_list = NULL;
+    function_cache = NULL;
+}
+
+static void generate_function_task ( void *context, int thread, size_t task )
+{
+    generation_t *generation = context;
+    thread_output_t *thread_output = &generation->thread_outputs[thread];
+    function_output_t *output = &generation->function_outputs[task];
+
+    // Flushing updates the length of the output, and is cheaper than ftell on a memstream
+    fflush ( output_stream );
+    *output = (function_output_t) { .thread = thread, .start = thread_output->length };
+    generate_or_reuse_function ( generation->functions[task] );
+    fflush ( output_stream );
+    output->end = thread_output->length;
+}
+
+/* Returns false without generating anything if no thread could be started */
+static bool generate_functions_in_parallel ( int jobs )
+{
+    generation_t generation = {
+        .functions = malloc ( global_symbols->n_symbols * sizeof(symbol_t*) ),
+        .thread_outputs = calloc ( jobs, sizeof(thread_output_t) ),
+        .source = source,
+        .source_length = source_length,
+        .string_list = string_list,
+        .string_list_len = string_list_len,
+        .use_freestanding_runtime = use_freestanding_runtime,
+        .generate_profiling = generate_profiling,
+        .compile_as_module = compile_as_module,
+        .function_cache = function_cache
+    };
+    size_t n_functions = 0;
+    for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+            generation.functions[n_functions++] = global_symbols->symbols[i];
+    generation.function_outputs = calloc ( n_functions, sizeof(function_output_t) );
+
+    parallel_tasks_t tasks = {
+        .n_tasks = n_functions,
+        .context = &generation,
+        .start_thread = start_generation_thread,
+        .stop_thread = stop_generation_thread,
+        .run_task = generate_function_task
+    };
+    size_t failed_function;
+    char *error;
+    bool started = run_in_parallel ( &tasks, jobs, &failed_function, &error );
+
+    // Whatever the failed function generated before the error is output too, like when generating in order
+    for ( size_t i = 0; started && i < n_functions && i <= failed_function; i++ )
+    {
+        function_output_t *output = &generation.function_outputs[i];
+        if ( i == failed_function )
+            output->end = generation.thread_outputs[output->thread].length;
+        fwrite ( generation.thread_outputs[output->thread].data + output->start, 1,
+                 output->end - output->start, output_stream );
+    }
+
+    for ( int i = 0; i < jobs; i++ )
+        free ( generation.thread_outputs[i].data );
+    free ( generation.thread_outputs );
+    free ( generation.function_outputs );
+    free ( generation.functions );
+
+    if ( error != NULL )
+        rethrow_error ( error );
+    return started;
+}
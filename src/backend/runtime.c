@@ -0,0 +1,238 @@
+#include "vslc.h"
+
+// This header defines a bunch of macros we can use to emit assembly to the output stream
+#include "emit.h"
+
+// The freestanding runtime replaces libc in programs compiled with -nostdlib.
+// All output goes through a buffer in .bss, which is written to stdout with the write(2) syscall
+// when it fills up, and when the program exits.
+// The runtime routines may clobber all caller saved registers, just like libc functions.
+
+#define RUNTIME_BUFFER_SIZE 65536
+
+// Linux x86-64 system call numbers
+#define SYS_WRITE 1
+#define SYS_EXIT_GROUP 231
+#define STDOUT_FILENO 1
+
+static void generate_runtime_write ( void );
+static void generate_runtime_write_int ( void );
+static void generate_runtime_write_cstr ( void );
+static void generate_runtime_parse_int ( void );
+static void generate_runtime_exit ( void );
+
+/* Emits the output buffer and the lookup table used for integer formatting */
+void generate_runtime_data ( void )
+{
+    DIRECTIVE ( ".section %s", ASM_STRING_SECTION );
+    DIRECTIVE ( "rt_newline: .ascii \"\\n\"" );
+
+    // All two digit numbers "00" to "99" after each other, so integers can be printed two digits at a time
+    fprintf ( output_stream, "rt_digit_pairs: .ascii \"" );
+    for ( int i = 0; i < 100; i++ )
+        fprintf ( output_stream, "%02d", i );
+    fprintf ( output_stream, "\"\n" );
+
+    DIRECTIVE ( ".section %s", ASM_BSS_SECTION );
+    DIRECTIVE ( ".align 8" );
+    DIRECTIVE ( "rt_buffer_used: \t.zero 8" );
+    DIRECTIVE ( "rt_buffer: \t.zero %d", RUNTIME_BUFFER_SIZE );
+}
+
+/* Emits all routines of the runtime. Expects to be in the .text section */
+void generate_runtime ( void )
+{
+    generate_runtime_write ( );
+    generate_runtime_write_int ( );
+    generate_runtime_write_cstr ( );
+    generate_runtime_parse_int ( );
+    generate_runtime_exit ( );
+
+    // Modules compiled with --no-main print through the runtime of the program they are linked with
+    DIRECTIVE ( ".global rt_write" );
+    DIRECTIVE ( ".global rt_write_int" );
+}
+
+/*
+* rt_write copies %rdx bytes starting at %rsi into the output buffer.
+* rt_flush empties the buffer, and rt_write_stdout writes %rdx bytes at %rsi directly to stdout.
+*/
+static void generate_runtime_write ( void )
+{
+    LABEL ( "rt_write" );
+    EMIT ( "movq rt_buffer_used(%s), %s", RIP, RAX );
+    EMIT ( "leaq (%s, %s), %s", RAX, RDX, RCX );
+    EMIT ( "cmpq $%d, %s", RUNTIME_BUFFER_SIZE, RCX );
+    EMIT ( "jbe rt_write_copy" );
+
+    // The text doesn't fit, so flush the buffer first
+    PUSHQ ( RSI );
+    PUSHQ ( RDX );
+    EMIT ( "call rt_flush" );
+    POPQ ( RDX );
+    POPQ ( RSI );
+    MOVQ ( "$0", RAX );
+    // Text larger than the whole buffer is written directly instead
+    EMIT ( "cmpq $%d, %s", RUNTIME_BUFFER_SIZE, RDX );
+    EMIT ( "ja rt_write_stdout" );
+
+    LABEL ( "rt_write_copy" );
+    EMIT ( "leaq rt_buffer(%s), %s", RIP, RDI );
+    ADDQ ( RAX, RDI );
+    EMIT ( "addq %s, rt_buffer_used(%s)", RDX, RIP );
+    MOVQ ( RDX, RCX );
+    EMIT ( "rep movsb" ); // Copies %rcx bytes from (%rsi) to (%rdi)
+    RET;
+
+    LABEL ( "rt_flush" );
+    EMIT ( "leaq rt_buffer(%s), %s", RIP, RSI );
+    EMIT ( "movq rt_buffer_used(%s), %s", RIP, RDX );
+    EMIT ( "movq $0, rt_buffer_used(%s)", RIP );
+
+    // write(2) may write less than requested, so keep going until everything is written
+    LABEL ( "rt_write_stdout" );
+    EMIT ( "testq %s, %s", RDX, RDX );
+    EMIT ( "jle rt_write_stdout_done" );
+    EMIT ( "movq $%d, %s", STDOUT_FILENO, RDI );
+    EMIT ( "movq $%d, %s", SYS_WRITE, RAX );
+    EMIT ( "syscall" ); // Clobbers %rcx and %r11, the arguments are preserved
+    EMIT ( "testq %s, %s", RAX, RAX );
+    EMIT ( "jle rt_write_stdout_done" ); // Give up on errors
+    ADDQ ( RAX, RSI );
+    SUBQ ( RAX, RDX );
+    JMP ( "rt_write_stdout" );
+    LABEL ( "rt_write_stdout_done" );
+    RET;
+}
+
+/*
+* rt_write_int writes the signed integer in %rax to the output buffer, in decimal.
+* The digits are produced from right to left into a scratch area on the stack, two at a time.
+* Division by 100 is done with a multiplication by its fixed point reciprocal, instead of divq.
+*/
+static void generate_runtime_write_int ( void )
+{
+    LABEL ( "rt_write_int" );
+    SUBQ ( "$32", RSP );
+    EMIT ( "leaq 32(%s), %s", RSP, RSI ); // Digits are written backwards from the end of the scratch area
+    EMIT ( "leaq rt_digit_pairs(%s), %s", RIP, R9 );
+    MOVQ ( RAX, R8 ); // Remember the sign
+    EMIT ( "testq %s, %s", RAX, RAX );
+    EMIT ( "jns rt_write_int_loop" );
+    NEGQ ( RAX ); // The most negative number stays the same, which is still correct when seen as unsigned
+
+    LABEL ( "rt_write_int_loop" );
+    EMIT ( "cmpq $100, %s", RAX );
+    EMIT ( "jb rt_write_int_last" );
+    MOVQ ( RAX, RCX );
+    EMIT ( "shrq $2, %s", RAX );
+    EMIT ( "movabsq $0x28F5C28F5C28F5C3, %s", RDX );
+    EMIT ( "mulq %s", RDX ); // %rdx = ((x >> 2) * magic) >> 64
+    EMIT ( "shrq $2, %s", RDX ); // %rdx = x / 100
+    EMIT ( "imulq $100, %s, %s", RDX, RAX );
+    SUBQ ( RAX, RCX ); // %rcx = x % 100
+    EMIT ( "movzwl (%s, %s, 2), %%eax", R9, RCX );
+    SUBQ ( "$2", RSI );
+    EMIT ( "movw %%ax, (%s)", RSI );
+    MOVQ ( RDX, RAX );
+    JMP ( "rt_write_int_loop" );
+
+    // Less than 100 is left, which is either one or two digits
+    LABEL ( "rt_write_int_last" );
+    EMIT ( "cmpq $10, %s", RAX );
+    EMIT ( "jb rt_write_int_single" );
+    EMIT ( "movzwl (%s, %s, 2), %%eax", R9, RAX );
+    SUBQ ( "$2", RSI );
+    EMIT ( "movw %%ax, (%s)", RSI );
+    JMP ( "rt_write_int_sign" );
+    LABEL ( "rt_write_int_single" );
+    EMIT ( "addq $'0', %s", RAX );
+    SUBQ ( "$1", RSI );
+    EMIT ( "movb %%al, (%s)", RSI );
+
+    LABEL ( "rt_write_int_sign" );
+    EMIT ( "testq %s, %s", R8, R8 );
+    EMIT ( "jns rt_write_int_done" );
+    SUBQ ( "$1", RSI );
+    EMIT ( "movb $'-', (%s)", RSI );
+
+    LABEL ( "rt_write_int_done" );
+    EMIT ( "leaq 32(%s), %s", RSP, RDX );
+    SUBQ ( RSI, RDX ); // The length is the distance from the first digit to the end
+    EMIT ( "call rt_write" );
+    ADDQ ( "$32", RSP );
+    RET;
+}
+
+/* rt_write_cstr writes the NUL-terminated string at %rsi to the output buffer */
+static void generate_runtime_write_cstr ( void )
+{
+    LABEL ( "rt_write_cstr" );
+    MOVQ ( "$0", RDX );
+    LABEL ( "rt_write_cstr_loop" );
+    EMIT ( "cmpb $0, (%s, %s)", RSI, RDX );
+    EMIT ( "je rt_write" );
+    EMIT ( "incq %s", RDX );
+    JMP ( "rt_write_cstr_loop" );
+}
+
+/*
+* rt_parse_int parses the string at %rdi as a base 10 integer, returning it in %rax.
+* Like strtol, leading whitespace and a sign are accepted, and parsing stops at the first non-digit.
+* Unlike strtol, out of range values wrap around instead of saturating.
+*/
+static void generate_runtime_parse_int ( void )
+{
+    LABEL ( "rt_parse_int" );
+    MOVQ ( "$0", RAX );
+    MOVQ ( "$0", R8 ); // Set to 1 if the number is negative
+
+    LABEL ( "rt_parse_int_space" );
+    EMIT ( "movzbl (%s), %%ecx", RDI );
+    EMIT ( "cmpb $' ', %s", CL );
+    EMIT ( "je rt_parse_int_skip" );
+    // '\t' to '\r' are the other whitespace characters
+    EMIT ( "leal -9(%%rcx), %%edx" );
+    EMIT ( "cmpl $4, %%edx" );
+    EMIT ( "ja rt_parse_int_sign" );
+    LABEL ( "rt_parse_int_skip" );
+    EMIT ( "incq %s", RDI );
+    JMP ( "rt_parse_int_space" );
+
+    LABEL ( "rt_parse_int_sign" );
+    EMIT ( "cmpb $'+', %s", CL );
+    EMIT ( "je rt_parse_int_sign_done" );
+    EMIT ( "cmpb $'-', %s", CL );
+    EMIT ( "jne rt_parse_int_digits" );
+    MOVQ ( "$1", R8 );
+    LABEL ( "rt_parse_int_sign_done" );
+    EMIT ( "incq %s", RDI );
+
+    LABEL ( "rt_parse_int_digits" );
+    EMIT ( "movzbl (%s), %%ecx", RDI );
+    EMIT ( "subl $'0', %%ecx" );
+    EMIT ( "cmpl $9, %%ecx" );
+    EMIT ( "ja rt_parse_int_done" ); // Also catches characters below '0', as they wrap around
+    IMULQ ( "$10", RAX );
+    ADDQ ( RCX, RAX );
+    EMIT ( "incq %s", RDI );
+    JMP ( "rt_parse_int_digits" );
+
+    LABEL ( "rt_parse_int_done" );
+    EMIT ( "testq %s, %s", R8, R8 );
+    EMIT ( "jz rt_parse_int_return" );
+    NEGQ ( RAX );
+    LABEL ( "rt_parse_int_return" );
+    RET;
+}
+
+/* rt_exit flushes the output buffer, and exits the process with the exit code in %rdi */
+static void generate_runtime_exit ( void )
+{
+    LABEL ( "rt_exit" );
+    PUSHQ ( RDI );
+    EMIT ( "call rt_flush" );
+    POPQ ( RDI );
+    EMIT ( "movq $%d, %s", SYS_EXIT_GROUP, RAX );
+    EMIT ( "syscall" );
+}
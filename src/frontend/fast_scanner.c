@@ -0,0 +1,305 @@
+/* A hand-written scanner, which can be used instead of the flex scanner in scanner.l.
+ * It recognizes exactly the same tokens, and provides the same yylex interface.
+ *
+ * It scans the source in place (see source.h), and tokens are only described by their token_slice.
+ * Whitespace, comments, identifiers and numbers are scanned a whole chunk of 16 or 32 bytes at a time,
+ * using SSE2 or AVX2 when the compiler targets them, and one byte at a time otherwise.
+ * Keywords are told apart from identifiers with a perfect hash.
+ */
+#include "vslc.h"
+#include "source.h"
+// The tokens defined in parser.y
+#include "parser.h"
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+// The state of a scanner, behind its yyscan_t handle
+typedef struct
+{
+    size_t position; // The next byte to scan in the source. The source's padding lets chunks be loaded past its end
+    int line;        // The line currently being read
+} scanner_t;
+
+#if defined(__AVX2__) || defined(__SSE2__)
+_Static_assert ( SOURCE_PADDING >= 32, "a whole chunk must fit in the padding" );
+#endif
+
+/* ==================== Chunks ==================== */
+
+// A mask has bit i set if byte i of the chunk is in the character class
+#if defined(__AVX2__)
+#define CHUNK_SIZE 32
+typedef __m256i chunk_t;
+#define LOAD(p) _mm256_loadu_si256 ( (const __m256i *) (p) )
+#define EQUALS(chunk, c) _mm256_cmpeq_epi8 ( (chunk), _mm256_set1_epi8 ( (c) ) )
+#define OR(a, b) _mm256_or_si256 ( (a), (b) )
+#define MASK(chunk) ( (uint32_t) _mm256_movemask_epi8 ( (chunk) ) )
+// Bytes from lo to hi are moved to the bottom of the signed range, so that one signed comparison finds them
+#define IN_RANGE(chunk, lo, hi) _mm256_cmpgt_epi8 ( _mm256_set1_epi8 ( (char) ( -128 + (hi) - (lo) + 1 ) ), \
+                                    _mm256_add_epi8 ( (chunk), _mm256_set1_epi8 ( (char) ( 128 - (lo) ) ) ) )
+#define LOWERCASE(chunk) _mm256_or_si256 ( (chunk), _mm256_set1_epi8 ( 0x20 ) )
+#elif defined(__SSE2__)
+#define CHUNK_SIZE 16
+typedef __m128i chunk_t;
+#define LOAD(p) _mm_loadu_si128 ( (const __m128i *) (p) )
+#define EQUALS(chunk, c) _mm_cmpeq_epi8 ( (chunk), _mm_set1_epi8 ( (c) ) )
+#define OR(a, b) _mm_or_si128 ( (a), (b) )
+#define MASK(chunk) ( (uint32_t) _mm_movemask_epi8 ( (chunk) ) )
+#define IN_RANGE(chunk, lo, hi) _mm_cmpgt_epi8 ( _mm_set1_epi8 ( (char) ( -128 + (hi) - (lo) + 1 ) ), \
+                                    _mm_add_epi8 ( (chunk), _mm_set1_epi8 ( (char) ( 128 - (lo) ) ) ) )
+#define LOWERCASE(chunk) _mm_or_si128 ( (chunk), _mm_set1_epi8 ( 0x20 ) )
+#endif
+
+static bool is_digit ( char c )
+{
+    return c >= '0' && c <= '9';
+}
+
+static bool is_identifier_start ( char c )
+{
+    return ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || c == '_';
+}
+
+#ifndef CHUNK_SIZE
+static bool is_whitespace ( char c )
+{
+    return c == ' ' || c == '\t' || c == '\v' || c == '\r' || c == '\n';
+}
+
+static bool is_identifier_part ( char c )
+{
+    return is_identifier_start ( c ) || is_digit ( c );
+}
+#else
+static uint32_t whitespace_mask ( chunk_t chunk )
+{
+    return MASK ( OR ( OR ( EQUALS ( chunk, ' ' ), EQUALS ( chunk, '\n' ) ),
+                       OR ( IN_RANGE ( chunk, '\t', '\v' ), EQUALS ( chunk, '\r' ) ) ) );
+}
+
+static uint32_t digit_mask ( chunk_t chunk )
+{
+    return MASK ( IN_RANGE ( chunk, '0', '9' ) );
+}
+
+static uint32_t identifier_mask ( chunk_t chunk )
+{
+    // Setting bit 5 turns upper case letters into lower case, and doesn't turn anything else into a letter
+    return MASK ( OR ( OR ( IN_RANGE ( LOWERCASE ( chunk ), 'a', 'z' ), IN_RANGE ( chunk, '0', '9' ) ),
+                       EQUALS ( chunk, '_' ) ) );
+}
+#endif
+
+/* Skips whitespace, counting the lines */
+static void skip_whitespace ( scanner_t *scanner )
+{
+#ifdef CHUNK_SIZE
+    while ( true )
+    {
+        chunk_t chunk = LOAD ( source + scanner->position );
+        uint32_t whitespace = whitespace_mask ( chunk );
+        uint32_t newlines = MASK ( EQUALS ( chunk, '\n' ) );
+        if ( whitespace == ( CHUNK_SIZE == 32 ? UINT32_MAX : 0xFFFF ) )
+        {
+            scanner->line += __builtin_popcount ( newlines );
+            scanner->position += CHUNK_SIZE;
+            continue;
+        }
+        // Only count the newlines before the first byte that isn't whitespace
+        int length = __builtin_ctz ( ~whitespace );
+        scanner->line += __builtin_popcount ( newlines & ( ( 1u << length ) - 1 ) );
+        scanner->position += length;
+        return;
+    }
+#else
+    for ( ; is_whitespace ( source[scanner->position] ); scanner->position++ )
+        if ( source[scanner->position] == '\n' )
+            scanner->line++;
+#endif
+}
+
+/* Skips to the end of the line, or of the input. The newline itself is left as whitespace */
+static void skip_comment ( scanner_t *scanner )
+{
+#ifdef CHUNK_SIZE
+    while ( scanner->position < source_length )
+    {
+        uint32_t newlines = MASK ( EQUALS ( LOAD ( source + scanner->position ), '\n' ) );
+        if ( newlines != 0 )
+        {
+            scanner->position += __builtin_ctz ( newlines );
+            break;
+        }
+        scanner->position += CHUNK_SIZE;
+    }
+    // The padding has no newlines, so the search may have gone past the end
+    if ( scanner->position > source_length )
+        scanner->position = source_length;
+#else
+    while ( scanner->position < source_length && source[scanner->position] != '\n' )
+        scanner->position++;
+#endif
+}
+
+/* Returns the position of the first byte from start that isn't a digit */
+static size_t end_of_number ( size_t start )
+{
+#ifdef CHUNK_SIZE
+    while ( true )
+    {
+        uint32_t digits = digit_mask ( LOAD ( source + start ) );
+        if ( ~digits & ( CHUNK_SIZE == 32 ? UINT32_MAX : 0xFFFF ) )
+            return start + __builtin_ctz ( ~digits );
+        start += CHUNK_SIZE;
+    }
+#else
+    while ( is_digit ( source[start] ) )
+        start++;
+    return start;
+#endif
+}
+
+/* Returns the position of the first byte from start that can't be part of an identifier */
+static size_t end_of_identifier ( size_t start )
+{
+#ifdef CHUNK_SIZE
+    while ( true )
+    {
+        uint32_t identifier = identifier_mask ( LOAD ( source + start ) );
+        if ( ~identifier & ( CHUNK_SIZE == 32 ? UINT32_MAX : 0xFFFF ) )
+            return start + __builtin_ctz ( ~identifier );
+        start += CHUNK_SIZE;
+    }
+#else
+    while ( is_identifier_part ( source[start] ) )
+        start++;
+    return start;
+#endif
+}
+
+/* Returns the end of the string literal starting at start, or start if there is none.
+ * The flex pattern is \"([^\"\n]|\\\")*\" and flex picks the longest match.
+ * A quote right after a backslash in the string can both end the string, and be part of it,
+ * so the scan continues past such quotes, remembering the last place the string could end.
+ */
+static size_t end_of_string ( size_t start )
+{
+    size_t end = start;
+    for ( size_t i = start + 1; i < source_length && source[i] != '\n'; i++ )
+    {
+        if ( source[i] != '"' )
+            continue;
+        end = i + 1;
+        if ( source[i-1] != '\\' )
+            break;
+    }
+    return end;
+}
+
+/* ==================== Keywords ==================== */
+
+typedef struct
+{
+    const char *text;
+    int length;
+    int token;
+} keyword_t;
+
+// A perfect hash of the keywords, using their length, and their first and last characters
+#define KEYWORD_HASH(first, last, length) ( ( 2 * (first) + 8 * (last) + (length) ) & 15 )
+
+static const keyword_t keywords[16] = {
+    [KEYWORD_HASH ( 'f', 'c', 4 )] = { "func", 4, FUNC },
+    [KEYWORD_HASH ( 'e', 'n', 6 )] = { "extern", 6, EXTERN },
+    [KEYWORD_HASH ( 'p', 't', 5 )] = { "print", 5, PRINT },
+    [KEYWORD_HASH ( 'r', 'n', 6 )] = { "return", 6, RETURN },
+    [KEYWORD_HASH ( 'b', 'k', 5 )] = { "break", 5, BREAK },
+    [KEYWORD_HASH ( 'i', 'f', 2 )] = { "if", 2, IF },
+    [KEYWORD_HASH ( 't', 'n', 4 )] = { "then", 4, THEN },
+    [KEYWORD_HASH ( 'e', 'e', 4 )] = { "else", 4, ELSE },
+    [KEYWORD_HASH ( 'w', 'e', 5 )] = { "while", 5, WHILE },
+    [KEYWORD_HASH ( 'd', 'o', 2 )] = { "do", 2, DO },
+    [KEYWORD_HASH ( 'b', 'n', 5 )] = { "begin", 5, OPENBLOCK },
+    [KEYWORD_HASH ( 'e', 'd', 3 )] = { "end", 3, CLOSEBLOCK },
+    [KEYWORD_HASH ( 'v', 'r', 3 )] = { "var", 3, VAR },
+};
+
+/* Returns the keyword token for the word, or IDENTIFIER if it isn't a keyword */
+static int keyword_or_identifier ( const char *text, int length )
+{
+    const keyword_t *keyword = &keywords[KEYWORD_HASH ( text[0], text[length-1], length )];
+    if ( keyword->length == length && memcmp ( keyword->text, text, length ) == 0 )
+        return keyword->token;
+    return IDENTIFIER;
+}
+
+/* ==================== Scanning ==================== */
+
+int yylex_init ( yyscan_t *handle )
+{
+    scanner_t *scanner = malloc ( sizeof(scanner_t) );
+    *scanner = (scanner_t) { .position = 0, .line = 1 };
+    *handle = scanner;
+    return 0;
+}
+
+// The semantic value is left alone. The parser finds the text of the token through token_slice
+int yylex ( YYSTYPE *value, yyscan_t handle )
+{
+    scanner_t *scanner = handle;
+    while ( true )
+    {
+        skip_whitespace ( scanner );
+        size_t position = scanner->position;
+        if ( position + 1 < source_length && source[position] == '/' && source[position+1] == '/' )
+            skip_comment ( scanner );
+        else
+            break;
+    }
+
+    if ( scanner->position >= source_length )
+        return 0;
+
+    size_t start = scanner->position;
+    size_t end;
+    char c = source[start];
+    int token;
+    if ( is_digit ( c ) )
+    {
+        end = end_of_number ( start );
+        token = NUMBER;
+    }
+    else if ( is_identifier_start ( c ) )
+    {
+        end = end_of_identifier ( start );
+        token = keyword_or_identifier ( source + start, end - start );
+    }
+    else if ( c == '"' && end_of_string ( start ) != start )
+    {
+        end = end_of_string ( start );
+        token = STRING;
+    }
+    else
+    {
+        // Unknown chars get returned as single char tokens
+        end = start + 1;
+        token = c;
+    }
+
+    scanner->position = end;
+    token_slice = (source_slice_t) { .offset = start, .length = end - start };
+    return token;
+}
+
+int yyget_lineno ( yyscan_t handle )
+{
+    return ( (scanner_t *) handle )->line;
+}
+
+int yylex_destroy ( yyscan_t handle )
+{
+    free ( handle );
+    return 0;
+}
@@ -1,16 +1,14 @@
 %{
 #include "vslc.h"
+#include "intern.h"
+#include "source.h"
 
-/* State variables from the flex generated scanner */
-extern int yylineno; // The line currently being read
-extern char yytext[]; // The text of the last consumed lexeme
-/* The main flex driver function used by the parser */
-int yylex ( void );
-/* The function called by the parser when errors occur */
-int yyerror ( const char *error )
+/* The function called by the parser when errors occur.
+ * The error is only reported once yyparse has returned, so that it can free its stack first */
+static _Thread_local char syntax_error[256];
+static void yyerror ( yyscan_t scanner, const char *error )
 {
-    fprintf ( stderr, "%s on line %d\n", error, yylineno );
-    exit ( EXIT_FAILURE );
+    snprintf ( syntax_error, sizeof(syntax_error), "%s on line %d", error, yyget_lineno ( scanner ) );
 }
 
 #define N0C(type,data) \
@@ -21,13 +19,44 @@ int yyerror ( const char *error )
   node_create ( (type), (data), 2, (child0), (child1) )
 #define N3C(type,data,child0,child1,child2) \
   node_create ( (type), (data), 3, (child0), (child1), (child2) )
+#define OP1C(type,operator,child0) \
+  operator_node_create ( (type), (operator), 1, (child0) )
+#define OP2C(type,operator,child0,child1) \
+  operator_node_create ( (type), (operator), 2, (child0), (child1) )
+
+// With -stream, an error in compiling a global is caught, and reported once yyparse has returned, like syntax errors.
+// The handler is not a local variable, since those may lose changes made between setjmp and longjmp
+static _Thread_local error_handler_t global_handler;
+
+/* Adds the global to the list, or compiles it right away with -stream, when there is no list.
+ * If compiling it fails, global_handler.message is set, and the parser must stop */
+static node_t* add_global ( node_t *list, node_t *global )
+{
+    if ( compile_streaming )
+    {
+        error_handler_t *outer_handler = error_handler;
+        error_handler = &global_handler;
+        if ( setjmp ( global_handler.jump ) == 0 )
+            compile_global ( global );
+        error_handler = outer_handler;
+        return NULL;
+    }
+    if ( list == NULL )
+        list = N0C ( LIST, NULL );
+    return append_to_list_node ( list, global );
+}
 
 %}
 
 // Get verbose error messages from the parser
 %define parse.error verbose
 
-%token FUNC PRINT RETURN BREAK IF THEN ELSE WHILE DO VAR
+// The parser and the scanner keep their state in local variables and in the scanner handle,
+// so several compilations can run at the same time
+%define api.pure full
+%param { yyscan_t scanner }
+
+%token FUNC EXTERN PRINT RETURN BREAK IF THEN ELSE WHILE DO VAR
 %token OPENBLOCK CLOSEBLOCK // Correspond to "begin" and "end"
 %token NUMBER IDENTIFIER STRING
 
@@ -46,11 +75,12 @@ program :
       global_list { root = $1; }
     ;
 global_list :
-      global { $$ = N1C ( LIST, NULL, $1 ); }
-    | global_list global { $$ = append_to_list_node ( $1, $2 ); }
+      global { $$ = add_global ( NULL, $1 ); if ( global_handler.message != NULL ) YYABORT; }
+    | global_list global { $$ = add_global ( $1, $2 ); if ( global_handler.message != NULL ) YYABORT; }
     ;
 global :
       function { $$ = $1; }
+    | extern_function { $$ = $1; }
     | global_declaration { $$ = $1; }
     ;
 global_declaration :
@@ -86,6 +116,10 @@ function :
       FUNC identifier '(' parameter_list ')' statement
         { $$ = N3C ( FUNCTION, NULL, $2, $4, $6 ); }
     ;
+extern_function :
+      EXTERN FUNC identifier '(' parameter_list ')'
+        { $$ = N2C ( EXTERN_FUNCTION, NULL, $3, $5 ); }
+    ;
 statement :
       assignment_statement { $$ = $1; }
     | return_statement { $$ = $1; }
@@ -140,29 +174,29 @@ while_statement :
     ;
 relation:
       expression '=' expression
-        { $$ = N2C ( RELATION, "=", $1, $3 ); }
+        { $$ = OP2C ( RELATION, OPERATOR_EQUAL, $1, $3 ); }
     | expression '!' '=' expression
-        { $$ = N2C ( RELATION, "!=", $1, $4 ); }
+        { $$ = OP2C ( RELATION, OPERATOR_NOT_EQUAL, $1, $4 ); }
     | expression '<' expression
-        { $$ = N2C ( RELATION, "<", $1, $3 ); }
+        { $$ = OP2C ( RELATION, OPERATOR_LESS, $1, $3 ); }
     | expression '>' expression
-        { $$ = N2C ( RELATION, ">", $1, $3 ); }
+        { $$ = OP2C ( RELATION, OPERATOR_GREATER, $1, $3 ); }
     ;
 expression :
       expression '+' expression
-        { $$ = N2C ( EXPRESSION, "+", $1, $3 ); }
+        { $$ = OP2C ( EXPRESSION, OPERATOR_ADD, $1, $3 ); }
     | expression '-' expression
-        { $$ = N2C ( EXPRESSION, "-", $1, $3 ); }
+        { $$ = OP2C ( EXPRESSION, OPERATOR_SUBTRACT, $1, $3 ); }
     | expression '*' expression
-        { $$ = N2C ( EXPRESSION, "*", $1, $3 ); }
+        { $$ = OP2C ( EXPRESSION, OPERATOR_MULTIPLY, $1, $3 ); }
     | expression '/' expression
-        { $$ = N2C ( EXPRESSION, "/", $1, $3 ); }
+        { $$ = OP2C ( EXPRESSION, OPERATOR_DIVIDE, $1, $3 ); }
     | expression '<' '<' expression
-        { $$ = N2C ( EXPRESSION, "<<", $1, $4 ); }
+        { $$ = OP2C ( EXPRESSION, OPERATOR_SHIFT_LEFT, $1, $4 ); }
     | expression '>' '>' expression
-        { $$ = N2C ( EXPRESSION, ">>", $1, $4 ); }
+        { $$ = OP2C ( EXPRESSION, OPERATOR_SHIFT_RIGHT, $1, $4 ); }
     | '-' expression %prec UMINUS
-        { $$ = N1C ( EXPRESSION, "-", $2 ); }
+        { $$ = OP1C ( EXPRESSION, OPERATOR_SUBTRACT, $2 ); }
     | '(' expression ')' { $$ = $2; }
     | number { $$ = $1; }
     | identifier { $$ = $1; }
@@ -179,13 +213,22 @@ expression_list :
       expression { $$ = N1C ( LIST, NULL, $1 ); }
     | expression_list ',' expression { $$ = append_to_list_node ( $1, $3 ); }
     ;
-// These final three perform memory allocation to keep extra data from yytext
-identifier: IDENTIFIER { $$ = N0C ( IDENTIFIER_DATA, strdup ( yytext ) ); }
-number: NUMBER
-      {
-        int64_t *value = malloc ( sizeof ( int64_t ) );
-        *value = strtol ( yytext, NULL, 10 );
-        $$ = N0C ( NUMBER_DATA, value );
-      }
-string: STRING { $$ = N0C ( STRING_DATA, strdup ( yytext ) ); }
+// These final three keep extra data from the token's slice of the source.
+// Identifiers are interned, so every use of a name shares one copy. Strings keep referring to the source
+identifier: IDENTIFIER { $$ = N0C ( IDENTIFIER_DATA, intern ( SLICE_TEXT ( token_slice ), token_slice.length ) ); }
+number: NUMBER { $$ = number_node_create ( strtol ( SLICE_TEXT ( token_slice ), NULL, 10 ) ); }
+string: STRING { $$ = string_node_create ( token_slice ); }
 %%
+
+void parse ( void )
+{
+    yyscan_t scanner;
+    yylex_init ( &scanner );
+    global_handler.message = NULL;
+    int result = yyparse ( scanner );
+    yylex_destroy ( scanner );
+    if ( global_handler.message != NULL )
+        rethrow_error ( global_handler.message );
+    if ( result != 0 )
+        compile_error ( "%s", syntax_error );
+}
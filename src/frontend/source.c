@@ -0,0 +1,153 @@
+// MAP_ANONYMOUS is not part of POSIX
+#define _DEFAULT_SOURCE
+#define _DARWIN_C_SOURCE
+#include "source.h"
+#include "error.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+_Thread_local const char *source;
+_Thread_local size_t source_length;
+_Thread_local source_slice_t token_slice;
+
+// How the source was obtained, so that source_close knows how to release it
+static _Thread_local size_t mapped_length; // 0 if the source was read into malloced memory
+
+static bool read_all ( int fd );
+static bool map_file ( int fd, size_t length );
+static void check_length ( size_t length, const char *name );
+
+/* External interface */
+
+void source_open ( const char *path )
+{
+    if ( path == NULL )
+    {
+        if ( !read_all ( STDIN_FILENO ) )
+            compile_error ( "error: could not read stdin: %s", strerror ( errno ) );
+        check_length ( source_length, "stdin" );
+        return;
+    }
+
+    int fd = open ( path, O_RDONLY );
+    struct stat file_stat;
+    bool success = fd >= 0 && fstat ( fd, &file_stat ) == 0;
+    // Pipes and devices can't be mapped, so they are read like stdin
+    if ( success && S_ISREG ( file_stat.st_mode ) && file_stat.st_size > UINT32_MAX )
+    {
+        errno = EFBIG;
+        success = false;
+    }
+    else if ( success && S_ISREG ( file_stat.st_mode ) )
+        success = map_file ( fd, file_stat.st_size );
+    else if ( success )
+        success = read_all ( fd );
+
+    int error = errno;
+    if ( fd >= 0 )
+        close ( fd );
+    if ( !success )
+        compile_error ( "error: could not read '%s': %s", path, strerror ( error ) );
+    check_length ( source_length, path );
+}
+
+void source_copy ( const char *text, size_t length )
+{
+    check_length ( length, "source" );
+    char *buffer = malloc ( length + SOURCE_PADDING );
+    memcpy ( buffer, text, length );
+    memset ( buffer + length, 0, SOURCE_PADDING );
+
+    source = buffer;
+    source_length = length;
+    mapped_length = 0;
+}
+
+void source_close ( void )
+{
+    if ( mapped_length > 0 )
+        munmap ( (void *) source, mapped_length );
+    else
+        free ( (void *) source );
+    source = NULL;
+    source_length = 0;
+    mapped_length = 0;
+}
+
+/* Internal matters */
+
+// Slices use 32 bit offsets. The source is released before the error is reported
+static void check_length ( size_t length, const char *name )
+{
+    if ( length > UINT32_MAX )
+    {
+        source_close ( );
+        compile_error ( "error: '%s' is too large, the limit is 4 GiB", name );
+    }
+}
+
+/* Reads everything from the file descriptor into malloced memory, followed by the zeroed padding.
+ * Returns false, with errno set, if reading fails */
+static bool read_all ( int fd )
+{
+    size_t capacity = 1 << 16;
+    size_t length = 0;
+    char *buffer = malloc ( capacity + SOURCE_PADDING );
+    ssize_t n_read;
+    while ( ( n_read = read ( fd, buffer + length, capacity - length ) ) != 0 )
+    {
+        if ( n_read < 0 )
+        {
+            if ( errno == EINTR )
+                continue;
+            free ( buffer );
+            return false;
+        }
+        length += n_read;
+        if ( length == capacity )
+        {
+            capacity *= 2;
+            buffer = realloc ( buffer, capacity + SOURCE_PADDING );
+        }
+    }
+    memset ( buffer + length, 0, SOURCE_PADDING );
+
+    source = buffer;
+    source_length = length;
+    mapped_length = 0;
+    return true;
+}
+
+/* Maps the file read only, followed by the zeroed padding.
+ * Returns false, with errno set, if mapping fails */
+static bool map_file ( int fd, size_t length )
+{
+    // Zeroed memory is reserved for the file and the padding, and the file is mapped over the start of it.
+    // The end of the file's last page reads as zeros, and the rest of the padding is the reserved memory.
+    size_t page_size = sysconf ( _SC_PAGESIZE );
+    size_t total = ( length + SOURCE_PADDING + page_size - 1 ) / page_size * page_size;
+    char *memory = mmap ( NULL, total, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    if ( memory == MAP_FAILED )
+        return false;
+    if ( length > 0 && mmap ( memory, length, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0 ) == MAP_FAILED )
+    {
+        int error = errno;
+        munmap ( memory, total );
+        errno = error;
+        return false;
+    }
+    posix_madvise ( memory, length, POSIX_MADV_SEQUENTIAL );
+
+    source = memory;
+    source_length = length;
+    mapped_length = total;
+    return true;
+}
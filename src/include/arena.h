@@ -0,0 +1,45 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+// An arena hands out memory by bumping a pointer through large blocks.
+// Nothing is freed on its own, instead all memory is freed at once with arena_free_all.
+// A zero-initialized arena_t is an empty arena, ready to use.
+typedef struct arena
+{
+    struct arena_block *blocks; // The block currently being filled, which links to the previous blocks
+    char *position;             // Where the next allocation starts
+    char *end;                  // The end of the current block
+} arena_t;
+
+// How many allocations arenas have made on this thread, and their size in bytes, for -ftime-report
+extern _Thread_local size_t arena_allocations;
+extern _Thread_local size_t arena_allocated_bytes;
+
+// Returns size bytes of memory, aligned for any type. Returns NULL if size is 0
+void* arena_alloc ( arena_t *arena, size_t size );
+
+// Copies the NUL-terminated string into the arena
+char* arena_strdup ( arena_t *arena, const char *string );
+
+// Frees every allocation made in the arena, leaving it empty
+void arena_free_all ( arena_t *arena );
+
+// Like arena_free_all, but keeps the first block for the next allocations,
+// so that an arena that is used over and over doesn't allocate and touch new memory each time
+void arena_reset ( arena_t *arena );
+
+// A point in the arena's allocations, which everything allocated after it can be freed back to
+typedef struct arena_mark
+{
+    struct arena_block *block;
+    char *position;
+} arena_mark_t;
+
+arena_mark_t arena_mark ( arena_t *arena );
+
+// Frees everything allocated after the mark. Like arena_reset, the first block is kept
+void arena_release ( arena_t *arena, arena_mark_t mark );
+
+#endif // ARENA_H
@@ -0,0 +1,13 @@
+#ifndef DEAD_CODE_H
+#define DEAD_CODE_H
+
+#include <stdbool.h>
+
+// Removes every function, global variable, global array and string that can't be reached from the entry function,
+// or from any function when compiling a module.
+// Symbols are removed from the global symbol table, and their declarations from the syntax tree.
+// The remaining strings in the string list are renumbered.
+// Must be called after names have been bound. If report is set, everything removed is listed on report_stream.
+void remove_dead_code ( bool report );
+
+#endif // DEAD_CODE_H
@@ -23,9 +23,9 @@
 #define MEM(reg) "("reg")"
 #define ARRAY_MEM(array,index,stride) "("array","index","stride")"
 
-#define DIRECTIVE(fmt, ...) printf(fmt "\n" __VA_OPT__(,) __VA_ARGS__)
-#define LABEL(name, ...) printf(name":\n" __VA_OPT__(,) __VA_ARGS__)
-#define EMIT(fmt, ...) printf("\t" fmt "\n" __VA_OPT__(,) __VA_ARGS__)
+#define DIRECTIVE(fmt, ...) fprintf(output_stream, fmt "\n" __VA_OPT__(,) __VA_ARGS__)
+#define LABEL(name, ...) fprintf(output_stream, name":\n" __VA_OPT__(,) __VA_ARGS__)
+#define EMIT(fmt, ...) fprintf(output_stream, "\t" fmt "\n" __VA_OPT__(,) __VA_ARGS__)
 
 #define MOVQ(src,dst)     EMIT("movq %s, %s", (src), (dst))
 #define PUSHQ(src)        EMIT("pushq %s", (src))
@@ -62,20 +62,28 @@
 // allowing the compiler to work on macOS as well
 // Section names are different,
 // and exported and imported function labels start with _
+// ASM_DECLARE_LIBC_SYMBOLS is only needed on macOS, and is used by modules compiled with --no-main
+// The sections of hot functions and of functions that never run, with -fprofile-use, which the linker groups together
 #ifdef __APPLE__
 #define ASM_BSS_SECTION "__DATA, __bss"
 #define ASM_STRING_SECTION "__TEXT, __cstring"
-#define ASM_DECLARE_SYMBOLS                     \
+#define ASM_HOT_TEXT_SECTION "__TEXT, __text"
+#define ASM_COLD_TEXT_SECTION "__TEXT, __text"
+#define ASM_DECLARE_LIBC_SYMBOLS                \
     ".set printf, _printf"                 "\n" \
     ".set putchar, _putchar"               "\n" \
     ".set puts, _puts"                     "\n" \
     ".set strtol, _strtol"                 "\n" \
-    ".set exit, _exit"                     "\n" \
+    ".set exit, _exit"
+#define ASM_DECLARE_SYMBOLS                     \
+    ASM_DECLARE_LIBC_SYMBOLS               "\n" \
     ".set _main, main"                     "\n" \
     ".global _main"
 #else
 #define ASM_BSS_SECTION ".bss"
 #define ASM_STRING_SECTION ".rodata"
+#define ASM_HOT_TEXT_SECTION ".text.hot, \"ax\", @progbits"
+#define ASM_COLD_TEXT_SECTION ".text.unlikely, \"ax\", @progbits"
 #define ASM_DECLARE_SYMBOLS ".global main"
 #endif
 
@@ -0,0 +1,26 @@
+#ifndef ERROR_H
+#define ERROR_H
+
+#include <setjmp.h>
+
+// Errors in the program being compiled are reported with compile_error, which never returns.
+// While an error handler is installed on the thread, the message is stored in it, and control jumps back to it.
+// Otherwise the message is printed on stderr, and the process exits.
+
+typedef struct error_handler
+{
+    jmp_buf jump;  // Where compile_error continues, with setjmp returning 1
+    char *message; // The message, allocated with malloc. NULL until an error happens
+} error_handler_t;
+
+// The handler of the compilation running on this thread, or NULL
+extern _Thread_local error_handler_t *error_handler;
+
+// Reports the error, formatted like printf, without a trailing newline
+_Noreturn void compile_error ( const char *format, ... );
+
+// Reports an error that was caught by another handler, such as one on a worker thread.
+// Takes ownership of the message
+_Noreturn void rethrow_error ( char *message );
+
+#endif // ERROR_H
@@ -0,0 +1,55 @@
+#ifndef FUNCTION_CACHE_H
+#define FUNCTION_CACHE_H
+#include "symbols.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// A cache of the generated code of functions, in a directory on disk, shared by all compilations that use it.
+//
+// An entry is found by hashing everything the code of a function depends on: its syntax tree after optimization,
+// the names and signatures of the symbols it uses, its string literals, the options that change code generation,
+// and the sources of the compiler itself. The whole 128-bit hash is stored in the entry, and compared on lookup.
+//
+// The cached code doesn't depend on where the function is in the program. Its labels and string references
+// are numbered from 0 in the cache, and renumbered when the code is reused.
+//
+// The directory has one subdirectory for each of the first two hex digits of the hash.
+// Each holds an equal part of the size limit, and the least recently used entries are removed when it is exceeded.
+// Entries are written to a temporary file and renamed, so compilations may share the cache at the same time.
+
+typedef struct function_cache function_cache_t;
+
+// The cache of the compilation running on this thread, or NULL
+extern _Thread_local function_cache_t *function_cache;
+
+// The size limit used when none is given
+#define FUNCTION_CACHE_DEFAULT_SIZE ( (size_t) 256 << 20 )
+
+// Opens the cache in the directory, creating it if needed, and sets function_cache.
+// A max_size of 0 uses FUNCTION_CACHE_DEFAULT_SIZE. If report is set, the hit rate is printed on report_stream when closed
+void function_cache_open ( const char *directory, size_t max_size, bool report );
+
+// Removes old entries from the subdirectories this compilation stored in, and closes the cache. Does nothing if none is open
+void function_cache_close ( void );
+
+// The key of one function, made by function_cache_lookup
+typedef struct
+{
+    uint64_t hash[2];
+    size_t *strings;  // The positions in the string list of the strings the function uses, in order
+    size_t n_strings;
+} function_cache_key_t;
+
+// Looks the function up. On a hit, its code is printed to output_stream, and true is returned.
+// On a miss, key is set, and must be passed on to function_cache_store or function_cache_discard
+bool function_cache_lookup ( symbol_t *function, function_cache_key_t *key );
+
+// Stores the code generated for the function with the key, and frees the key
+void function_cache_store ( function_cache_key_t *key, symbol_t *function, const char *code, size_t length );
+
+// Frees the key without storing anything, such as when generating the function failed
+void function_cache_discard ( function_cache_key_t *key );
+
+#endif // FUNCTION_CACHE_H
@@ -0,0 +1,26 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Interned strings are unique: two interned strings have the same text exactly when they are the same pointer.
+// They are normal NUL-terminated strings, with their hash and length stored in front of the text.
+// Interned strings must never be modified, and are all freed together by destroy_interned_strings.
+
+// Returns the interned copy of the first length characters of text
+char* intern ( const char *text, size_t length );
+
+// Returns the hash of an interned string, without looking at its text
+uint64_t interned_hash ( const char *interned );
+
+// Returns the length of an interned string, without looking at its text
+size_t interned_length ( const char *interned );
+
+// Frees every interned string
+void destroy_interned_strings ( void );
+
+// Forgets every interned string, but keeps some of their memory for the next ones
+void reset_interned_strings ( void );
+
+#endif // INTERN_H
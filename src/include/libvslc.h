@@ -0,0 +1,71 @@
+#ifndef LIBVSLC_H
+#define LIBVSLC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+
+// The compiler as a library, for embedding it in other programs.
+//
+// A context holds the options of its compilations, and the output and error of the last one.
+// A compilation runs on the calling thread from start to end, and all of its state belongs to that thread.
+// Several compilations may run at the same time on different threads, as long as each uses its own context.
+// Errors in the compiled program do not exit the process, they make vslc_compile return false.
+
+// The formats of the report of -ftime-report
+typedef enum { VSLC_TIME_REPORT_NONE, VSLC_TIME_REPORT_TEXT, VSLC_TIME_REPORT_JSON } vslc_time_report_t;
+
+// What a compilation outputs. Corresponds to the command line options of vslc
+typedef struct vslc_options
+{
+    bool print_full_tree;             // -t
+    bool print_tree_after_simplify;   // -T
+    bool print_symbol_table_contents; // -s
+    bool generate_program;            // -c
+    bool use_freestanding_runtime;    // -nostdlib
+    bool report_dead_code;            // -report-dead, see vslc_reports
+    bool no_main;                     // --no-main, to compile a module that other programs link with
+    bool stream;                      // -stream, to generate each function as soon as it is parsed, with -c only
+    int jobs;                         // -j, how many threads bind names and generate functions. 0 and 1 use the calling thread
+    const char *cache_directory;      // -cache, where to reuse the code of functions from earlier compilations, or NULL
+    size_t cache_max_size;            // -cache-size, in bytes. 0 uses the default of 256 MB
+    bool report_cache_stats;          // -cache-stats, which reports the hit rate, see vslc_reports
+    vslc_time_report_t time_report;   // -ftime-report, which reports the time and memory of each phase, see vslc_reports
+    bool profile;                     // -p, to make a program that writes how often and how long its functions run
+    const char *profile_path;         // -fprofile-use, the profile written by such a program to optimize for, or NULL
+} vslc_options_t;
+
+// The output of a compilation. Owned by the context, and valid until its next compilation, or until it is destroyed
+typedef struct vslc_buffer
+{
+    const char *data;
+    size_t length;
+} vslc_buffer_t;
+
+typedef struct vslc_context vslc_context_t;
+
+vslc_context_t* vslc_context_create ( const vslc_options_t *options );
+void vslc_context_destroy ( vslc_context_t *context );
+
+// Compiles the source, which is length bytes long, and does not need to be NUL terminated.
+// Returns true on success. Either way, out_buffer is set to everything output before the compilation ended
+bool vslc_compile ( vslc_context_t *context, const char *source, size_t length, vslc_buffer_t *out_buffer );
+
+// Like vslc_compile, but maps the source from the file at path, or reads it from stdin if path is NULL
+bool vslc_compile_file ( vslc_context_t *context, const char *path, vslc_buffer_t *out_buffer );
+
+// Like vslc_compile_file, but writes the output to the stream as it is made, instead of keeping all of it in memory
+bool vslc_compile_file_to ( vslc_context_t *context, const char *path, FILE *stream );
+
+// Returns the error message of the last compilation, or NULL if it succeeded
+const char* vslc_error ( vslc_context_t *context );
+
+// Returns what the last compilation reported, such as with report_dead_code, one line each. Empty if nothing
+const char* vslc_reports ( vslc_context_t *context );
+
+// Compilations free all of their memory when they end. After vslc_keep_thread_memory ( true ),
+// compilations on the calling thread keep some of it for the next one instead, which helps a thread that compiles
+// many small programs. vslc_keep_thread_memory ( false ) frees it, and should be called before such a thread exits
+void vslc_keep_thread_memory ( bool keep );
+
+#endif // LIBVSLC_H
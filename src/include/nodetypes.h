@@ -31,20 +31,21 @@ NODELIST_BEGIN
     NODE(GLOBAL_DECLARATION),
     NODE(ARRAY_INDEXING),
     NODE(VARIABLE),
-    NODE(FUNCTION),
+    NODE(FUNCTION), // data is its profile with -fprofile-use, see profile.h
+    NODE(EXTERN_FUNCTION), // A function defined in another module, without a body
     NODE(BLOCK),
     NODE(ASSIGNMENT_STATEMENT),
     NODE(RETURN_STATEMENT),
     NODE(PRINT_STATEMENT),
     NODE(BREAK_STATEMENT),
-    NODE(IF_STATEMENT),
-    NODE(WHILE_STATEMENT),
-    NODE(RELATION), // data is a string defining relation type
-    NODE(EXPRESSION), // data is a string defining operation type
+    NODE(IF_STATEMENT), // data is its profile with -fprofile-use, see profile.h
+    NODE(WHILE_STATEMENT), // data is its profile with -fprofile-use, see profile.h
+    NODE(RELATION), // operator is the relation type
+    NODE(EXPRESSION), // operator is the operation type
     NODE(FUNCTION_CALL),
-    NODE(IDENTIFIER_DATA), // data is an owned string
-    NODE(NUMBER_DATA), // data is an owned int64_t*
-    NODE(STRING_DATA), // data is an owned string literal, including the ""
+    NODE(IDENTIFIER_DATA), // data is a string
+    NODE(NUMBER_DATA), // value is the number
+    NODE(STRING_DATA), // slice is a string literal in the source, including the ""
     NODE(STRING_LIST_REFERENCE) // data is the string's index casted to void*
 NODELIST_END
 
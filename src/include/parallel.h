@@ -0,0 +1,33 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Runs independent tasks, numbered from 0, on several threads.
+// Each thread takes the next task that no thread has started on, so the tasks are started in order.
+// Errors reported with compile_error in a task are caught, and no more tasks are started after one.
+// Since the tasks are started in order, every task before the first one that failed has finished.
+//
+// The threads don't see the thread-local state of the thread calling run_in_parallel,
+// so whatever the tasks need from it must be passed through the context.
+
+typedef struct parallel_tasks
+{
+    size_t n_tasks;
+    void *context; // Passed to the functions below
+
+    // Called on each thread before its first task, and after its last. Both may be NULL
+    void (*start_thread) ( void *context, int thread );
+    void (*stop_thread) ( void *context, int thread );
+
+    void (*run_task) ( void *context, int thread, size_t task );
+} parallel_tasks_t;
+
+// Runs the tasks on at most n_threads threads, numbered from 0, and waits for them to finish.
+// Returns false without running any task if no thread could be started.
+// Otherwise failed_task is set to the first task that failed, or n_tasks,
+// and error to its message, which the caller must free, or NULL
+bool run_in_parallel ( const parallel_tasks_t *tasks, int n_threads, size_t *failed_task, char **error );
+
+#endif // PARALLEL_H
@@ -0,0 +1,42 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+#include "tree.h"
+
+#include <stdint.h>
+
+// How the generator lays out an if statement or a while loop, or where it places a function, chosen from a profile
+typedef enum
+{
+    LAYOUT_DEFAULT,    // No profile, or nothing to gain from one
+    LAYOUT_THEN_FIRST, // The then-block runs at least as often as not, and follows the condition
+    LAYOUT_ELSE_FIRST, // The then-block runs less often than the else-block, and is placed after it
+    LAYOUT_ROTATED,    // The loop usually iterates, so its condition is tested at the bottom, with one branch each time
+    LAYOUT_UNROLLED,   // A rotated hot loop with a small body, which is generated twice, with the condition between
+    LAYOUT_HOT,        // A function that a large part of the program's time is spent in, placed with the other hot ones
+    LAYOUT_COLD,       // A function that was never called, placed away from the others
+} layout_t;
+
+// The counts of a FUNCTION, IF_STATEMENT or WHILE_STATEMENT node in the profile, held in its data.
+// The data is NULL without -fprofile-use, or when the node isn't in the profile
+typedef struct profile_counts
+{
+    int64_t runs;   // The calls of a function, or the times an if or while statement was reached
+    int64_t inner;  // The self cycles of a function, the runs of the then-block of an if, or the iterations of a loop
+    layout_t layout;
+} profile_counts_t;
+
+#define PROFILE_LAYOUT(node) \
+    ( (node)->data != NULL ? ( (profile_counts_t *) (node)->data )->layout : LAYOUT_DEFAULT )
+
+// Reads the profile written by a program compiled with -p (see generator.c), attaches its counts to the functions,
+// if statements and while loops of the program, and optimizes for them:
+//  - Calls on hot call edges to small functions that return an expression without calls are inlined
+//  - if statements put the block that runs most often right after the condition
+//  - Loops that usually iterate are rotated, and the hot ones with small bodies are unrolled once
+//  - Hot functions and functions that never ran are placed in sections of their own, which the linker groups
+// The counters of a function are numbered in the order the generator meets its if and while statements,
+// so this must run after names are bound and dead code is removed, just like when the profile was made.
+// A function whose number of if and while statements has changed since then is left alone, and reported.
+void optimize_with_profile ( const char *path );
+
+#endif // PROFILE_H
@@ -0,0 +1,20 @@
+#ifndef PURE_FUNCTIONS_H
+#define PURE_FUNCTIONS_H
+#include "tree.h"
+
+// Finds all pure functions in the program, which are functions that only depend on their arguments:
+// they don't print, don't use global variables or arrays, and only call other pure functions.
+// Works both before and after names have been bound.
+void find_pure_functions ( node_t *program );
+
+// If the node is a call to a pure function where all arguments are NUMBER_DATA,
+// the call is evaluated, and a NUMBER_DATA node with the result is returned in its place.
+// Evaluation gives up if it takes too many steps, or would divide by zero at runtime,
+// in which case the call is returned as is. So are all calls after the evaluated ones have taken
+// too many steps together, so that compile time stays bounded however many calls there are.
+node_t* evaluate_pure_call ( node_t *node );
+
+// Frees everything made by find_pure_functions
+void destroy_pure_functions ( void );
+
+#endif // PURE_FUNCTIONS_H
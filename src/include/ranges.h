@@ -0,0 +1,44 @@
+#ifndef RANGES_H
+#define RANGES_H
+#include "tree.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// A closed interval [min, max] of the values an expression can have.
+// The full range [INT64_MIN, INT64_MAX] means that nothing is known.
+typedef struct range
+{
+    int64_t min;
+    int64_t max;
+} range_t;
+
+typedef enum {
+    RELATION_UNREACHABLE,   // The relation is never evaluated
+    RELATION_ALWAYS_TRUE,
+    RELATION_ALWAYS_FALSE,
+    RELATION_UNKNOWN
+} relation_outcome_t;
+
+// Runs value range analysis over all functions, after names have been bound.
+// Every expression evaluated in the program gets the range of values it can have at that point,
+// found by following assignments and the conditions of if and while statements.
+void analyze_ranges ( void );
+
+// Looks up the range of the given expression found by analyze_ranges.
+// Returns false if the expression is never evaluated, or wasn't part of the analysis.
+bool expression_range ( node_t *expression, range_t *range );
+
+// Looks up whether the given relation can be both true and false, according to analyze_ranges
+relation_outcome_t relation_outcome ( node_t *relation );
+
+// Frees the analysis results. Must be called before any analyzed node is destroyed
+void destroy_ranges ( void );
+
+// Runs the analysis, and uses the results to rewrite expressions into cheaper forms where it is safe:
+//  - Variables with a single possible value are replaced by the value
+//  - Division by a power of two becomes a right shift, when the dividend is never negative
+//  - if and while statements with conditions that are always true or false are removed
+void optimize_with_ranges ( void );
+
+#endif // RANGES_H
@@ -0,0 +1,24 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include "libvslc.h"
+
+// vslc --server keeps compilers running on a Unix domain socket, and vslc --client sends them work,
+// so that compiling many small programs doesn't start a process and set up its memory for each.
+//
+// Each connection carries one request, a line
+//     vslc-request 3 <t> <T> <s> <c> <nostdlib> <report-dead> <no-main> <stream> <p> <time-report> <jobs> <length>
+// with the options as 0 or 1, and <time-report> as a vslc_time_report_t, followed by <length> bytes of source.
+// The server answers with a line
+//     vslc-response 3 <success> <output length> <reports length> <error length>
+// followed by the output, the reports and the error message, and closes the connection.
+
+// Serves requests on the socket, n_workers at a time, until SIGINT, SIGTERM or SIGHUP.
+// The cache options apply to every request. Returns the exit status
+int run_server ( const char *socket_path, int n_workers, const vslc_options_t *options );
+
+// Sends the file, or stdin if path is NULL, to the server, and prints the answer the way vslc would
+// have printed the result of compiling it. Returns the exit status
+int run_client ( const char *socket_path, const char *path, const vslc_options_t *options );
+
+#endif // SERVER_H
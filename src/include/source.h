@@ -0,0 +1,37 @@
+#ifndef SOURCE_H
+#define SOURCE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// The program being compiled, either mapped from a file, read from stdin, or copied from memory.
+// It is followed by SOURCE_PADDING zero bytes, so that scanners may read a little past its end.
+// It stays available until source_close, so the syntax tree can refer to it instead of copying its text.
+// Like the rest of a compilation's state, it belongs to the thread running the compilation.
+#define SOURCE_PADDING 64
+extern _Thread_local const char *source;
+extern _Thread_local size_t source_length;
+
+// A piece of the source, such as a token. Small enough to be kept inline in a syntax tree node.
+// The text of a slice is not NUL terminated, print it with "%.*s", (int) slice.length, SLICE_TEXT ( slice )
+typedef struct
+{
+    uint32_t offset;
+    uint32_t length;
+} source_slice_t;
+
+#define SLICE_TEXT(slice) ( source + (slice).offset )
+
+// The slice of the last token returned by yylex. Set by both scanners
+extern _Thread_local source_slice_t token_slice;
+
+// Maps the file at the given path into memory, or reads all of stdin if path is NULL
+void source_open ( const char *path );
+
+// Makes a padded copy of the text, and uses it as the source
+void source_copy ( const char *text, size_t length );
+
+// Unmaps or frees the source. Nothing may refer to it afterwards
+void source_close ( void );
+
+#endif // SOURCE_H
@@ -8,13 +8,22 @@
 
 // We use hashmaps to make lookups quick.
 // The entries are symbols, using the name of the symbol as the key.
+// Names must be interned (see intern.h), so keys are compared by pointer, using the hash stored with the name.
 // The hashmap logic is already implemented in symbol_table.c
-// NOTE: Removing entries is not necessary for this project.
+// Entries can only be removed through symbol_table_remove_symbols.
+typedef struct symbol_hashmap_bucket
+{
+    const char *name; // A copy of symbol->name, so that lookups don't have to follow the symbol pointer
+    struct symbol *symbol;
+} symbol_hashmap_bucket_t;
+
 typedef struct symbol_hashmap
 {
-    struct symbol **buckets; // A bucket may contain 0 or 1 entries
-    size_t n_buckets;
+    int8_t *control;                  // One byte per bucket, telling if it is empty, deleted, or holds an entry with a given hash
+    symbol_hashmap_bucket_t *buckets; // A bucket may contain 0 or 1 entries. Shares its allocation with the control bytes
+    size_t n_buckets;        // 0, or a power of two that is at least 16
     size_t n_entries;
+    size_t n_deleted;        // Buckets that have been emptied, but that lookups still have to look past
 
     // If a key is not found, the lookup function will consult this as a backup
     struct symbol_hashmap *backup;
@@ -22,12 +31,21 @@ typedef struct symbol_hashmap
 
 // A dynamically sized list of symbols, including a hashmap for fast lookups
 // The logic for the symbol table is already implemented in symbol_table.c
+//
+// A symbol table can have nested scopes, where symbols in inner scopes shadow symbols with the same name.
+// All scopes share the one hashmap, which only holds the innermost visible symbol for each name.
+// What each insertion shadowed is kept in the scope log, so the hashmap can be restored when a scope is popped.
 typedef struct symbol_table
 {
     struct symbol **symbols;
     size_t n_symbols;
     size_t capacity;
     symbol_hashmap_t *hashmap;
+
+    struct scope_log_entry *scope_log; // Empty when no scope has been pushed
+    size_t scope_log_length;
+    size_t scope_log_capacity;
+    size_t scope_start; // The sequence number of the first symbol in the innermost scope
 } symbol_table_t;
 
 typedef enum {
@@ -40,20 +58,32 @@ INSERT_COLLISION = 1
 symbol_table_t* symbol_table_init ( void );
 
 // Tries to insert the given symbol into the symbol table.
-// If the topmost hashmap already contains a symbol with the same name,
+// If the innermost scope already contains a symbol with the same name,
 // INSERT_COLLISION is returned, otherwise the result is INSERT_OK.
 //
 // The symbol table takes ownership of the symbol, and assigns it a sequence number.
 // DO NOT change the symbol's name after insertion.
 insert_result_t symbol_table_insert ( symbol_table_t *table, struct symbol *symbol );
 
+// Starts a new scope. Symbols inserted into it may shadow symbols in outer scopes.
+void symbol_table_push_scope ( symbol_table_t *table );
+
+// Ends the innermost scope. Its symbols are removed from the hashmap, and the symbols they shadowed are visible again.
+// The symbols stay in the table's list of symbols.
+void symbol_table_pop_scope ( symbol_table_t *table );
+
+// Removes and frees every symbol in the table where remove[sequence_number] is true.
+// The remaining symbols keep their order, but get new sequence numbers.
+// The hashmap is rebuilt in place, so hashmaps using it as their backup stay valid.
+void symbol_table_remove_symbols ( symbol_table_t *table, const bool *remove );
+
 // Destroys the given symbol table, its hashmap, and all the symbols it owns
 void symbol_table_destroy ( symbol_table_t *table );
 
 // Initalizes a new, empty hashmap
 symbol_hashmap_t* symbol_hashmap_init ( void );
 
-// Looks for a symbol in the symbol hashmap, matching the given name.
+// Looks for a symbol in the symbol hashmap, matching the given interned name.
 // If no symbol is found, the hashmap's backup hashmap is checked.
 // If the name can't be found in the backup chain either, NULL is returned.
 struct symbol* symbol_hashmap_lookup ( symbol_hashmap_t *hashmap, const char *name );
@@ -6,7 +6,7 @@
 
 typedef enum
 {
-    SYMBOL_GLOBAL_VAR, SYMBOL_GLOBAL_ARRAY, SYMBOL_FUNCTION, SYMBOL_PARAMETER, SYMBOL_LOCAL_VAR,
+    SYMBOL_GLOBAL_VAR, SYMBOL_GLOBAL_ARRAY, SYMBOL_FUNCTION, SYMBOL_EXTERN_FUNCTION, SYMBOL_PARAMETER, SYMBOL_LOCAL_VAR,
 } symtype_t;
 
 // Use as a normal array, to get the name of a symbol type: SYMBOL_TYPE_NAMES[symbol->type]
@@ -14,29 +14,37 @@ typedef enum
         [SYMBOL_GLOBAL_VAR] = "GLOBAL_VAR",       \
         [SYMBOL_GLOBAL_ARRAY] = "GLOBAL_ARRAY",   \
         [SYMBOL_FUNCTION] = "FUNCTION",           \
+        [SYMBOL_EXTERN_FUNCTION] = "EXTERN_FUNCTION", \
         [SYMBOL_PARAMETER] = "PARAMETER",         \
         [SYMBOL_LOCAL_VAR] = "LOCAL_VAR"})
 
 typedef struct symbol
 {
-    char *name;             // Symbol name ( not owned )
+    char *name;             // Symbol name, interned ( not owned )
     symtype_t type;         // Symbol type
     node_t *node;           // The AST node that defined this symbol ( not owned )
     size_t sequence_number; // Sequence number in the symbol table this symbol belongs to
 
-    /* Global variables and arrays have function_symtable = NULL
+    /* Global variables, arrays and extern functions have function_symtable = NULL
      * Functions point to their own symbol tables here, but the function itself is a global symbol
      * Parameters and local variables point to the function_symtable they belong to */
     struct symbol_table *function_symtable;
 } symbol_t;
 
-/* Global symbol table and string list */
-extern symbol_table_t *global_symbols;
-extern char **string_list;
-extern size_t string_list_len;
+/* Global symbol table and string list.
+ * The strings are string literals in the source, including the "" */
+extern _Thread_local symbol_table_t *global_symbols;
+extern _Thread_local source_slice_t *string_list;
+extern _Thread_local size_t string_list_len;
 
-void create_tables ( void );
+void create_tables ( int jobs ); // With jobs above 1, functions are bound on that many threads
 void print_tables ( void );
 void destroy_tables ( void );
 
+// With -stream, globals are added one at a time as they are parsed, see libvslc.c.
+// Names may be used before the globals they refer to are declared. Such uses are checked by finish_streamed_tables
+void begin_streamed_tables ( void );
+symbol_t* add_streamed_global ( node_t *global ); // Returns the symbol of a function, and binds the names in it
+void finish_streamed_tables ( void );
+
 #endif // SYMBOLS_H
@@ -0,0 +1,43 @@
+#ifndef TIME_REPORT_H
+#define TIME_REPORT_H
+#include "nodetypes.h"
+#include "symbol_table.h"
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// Measures where the time and memory of a compilation go, for -ftime-report.
+//
+// A phase lasts until the next one starts, so each moment is counted in exactly one phase.
+// With -stream, where functions are compiled in the middle of parsing, compile_global switches to the phases of
+// each function and back to parsing again.
+//
+// Wall time, and the CPU time of the whole process, including the threads of -j.
+// Allocations are those made in arenas on the compiling thread, which is where the syntax tree and the interned
+// strings live. The change in heap use, from the C library where it can tell (glibc), covers the rest, on all threads.
+// Peak RSS is the highest the process has reached by the end of the phase.
+
+typedef enum
+{
+    PHASE_NONE, PHASE_PARSE, PHASE_SIMPLIFY, PHASE_BIND, PHASE_RANGES, PHASE_DEAD_CODE, PHASE_PROFILE, PHASE_GENERATE,
+    _PHASE_COUNT
+} phase_t;
+
+// How many nodes of each type the compilation on this thread has created. Counted by tree.c
+extern _Thread_local size_t created_nodes[_NODE_COUNT];
+
+// Called when a compilation starts on this thread. If enabled, it is measured, starting in no phase
+void time_report_start ( bool enabled );
+
+// Ends the current phase, and starts the given one. Returns the phase that was running, so that it can be resumed.
+// Does nothing unless the compilation is measured
+phase_t time_report_phase ( phase_t phase );
+
+// Counts the symbols of a function, for the functions that -stream forgets before the report is printed
+void time_report_count_function ( const symbol_table_t *function_symtable );
+
+// Ends the current phase, and prints the measurements, and the size of the syntax tree, symbol tables and string list,
+// on report_stream. As one line of JSON if json is set. path is the file compiled, or NULL.
+void time_report_print ( const char *path, bool json );
+
+#endif // TIME_REPORT_H
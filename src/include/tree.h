@@ -1,9 +1,36 @@
 #ifndef TREE_H
 #define TREE_H
 #include "nodetypes.h"
+#include "arena.h"
+#include "source.h"
 
+#include <stdint.h>
 #include <stdlib.h>
 
+/* The operators of EXPRESSION and RELATION nodes.
+ * An EXPRESSION with OPERATOR_SUBTRACT and only one child is a negation.
+ * OPERATOR_LESS_EQUAL and OPERATOR_GREATER_EQUAL are not part of VSL, but are used by optimizations */
+typedef enum
+{
+    OPERATOR_ADD, OPERATOR_SUBTRACT, OPERATOR_MULTIPLY, OPERATOR_DIVIDE, OPERATOR_SHIFT_LEFT, OPERATOR_SHIFT_RIGHT,
+    OPERATOR_EQUAL, OPERATOR_NOT_EQUAL, OPERATOR_LESS, OPERATOR_GREATER, OPERATOR_LESS_EQUAL, OPERATOR_GREATER_EQUAL
+} operator_t;
+
+// Use as a normal array, to get the VSL spelling of an operator: OPERATOR_NAMES[node->operator]
+#define OPERATOR_NAMES ((const char *[]){           \
+        [OPERATOR_ADD] = "+",                       \
+        [OPERATOR_SUBTRACT] = "-",                  \
+        [OPERATOR_MULTIPLY] = "*",                  \
+        [OPERATOR_DIVIDE] = "/",                    \
+        [OPERATOR_SHIFT_LEFT] = "<<",               \
+        [OPERATOR_SHIFT_RIGHT] = ">>",              \
+        [OPERATOR_EQUAL] = "=",                     \
+        [OPERATOR_NOT_EQUAL] = "!=",                \
+        [OPERATOR_LESS] = "<",                      \
+        [OPERATOR_GREATER] = ">",                   \
+        [OPERATOR_LESS_EQUAL] = "<=",               \
+        [OPERATOR_GREATER_EQUAL] = ">="})
+
 /* This is the tree node structure for the abstract syntax tree (AST) */
 typedef struct node
 {
@@ -11,21 +38,46 @@ typedef struct node
     struct node** children; // An owned list of pointers to child nodes
     size_t n_children; // The length of the list of child nodes
 
-    void* data; // Extra data, only owned if type ends in _DATA
+    // Extra data, depending on the type of the node
+    union {
+        void* data; // Strings allocated with tree_alloc, or the position of a STRING_LIST_REFERENCE
+        source_slice_t slice; // The string literal of a STRING_DATA node, including the ""
+        int64_t value; // The number of a NUMBER_DATA node
+        operator_t operator; // The operator of an EXPRESSION or RELATION node
+    };
     struct symbol* symbol;
 } node_t;
 
 /* Global root for parse tree and the abstract syntax tree (AST) */
-extern node_t *root;
+extern _Thread_local node_t *root;
+
+// Allocates memory that lives as long as the syntax tree, used for the data of nodes.
+// Everything is freed together by destroy_syntax_tree
+void* tree_alloc ( size_t size );
+char* tree_strdup ( const char *string );
+
+// Frees everything allocated with tree_alloc after the mark, such as a function compiled with -stream
+arena_mark_t tree_mark ( void );
+void tree_release ( arena_mark_t mark );
 
-// The node creation function, needed by the parser
+// The node creation functions, needed by the parser
 node_t* node_create ( node_type_t type, void *data, size_t n_children, ... );
+node_t* operator_node_create ( node_type_t type, operator_t operator, size_t n_children, ... );
+node_t* number_node_create ( int64_t value );
+node_t* string_node_create ( source_slice_t slice );
 // Append an element to the given LIST node, returns the list node
 node_t* append_to_list_node( node_t* list_node, node_t* element );
 
 void print_syntax_tree ( void );
 void destroy_syntax_tree ( void );
+// Like destroy_syntax_tree, but keeps some of the memory for the next syntax tree made on this thread
+void reset_syntax_tree ( void );
+// Returns a copy of the given node, and all its children, sharing their data and symbols
+node_t* copy_subtree ( node_t *node );
 void simplify_tree ( void );
+// Simplifies one global of a program compiled with -stream, where calls can't be folded,
+// since the functions they call may not have been parsed yet
+node_t* simplify_global ( node_t *global );
 
 // Special function used when syntax trees are output as graphviz graphs.
 // Implemented in graphviz_output.c
@@ -4,6 +4,8 @@
 #include "tree.h"
 /* Definition of the symbol table, and functions for building it */
 #include "symbols.h"
+/* Reporting errors in the program being compiled */
+#include "error.h"
 
 #include <assert.h>
 #include <stdarg.h>
@@ -13,13 +15,54 @@
 #include <stdlib.h>
 #include <string.h>
 
-/* Function for generating machine code, in generator.c */
-void generate_program ( void );
+/* Where the syntax tree, the symbol tables and the generated program are printed, in libvslc.c.
+ * All of a compilation's state belongs to the thread running it, see libvslc.h */
+extern _Thread_local FILE *output_stream;
 
-/* The main driver function of the parser generated by bison */
-int yyparse ();
+/* Where passes report what they did, such as the code removed by -report-dead. Returned by vslc_reports */
+extern _Thread_local FILE *report_stream;
 
-/* A "hidden" cleanup function in flex */
-int yylex_destroy ();
+/* Function for generating machine code, in generator.c.
+ * With jobs above 1, functions are generated on that many threads, and the output is the same */
+void generate_program ( int jobs );
+
+/* With -stream, the program is generated one global at a time instead, in the order they are parsed.
+ * first_function is the entry point, or NULL in a module */
+void begin_streamed_program ( void );
+void generate_streamed_function ( symbol_t *function );
+void generate_streamed_declaration ( node_t *declaration );
+void end_streamed_program ( symbol_t *first_function );
+
+/* When set, the program is a module without main, whose functions can all be called from other modules.
+ * Set from the options in libvslc.c */
+extern _Thread_local bool compile_as_module;
+
+/* When set, generated programs use the freestanding runtime instead of libc, in generator.c */
+extern _Thread_local bool use_freestanding_runtime;
+
+/* When set, generated functions count their calls, the time spent in them and the calls they make,
+ * and the program writes a profile when it exits. In generator.c, set by -p */
+extern _Thread_local bool generate_profiling;
+
+/* Functions for emitting the freestanding runtime, in runtime.c */
+void generate_runtime_data ( void );
+void generate_runtime ( void );
+
+/* Parses the source in source.h, and sets root to the syntax tree. In parser.y */
+void parse ( void );
+
+/* When set, parse passes each global to compile_global as soon as it is parsed, and root stays NULL.
+ * Both are in libvslc.c */
+extern _Thread_local bool compile_streaming;
+void compile_global ( node_t *global );
+
+/* The scanner, generated by flex or hand-written in fast_scanner.c.
+ * Both scan the source in source.h, and set token_slice to the text of each token.
+ * They are reentrant, keeping the rest of their state in the handle made by yylex_init */
+typedef void* yyscan_t;
+int yylex_init ( yyscan_t *scanner );
+int yylex ( YYSTYPE *value, yyscan_t scanner );
+int yyget_lineno ( yyscan_t scanner ); // The line currently being read
+int yylex_destroy ( yyscan_t scanner );
 
 #endif // VSLC_H
@@ -0,0 +1,281 @@
+#include "vslc.h"
+#include "libvslc.h"
+#include "ranges.h"
+#include "dead_code.h"
+#include "profile.h"
+#include "function_cache.h"
+#include "time_report.h"
+
+_Thread_local FILE *output_stream;
+_Thread_local FILE *report_stream;
+_Thread_local bool compile_as_module;
+_Thread_local bool compile_streaming;
+
+struct vslc_context
+{
+    vslc_options_t options;
+    char *output;         // Everything printed by the last compilation, from open_memstream
+    size_t output_length;
+    char *error;          // The error message of the last compilation, or NULL
+    char *reports;        // Everything reported by the last compilation, from open_memstream
+    size_t reports_length;
+};
+
+// Set by vslc_keep_thread_memory
+static _Thread_local bool keep_memory;
+
+// The error handler of the compilation running on this thread.
+// It is not a local variable, since those may lose changes made between setjmp and longjmp
+static _Thread_local error_handler_t handler;
+
+static bool run_compilation ( vslc_context_t *context, const char *path, const char *text, size_t length,
+                              FILE *stream, vslc_buffer_t *out_buffer );
+static void compile ( const vslc_options_t *options );
+static void compile_streamed ( const vslc_options_t *options );
+static void clean_up ( void );
+
+/* External interface */
+
+vslc_context_t* vslc_context_create ( const vslc_options_t *options )
+{
+    vslc_context_t *context = malloc ( sizeof(vslc_context_t) );
+    *context = (vslc_context_t) { .options = *options };
+    return context;
+}
+
+void vslc_context_destroy ( vslc_context_t *context )
+{
+    free ( context->output );
+    free ( context->error );
+    free ( context->reports );
+    free ( context );
+}
+
+bool vslc_compile ( vslc_context_t *context, const char *source, size_t length, vslc_buffer_t *out_buffer )
+{
+    return run_compilation ( context, NULL, source, length, NULL, out_buffer );
+}
+
+bool vslc_compile_file ( vslc_context_t *context, const char *path, vslc_buffer_t *out_buffer )
+{
+    return run_compilation ( context, path, NULL, 0, NULL, out_buffer );
+}
+
+bool vslc_compile_file_to ( vslc_context_t *context, const char *path, FILE *stream )
+{
+    vslc_buffer_t output;
+    return run_compilation ( context, path, NULL, 0, stream, &output );
+}
+
+const char* vslc_error ( vslc_context_t *context )
+{
+    return context->error;
+}
+
+const char* vslc_reports ( vslc_context_t *context )
+{
+    return context->reports != NULL ? context->reports : "";
+}
+
+void vslc_keep_thread_memory ( bool keep )
+{
+    keep_memory = keep;
+    if ( !keep )
+        destroy_syntax_tree ( );
+}
+
+/* Internal matters */
+
+/* Compiles the text, or the file at path if text is NULL. The output goes to the stream,
+ * or to the context if stream is NULL. Errors jump back here, and whatever the compilation had made is freed */
+static bool run_compilation ( vslc_context_t *context, const char *path, const char *text, size_t length,
+                              FILE *stream, vslc_buffer_t *out_buffer )
+{
+    free ( context->output );
+    free ( context->error );
+    free ( context->reports );
+    context->output = NULL;
+    context->output_length = 0;
+    context->error = NULL;
+    output_stream = stream != NULL ? stream : open_memstream ( &context->output, &context->output_length );
+    report_stream = open_memstream ( &context->reports, &context->reports_length );
+    use_freestanding_runtime = context->options.use_freestanding_runtime;
+    generate_profiling = context->options.profile;
+    compile_as_module = context->options.no_main;
+    compile_streaming = false;
+    time_report_start ( context->options.time_report != VSLC_TIME_REPORT_NONE );
+
+    // The caller may have a handler of its own, such as the one of a thread in parallel.h
+    error_handler_t *outer_handler = error_handler;
+    handler.message = NULL;
+    error_handler = &handler;
+    if ( setjmp ( handler.jump ) == 0 )
+    {
+        if ( context->options.profile && context->options.use_freestanding_runtime )
+            compile_error ( "error: -p writes the profile with libc, and can't be combined with -nostdlib" );
+        // The counters of the profile are numbered in the code generated without it
+        if ( context->options.profile && context->options.profile_path != NULL )
+            compile_error ( "error: -p can't be combined with -fprofile-use" );
+        if ( text != NULL )
+            source_copy ( text, length );
+        else
+            source_open ( path );
+        if ( context->options.stream )
+            compile_streamed ( &context->options );
+        else
+            compile ( &context->options );
+        if ( context->options.time_report != VSLC_TIME_REPORT_NONE )
+            time_report_print ( path, context->options.time_report == VSLC_TIME_REPORT_JSON );
+    }
+    error_handler = outer_handler;
+    clean_up ( );
+
+    if ( stream == NULL )
+        fclose ( output_stream );
+    output_stream = NULL;
+    fclose ( report_stream );
+    report_stream = NULL;
+    context->error = handler.message;
+    *out_buffer = (vslc_buffer_t) { .data = context->output, .length = context->output_length };
+    return context->error == NULL;
+}
+
+/* Runs every pass of the compiler on the source */
+static void compile ( const vslc_options_t *options )
+{
+    // The time of each phase is measured for -ftime-report, in time_report.c
+    time_report_phase ( PHASE_PARSE );
+    parse ( ); // In parser.y, constructs the syntax tree
+
+    // Operations in tree.c
+    if ( options->print_full_tree )
+        print_syntax_tree ( );
+
+    time_report_phase ( PHASE_SIMPLIFY );
+    simplify_tree ( );
+    if ( options->print_tree_after_simplify )
+        print_syntax_tree ( );
+
+    // Operations in symbols.c
+    time_report_phase ( PHASE_BIND );
+    create_tables ( options->jobs );
+    if ( options->print_symbol_table_contents )
+        print_tables ( );
+
+    // Operations in ranges.c, which need the names to be bound
+    time_report_phase ( PHASE_RANGES );
+    optimize_with_ranges ( );
+
+    // Operations in dead_code.c
+    time_report_phase ( PHASE_DEAD_CODE );
+    remove_dead_code ( options->report_dead_code );
+
+    // Operations in profile.c, which need the program to be optimized just like when the profile was made
+    if ( options->profile_path != NULL )
+    {
+        time_report_phase ( PHASE_PROFILE );
+        optimize_with_profile ( options->profile_path );
+    }
+
+    // Operations in generator.c, which may reuse the code of functions from the cache in function_cache.c
+    time_report_phase ( PHASE_GENERATE );
+    if ( options->generate_program && options->cache_directory != NULL )
+        function_cache_open ( options->cache_directory, options->cache_max_size, options->report_cache_stats );
+    if ( options->generate_program )
+        generate_program ( options->jobs );
+}
+
+// With -stream, the first function, which becomes the entry point
+static _Thread_local symbol_t *first_function;
+
+// With -stream, everything in the syntax tree before this is kept, and everything after it belongs to the global
+// being parsed. Only the declarations of global variables and extern functions are kept, and a copy of the name
+// and parameters of each function
+static _Thread_local arena_mark_t kept_tree;
+
+/* Compiles the program one global at a time, as they are parsed, so that only one function is in memory at a time.
+ * The passes that look at the whole program, range analysis and the removal of dead code, are left out */
+static void compile_streamed ( const vslc_options_t *options )
+{
+    if ( !options->generate_program || options->print_full_tree || options->print_tree_after_simplify
+         || options->print_symbol_table_contents || options->report_dead_code || options->profile_path != NULL )
+        compile_error ( "error: -stream needs -c, and can't be combined with -t, -T, -s, -report-dead "
+                        "or -fprofile-use" );
+
+    if ( options->cache_directory != NULL )
+        function_cache_open ( options->cache_directory, options->cache_max_size, options->report_cache_stats );
+    begin_streamed_tables ( );  // In symbols.c
+    begin_streamed_program ( ); // In generator.c
+    first_function = NULL;
+    kept_tree = tree_mark ( );
+
+    compile_streaming = true;
+    time_report_phase ( PHASE_PARSE );
+    parse ( ); // In parser.y, which calls compile_global
+    compile_streaming = false;
+
+    time_report_phase ( PHASE_BIND );
+    finish_streamed_tables ( );
+    time_report_phase ( PHASE_GENERATE );
+    end_streamed_program ( first_function );
+}
+
+/* Replaces the syntax tree of the function with a node holding only its name and parameters,
+ * which is all that calls to it need, and frees the rest along with its local symbols */
+static void forget_function_body ( symbol_t *function )
+{
+    node_t *parameters = function->node->children[1];
+    size_t n_parameters = parameters->n_children;
+    char **names = malloc ( n_parameters * sizeof(char*) );
+    for ( size_t i = 0; i < n_parameters; i++ )
+        names[i] = parameters->children[i]->data;
+
+    tree_release ( kept_tree );
+    time_report_count_function ( function->function_symtable );
+    symbol_table_destroy ( function->function_symtable );
+    function->function_symtable = NULL;
+
+    // The names are interned, so they are still there
+    parameters = node_create ( LIST, NULL, 0 );
+    for ( size_t i = 0; i < n_parameters; i++ )
+        append_to_list_node ( parameters, node_create ( IDENTIFIER_DATA, names[i], 0 ) );
+    function->node = node_create ( FUNCTION, NULL, 2, node_create ( IDENTIFIER_DATA, function->name, 0 ), parameters );
+    free ( names );
+}
+
+/* Called by the parser with -stream, as soon as each global has been parsed */
+void compile_global ( node_t *global )
+{
+    phase_t parsing = time_report_phase ( PHASE_SIMPLIFY );
+    global = simplify_global ( global );                // In tree.c
+    time_report_phase ( PHASE_BIND );
+    symbol_t *function = add_streamed_global ( global ); // In symbols.c
+
+    // In generator.c
+    time_report_phase ( PHASE_GENERATE );
+    if ( global->type == FUNCTION )
+    {
+        generate_streamed_function ( function );
+        if ( first_function == NULL )
+            first_function = function;
+        forget_function_body ( function );
+    }
+    else if ( global->type == GLOBAL_DECLARATION )
+        generate_streamed_declaration ( global );
+
+    kept_tree = tree_mark ( );
+    time_report_phase ( parsing );
+}
+
+/* Frees everything made by a compilation, whether it finished or not */
+static void clean_up ( void )
+{
+    function_cache_close ( ); // In function_cache.c
+    destroy_tables ( );       // In symbols.c
+    if ( keep_memory )        // In tree.c
+        reset_syntax_tree ( );
+    else
+        destroy_syntax_tree ( );
+    source_close ( );
+    compile_streaming = false;
+}
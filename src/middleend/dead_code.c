@@ -0,0 +1,171 @@
+#include "vslc.h"
+#include "dead_code.h"
+
+// Everything used by a reachable function is reachable, starting with the entry function.
+// In a module, every function can be called from other modules, so they are all reachable.
+// Reachable functions are found with a worklist, so that each function body is only walked once.
+
+static _Thread_local bool *symbol_reachable; // Indexed by sequence number in the global symbol table
+static _Thread_local bool *string_reachable; // Indexed by position in the string list
+static _Thread_local symbol_t **worklist;
+static _Thread_local size_t worklist_length;
+
+static void mark_reachable ( node_t *node );
+static void renumber_strings ( node_t *node, size_t *new_positions );
+static void remove_declarations ( void );
+
+/* External interface */
+
+void remove_dead_code ( bool report )
+{
+    size_t n_symbols = global_symbols->n_symbols;
+    symbol_reachable = calloc ( n_symbols + 1, sizeof(bool) );
+    string_reachable = calloc ( string_list_len + 1, sizeof(bool) );
+    worklist = malloc ( ( n_symbols + 1 ) * sizeof(symbol_t*) );
+    worklist_length = 0;
+
+    // The first function is the entry point, called by main. In a module, every function is an entry point
+    for ( size_t i = 0; i < n_symbols; i++ )
+    {
+        symbol_t *symbol = global_symbols->symbols[i];
+        if ( symbol->type == SYMBOL_FUNCTION )
+        {
+            symbol_reachable[i] = true;
+            worklist[worklist_length++] = symbol;
+            if ( !compile_as_module )
+                break;
+        }
+    }
+
+    while ( worklist_length > 0 )
+    {
+        symbol_t *function = worklist[--worklist_length];
+        mark_reachable ( function->node->children[2] );
+    }
+
+    if ( report )
+    {
+        for ( size_t i = 0; i < n_symbols; i++ )
+        {
+            symbol_t *symbol = global_symbols->symbols[i];
+            if ( symbol_reachable[i] )
+                continue;
+            const char *kind = symbol->type == SYMBOL_FUNCTION ? "function" :
+                               symbol->type == SYMBOL_EXTERN_FUNCTION ? "extern function" :
+                               symbol->type == SYMBOL_GLOBAL_ARRAY ? "global array" : "global variable";
+            fprintf ( report_stream, "removed unused %s '%s'\n", kind, symbol->name );
+        }
+        for ( size_t i = 0; i < string_list_len; i++ )
+            if ( !string_reachable[i] )
+                fprintf ( report_stream, "removed unused string %.*s\n", (int) string_list[i].length, SLICE_TEXT ( string_list[i] ) );
+    }
+
+    // Give the reachable strings new positions
+    size_t *new_positions = malloc ( ( string_list_len + 1 ) * sizeof(size_t) );
+    size_t n_strings = 0;
+    for ( size_t i = 0; i < string_list_len; i++ )
+    {
+        if ( string_reachable[i] )
+        {
+            new_positions[i] = n_strings;
+            string_list[n_strings++] = string_list[i];
+        }
+    }
+    string_list_len = n_strings;
+
+    for ( size_t i = 0; i < n_symbols; i++ )
+    {
+        symbol_t *symbol = global_symbols->symbols[i];
+        if ( symbol_reachable[i] && symbol->type == SYMBOL_FUNCTION )
+            renumber_strings ( symbol->node->children[2], new_positions );
+    }
+    free ( new_positions );
+
+    // Take the declarations out of the tree first, while their symbols can still be looked up
+    remove_declarations ( );
+
+    bool *remove = malloc ( ( n_symbols + 1 ) * sizeof(bool) );
+    for ( size_t i = 0; i < n_symbols; i++ )
+    {
+        symbol_t *symbol = global_symbols->symbols[i];
+        remove[i] = !symbol_reachable[i];
+        if ( remove[i] && symbol->type == SYMBOL_FUNCTION )
+            symbol_table_destroy ( symbol->function_symtable );
+    }
+    symbol_table_remove_symbols ( global_symbols, remove );
+    free ( remove );
+
+    free ( symbol_reachable );
+    free ( string_reachable );
+    free ( worklist );
+}
+
+/* Internal matters */
+
+/* Marks every global symbol and string used in the subtree as reachable.
+ * Functions that become reachable are added to the worklist. */
+static void mark_reachable ( node_t *node )
+{
+    if ( node->type == STRING_LIST_REFERENCE )
+        string_reachable[(size_t) node->data] = true;
+
+    symbol_t *symbol = node->symbol;
+    bool is_global = symbol != NULL &&
+        ( symbol->type == SYMBOL_FUNCTION || symbol->type == SYMBOL_EXTERN_FUNCTION ||
+          symbol->type == SYMBOL_GLOBAL_VAR || symbol->type == SYMBOL_GLOBAL_ARRAY );
+    if ( is_global && !symbol_reachable[symbol->sequence_number] )
+    {
+        symbol_reachable[symbol->sequence_number] = true;
+        if ( symbol->type == SYMBOL_FUNCTION )
+            worklist[worklist_length++] = symbol;
+    }
+
+    for ( size_t i = 0; i < node->n_children; i++ )
+        mark_reachable ( node->children[i] );
+}
+
+/* Updates the positions in all STRING_LIST_REFERENCE nodes in the subtree */
+static void renumber_strings ( node_t *node, size_t *new_positions )
+{
+    if ( node->type == STRING_LIST_REFERENCE )
+        node->data = (void*) new_positions[(size_t) node->data];
+
+    for ( size_t i = 0; i < node->n_children; i++ )
+        renumber_strings ( node->children[i], new_positions );
+}
+
+/* Takes the declarations of all unreachable globals out of the syntax tree.
+ * Global declaration lists that become empty are also removed. */
+static void remove_declarations ( void )
+{
+    size_t n_kept = 0;
+    for ( size_t i = 0; i < root->n_children; i++ )
+    {
+        node_t *node = root->children[i];
+        if ( node->type == FUNCTION || node->type == EXTERN_FUNCTION )
+        {
+            symbol_t *symbol = symbol_hashmap_lookup ( global_symbols->hashmap, node->children[0]->data );
+            if ( !symbol_reachable[symbol->sequence_number] )
+                continue;
+        }
+        else
+        {
+            node_t *global_variable_list = node->children[0];
+            size_t n_variables_kept = 0;
+            for ( size_t j = 0; j < global_variable_list->n_children; j++ )
+            {
+                node_t *var = global_variable_list->children[j];
+                char *name = var->type == ARRAY_INDEXING ? var->children[0]->data : var->data;
+                symbol_t *symbol = symbol_hashmap_lookup ( global_symbols->hashmap, name );
+                if ( symbol_reachable[symbol->sequence_number] )
+                    global_variable_list->children[n_variables_kept++] = var;
+            }
+            global_variable_list->n_children = n_variables_kept;
+
+            if ( n_variables_kept == 0 )
+                continue;
+        }
+        root->children[n_kept++] = node;
+    }
+    root->n_children = n_kept;
+}
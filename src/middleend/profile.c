@@ -0,0 +1,379 @@
+#include "vslc.h"
+#include "profile.h"
+#include "intern.h"
+
+#include <errno.h>
+
+#define FUNC_PARAM_COUNT(func) ((func)->node->children[1]->n_children)
+
+// The profile has one line for each function, call edge, if statement and while loop, written by vslc_profile_dump:
+//     function <name> <calls> <cycles> <self cycles>
+//     call <caller> <callee> <calls>
+//     branch <function> THEN<number> <runs> <runs of the then-block>
+//     loop <function> WHILE<number> <runs> <iterations>
+// where the numbers are the ones in the labels the generator gave the statements.
+// The counts of a line are attached to its node, and stay valid for as long as the syntax tree.
+
+// A call edge is hot, and its calls may be inlined, when it was taken at least this many times
+#define INLINE_MIN_CALLS 1000
+// The largest expression, in nodes, that a call is replaced by
+#define INLINE_MAX_NODES 24
+// A loop is unrolled when it has iterated at least this many times, and at least this many times each time it ran
+#define UNROLL_MIN_ITERATIONS 1000
+#define UNROLL_MIN_AVERAGE 4
+// The largest loop body, in nodes, that is unrolled
+#define UNROLL_MAX_NODES 40
+// A function is hot when at least this large a part of the program's cycles was spent in the function itself
+#define HOT_FUNCTION_DIVISOR 20
+
+// What the profile says about one function
+typedef struct
+{
+    node_t **ifs, **whiles; // Numbered like the labels of the generator
+    size_t n_ifs, n_whiles;
+    size_t n_if_lines, n_while_lines;
+    bool in_profile;
+    bool changed;           // The profile doesn't match the function, so it is left alone
+    symbol_t **hot_callees;
+    size_t n_hot_callees;
+} function_profile_t;
+
+static _Thread_local function_profile_t *functions; // Indexed by sequence number in the global symbol table
+static _Thread_local int64_t total_self_cycles;
+
+static void number_statements ( node_t *node, function_profile_t *function );
+static size_t read_profile ( FILE *file );
+static void use_profile ( void );
+static void choose_layouts ( node_t *node );
+static void inline_in_statement ( node_t *statement, function_profile_t *caller );
+
+/* External interface */
+
+void optimize_with_profile ( const char *path )
+{
+    FILE *file = fopen ( path, "r" );
+    if ( file == NULL )
+        compile_error ( "error: could not read the profile '%s': %s", path, strerror ( errno ) );
+
+    size_t n_symbols = global_symbols->n_symbols;
+    functions = calloc ( n_symbols + 1, sizeof(function_profile_t) );
+    total_self_cycles = 0;
+
+    for ( size_t i = 0; i < n_symbols; i++ )
+        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+            number_statements ( global_symbols->symbols[i]->node->children[2], &functions[i] );
+
+    size_t bad_line = read_profile ( file );
+    fclose ( file );
+    if ( bad_line == 0 )
+        use_profile ( );
+
+    for ( size_t i = 0; i < n_symbols; i++ )
+    {
+        free ( functions[i].ifs );
+        free ( functions[i].whiles );
+        free ( functions[i].hot_callees );
+    }
+    free ( functions );
+    functions = NULL;
+
+    if ( bad_line > 0 )
+        compile_error ( "error: line %zu of '%s' is not part of a profile", bad_line, path );
+}
+
+/* Internal matters */
+
+static void append_node ( node_t ***nodes, size_t *n_nodes, node_t *node )
+{
+    // Grows to the next power of two when full
+    if ( ( *n_nodes & ( *n_nodes - 1 ) ) == 0 )
+        *nodes = realloc ( *nodes, ( *n_nodes > 0 ? *n_nodes * 2 : 1 ) * sizeof(node_t*) );
+    (*nodes)[(*n_nodes)++] = node;
+}
+
+/* Lists the if and while statements of a function in the order the generator numbers them, as it meets them */
+static void number_statements ( node_t *node, function_profile_t *function )
+{
+    if ( node->type == IF_STATEMENT )
+        append_node ( &function->ifs, &function->n_ifs, node );
+    else if ( node->type == WHILE_STATEMENT )
+        append_node ( &function->whiles, &function->n_whiles, node );
+    for ( size_t i = 0; i < node->n_children; i++ )
+        number_statements ( node->children[i], function );
+}
+
+/* Leaves out the counts of functions that have changed, and optimizes the rest with them */
+static void use_profile ( void )
+{
+    for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+    {
+        symbol_t *symbol = global_symbols->symbols[i];
+        function_profile_t *function = &functions[i];
+        if ( symbol->type != SYMBOL_FUNCTION || !function->in_profile )
+            continue;
+
+        if ( function->changed || function->n_if_lines != function->n_ifs || function->n_while_lines != function->n_whiles )
+        {
+            fprintf ( report_stream, "profile: function '%s' has changed since the profile was made, "
+                      "and is not optimized with it\n", symbol->name );
+            for ( size_t j = 0; j < function->n_ifs; j++ )
+                function->ifs[j]->data = NULL;
+            for ( size_t j = 0; j < function->n_whiles; j++ )
+                function->whiles[j]->data = NULL;
+            function->n_hot_callees = 0;
+        }
+
+        profile_counts_t *counts = symbol->node->data;
+        if ( counts->runs == 0 )
+            counts->layout = LAYOUT_COLD;
+        else if ( total_self_cycles > 0 && counts->inner >= total_self_cycles / HOT_FUNCTION_DIVISOR )
+            counts->layout = LAYOUT_HOT;
+    }
+
+    // The layouts are chosen before inlining, which only adds expressions
+    for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+            choose_layouts ( global_symbols->symbols[i]->node->children[2] );
+    for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+        if ( functions[i].n_hot_callees > 0 )
+            inline_in_statement ( global_symbols->symbols[i]->node->children[2], &functions[i] );
+}
+
+/* Returns the function with the given name, or NULL if there is none in this program */
+static symbol_t* find_function ( const char *name )
+{
+    symbol_t *symbol = symbol_hashmap_lookup ( global_symbols->hashmap, intern ( name, strlen ( name ) ) );
+    return symbol != NULL && symbol->type == SYMBOL_FUNCTION ? symbol : NULL;
+}
+
+static profile_counts_t* make_counts ( int64_t runs, int64_t inner )
+{
+    profile_counts_t *counts = tree_alloc ( sizeof(profile_counts_t) );
+    *counts = (profile_counts_t) { .runs = runs, .inner = inner, .layout = LAYOUT_DEFAULT };
+    return counts;
+}
+
+/* Attaches the counts of a branch or loop line to the statement with the number in the label */
+static void attach_statement_counts ( function_profile_t *function, const char *label, const char *prefix,
+                                      int64_t runs, int64_t inner )
+{
+    bool is_if = strcmp ( prefix, "THEN" ) == 0;
+    node_t **statements = is_if ? function->ifs : function->whiles;
+    size_t n_statements = is_if ? function->n_ifs : function->n_whiles;
+    if ( is_if )
+        function->n_if_lines++;
+    else
+        function->n_while_lines++;
+
+    char *end;
+    size_t number = strtoul ( label + strlen ( prefix ), &end, 10 );
+    if ( strncmp ( label, prefix, strlen ( prefix ) ) != 0 || *end != '\0' || number >= n_statements )
+        function->changed = true;
+    else
+        statements[number]->data = make_counts ( runs, inner );
+}
+
+/* Attaches the counts in the profile to the nodes. Returns the number of the first line that isn't part of a profile,
+ * or 0 if they all are */
+static size_t read_profile ( FILE *file )
+{
+    char *line = NULL;
+    size_t capacity = 0;
+    for ( size_t line_number = 1; getline ( &line, &capacity, file ) > 0; line_number++ )
+    {
+        // Every line is a kind, one or two names, and one to three counts
+        char *fields[6];
+        size_t n_fields = 0;
+        char *rest;
+        for ( char *field = strtok_r ( line, " \n", &rest ); field != NULL && n_fields < 6;
+              field = strtok_r ( NULL, " \n", &rest ) )
+            fields[n_fields++] = field;
+        const char *kind = n_fields > 0 ? fields[0] : "";
+        size_t first_count = strcmp ( kind, "function" ) == 0 ? 2 : 3;
+        int64_t counts[4] = { 0 };
+        for ( size_t i = first_count; i < n_fields; i++ )
+            counts[i - first_count] = strtoll ( fields[i], NULL, 10 );
+
+        if ( n_fields == 5 && strcmp ( kind, "function" ) == 0 )
+        {
+            symbol_t *function = find_function ( fields[1] );
+            if ( function == NULL )
+                continue;
+            function->node->data = make_counts ( counts[0], counts[2] );
+            functions[function->sequence_number].in_profile = true;
+            total_self_cycles += counts[2];
+            continue;
+        }
+
+        symbol_t *function = n_fields >= 4 ? find_function ( fields[1] ) : NULL;
+        function_profile_t *profile = function != NULL ? &functions[function->sequence_number] : NULL;
+        if ( n_fields == 4 && strcmp ( kind, "call" ) == 0 )
+        {
+            symbol_t *callee = find_function ( fields[2] );
+            if ( profile != NULL && callee != NULL && counts[0] >= INLINE_MIN_CALLS )
+            {
+                profile->hot_callees = realloc ( profile->hot_callees, ( profile->n_hot_callees + 1 ) * sizeof(symbol_t*) );
+                profile->hot_callees[profile->n_hot_callees++] = callee;
+            }
+        }
+        else if ( n_fields == 5 && strcmp ( kind, "branch" ) == 0 )
+        {
+            if ( profile != NULL )
+                attach_statement_counts ( profile, fields[2], "THEN", counts[0], counts[1] );
+        }
+        else if ( n_fields == 5 && strcmp ( kind, "loop" ) == 0 )
+        {
+            if ( profile != NULL )
+                attach_statement_counts ( profile, fields[2], "WHILE", counts[0], counts[1] );
+        }
+        else
+        {
+            free ( line );
+            return line_number;
+        }
+    }
+    free ( line );
+    return 0;
+}
+
+static size_t count_nodes ( node_t *node )
+{
+    size_t n_nodes = 1;
+    for ( size_t i = 0; i < node->n_children; i++ )
+        n_nodes += count_nodes ( node->children[i] );
+    return n_nodes;
+}
+
+static bool contains ( node_t *node, node_type_t type )
+{
+    if ( node->type == type )
+        return true;
+    for ( size_t i = 0; i < node->n_children; i++ )
+        if ( contains ( node->children[i], type ) )
+            return true;
+    return false;
+}
+
+static void choose_layouts ( node_t *node )
+{
+    // Without an else-block, skipping the then-block takes one branch, which beats the default whichever way it goes
+    profile_counts_t *counts = node->data;
+    if ( node->type == IF_STATEMENT && counts != NULL && counts->runs > 0 )
+        counts->layout = counts->inner * 2 >= counts->runs || node->n_children == 2 ? LAYOUT_THEN_FIRST
+                                                                                   : LAYOUT_ELSE_FIRST;
+
+    // Only innermost loops are unrolled, so that the code doesn't grow more than twice for each loop
+    if ( node->type == WHILE_STATEMENT && counts != NULL && counts->inner > 0 && counts->inner >= counts->runs )
+    {
+        node_t *body = node->children[1];
+        if ( counts->inner >= UNROLL_MIN_ITERATIONS && counts->inner >= counts->runs * UNROLL_MIN_AVERAGE &&
+             count_nodes ( body ) <= UNROLL_MAX_NODES && !contains ( body, WHILE_STATEMENT ) )
+            counts->layout = LAYOUT_UNROLLED;
+        else
+            counts->layout = LAYOUT_ROTATED;
+    }
+
+    for ( size_t i = 0; i < node->n_children; i++ )
+        choose_layouts ( node->children[i] );
+}
+
+/* Returns the expression the function returns, if it does nothing else, and the expression is small and calls nothing */
+static node_t* returned_expression ( symbol_t *function )
+{
+    // Blocks without declarations, around a single statement
+    node_t *body = function->node->children[2];
+    while ( body->type == BLOCK && body->n_children == 1 && body->children[0]->n_children == 1 )
+        body = body->children[0]->children[0];
+    if ( body->type != RETURN_STATEMENT )
+        return NULL;
+
+    node_t *expression = body->children[0];
+    if ( count_nodes ( expression ) > INLINE_MAX_NODES || contains ( expression, FUNCTION_CALL ) )
+        return NULL;
+    return expression;
+}
+
+static size_t count_uses ( node_t *node, size_t parameter )
+{
+    if ( node->type == IDENTIFIER_DATA )
+        return node->symbol->type == SYMBOL_PARAMETER && node->symbol->sequence_number == parameter;
+    size_t uses = 0;
+    for ( size_t i = 0; i < node->n_children; i++ )
+        uses += count_uses ( node->children[i], parameter );
+    return uses;
+}
+
+/* Replaces the parameters in the copied expression by copies of the arguments */
+static node_t* substitute_arguments ( node_t *node, node_t *arguments )
+{
+    if ( node->type == IDENTIFIER_DATA && node->symbol->type == SYMBOL_PARAMETER )
+        return copy_subtree ( arguments->children[node->symbol->sequence_number] );
+    for ( size_t i = 0; i < node->n_children; i++ )
+        node->children[i] = substitute_arguments ( node->children[i], arguments );
+    return node;
+}
+
+/* Returns the expression the call can be replaced by, or NULL if it is kept.
+ * The callee's expression has no side effects, so the arguments may be evaluated as part of it, in any order,
+ * as long as they have no side effects either. An argument used more or less than once must also be cheap */
+static node_t* inline_call ( node_t *call, function_profile_t *caller )
+{
+    symbol_t *callee = call->children[0]->symbol;
+    bool hot = false;
+    for ( size_t i = 0; i < caller->n_hot_callees && !hot; i++ )
+        hot = caller->hot_callees[i] == callee;
+    node_t *expression = hot && callee->type == SYMBOL_FUNCTION ? returned_expression ( callee ) : NULL;
+    if ( expression == NULL )
+        return NULL;
+
+    node_t *arguments = call->children[1];
+    if ( arguments->n_children != FUNC_PARAM_COUNT ( callee ) )
+        return NULL;
+    for ( size_t i = 0; i < arguments->n_children; i++ )
+    {
+        node_t *argument = arguments->children[i];
+        bool cheap = argument->type == NUMBER_DATA || argument->type == IDENTIFIER_DATA;
+        if ( contains ( argument, FUNCTION_CALL ) || ( count_uses ( expression, i ) != 1 && !cheap ) )
+            return NULL;
+    }
+    return substitute_arguments ( copy_subtree ( expression ), arguments );
+}
+
+static void inline_in_expression ( node_t **place, function_profile_t *caller )
+{
+    node_t *node = *place;
+    for ( size_t i = 0; i < node->n_children; i++ )
+        inline_in_expression ( &node->children[i], caller );
+
+    node_t *inlined = node->type == FUNCTION_CALL ? inline_call ( node, caller ) : NULL;
+    if ( inlined != NULL )
+        *place = inlined;
+}
+
+/* Inlines the hot calls in the expressions of the statement. Calls that are statements of their own are kept,
+ * since the functions that could be inlined have no side effects, and are rarely called that way */
+static void inline_in_statement ( node_t *statement, function_profile_t *caller )
+{
+    switch ( statement->type )
+    {
+        case BLOCK: {
+            node_t *statement_list = statement->children[statement->n_children - 1];
+            for ( size_t i = 0; i < statement_list->n_children; i++ )
+                inline_in_statement ( statement_list->children[i], caller );
+            break;
+        }
+        case IF_STATEMENT:
+        case WHILE_STATEMENT:
+            inline_in_expression ( &statement->children[0], caller );
+            for ( size_t i = 1; i < statement->n_children; i++ )
+                inline_in_statement ( statement->children[i], caller );
+            break;
+        case FUNCTION_CALL:
+            inline_in_expression ( &statement->children[1], caller );
+            break;
+        default:
+            for ( size_t i = 0; i < statement->n_children; i++ )
+                inline_in_expression ( &statement->children[i], caller );
+            break;
+    }
+}
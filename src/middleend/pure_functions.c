@@ -0,0 +1,545 @@
+#include "vslc.h"
+#include "pure_functions.h"
+#include "arena.h"
+
+#include <setjmp.h>
+
+// Pure functions are translated into a small tree of their own, where names are resolved to slots in a frame,
+// and operators are enums. This makes evaluation fast, and independent of changes made to the syntax tree.
+//
+// Like in the generated code, all parameters and local variables of a function get their own slot,
+// and local variables are set to 0 when the function is called, not when their block is entered.
+
+// How many steps a single call from the program may take to evaluate, before giving up
+#define EVALUATION_STEP_BUDGET (1 << 24)
+// How many steps all calls in the program may take together, each time the tree is simplified.
+// Once they are used up, the remaining calls are left for runtime
+#define PROGRAM_STEP_BUDGET (1 << 26)
+// How deep the evaluation may recurse
+#define MAX_CALL_DEPTH 1000
+
+typedef enum {
+    CODE_CONSTANT,   // value is the constant
+    CODE_VARIABLE,   // value is the slot
+    CODE_OPERATION,  // value is the operator_t, children are the operands
+    CODE_CALL,       // value is the callee's sequence number, children are the arguments
+    CODE_BLOCK,      // children are the statements
+    CODE_ASSIGNMENT, // value is the slot, the child is the expression
+    CODE_RETURN,
+    CODE_IF,         // children are the relation, the then-statement, and maybe the else-statement
+    CODE_WHILE,      // children are the relation and the body
+    CODE_BREAK
+} code_kind_t;
+
+typedef struct code
+{
+    code_kind_t kind;
+    int64_t value;
+    struct code **children;
+    size_t n_children;
+} code_t;
+
+typedef struct
+{
+    code_t *body;         // NULL if the function can't be translated
+    size_t n_parameters;
+    size_t n_slots;       // Parameters and local variables
+    bool pure;
+    bool shadowed;        // A parameter or local variable somewhere has the same name as the function
+    bool too_slow;        // A call to the function has run out of steps, so no more are tried
+} function_info_t;
+
+typedef enum { FLOW_NORMAL, FLOW_BREAK, FLOW_RETURN } flow_t;
+
+/* Symbols for all global names, only used for looking them up.
+ * The functions list is indexed by the sequence numbers of these symbols. */
+static _Thread_local symbol_table_t *globals;
+static _Thread_local function_info_t *functions;
+
+/* All translated code is allocated here */
+static _Thread_local arena_t code_arena;
+
+/* The state of the translation of a function */
+static _Thread_local const char **scope_names; // The names in scope, innermost last
+static _Thread_local size_t *scope_slots;
+static _Thread_local size_t scope_length, scope_capacity;
+static _Thread_local size_t n_slots;
+static _Thread_local int loop_depth;
+static _Thread_local bool translation_failed;
+
+/* The state of an evaluation */
+static _Thread_local int64_t *frames; // The slots of all active calls, after each other
+static _Thread_local size_t frames_capacity, frame_base, frame_top;
+static _Thread_local int64_t return_value;
+static _Thread_local size_t steps_left;
+static _Thread_local size_t program_steps_left;
+static _Thread_local int call_depth;
+static _Thread_local jmp_buf give_up;
+
+static void declare ( const char *name );
+static code_t *translate ( node_t *node );
+static int64_t evaluate ( code_t *code );
+static int64_t call_function ( function_info_t *function );
+static flow_t execute ( code_t *code );
+
+/* External interface */
+
+void find_pure_functions ( node_t *program )
+{
+    program_steps_left = PROGRAM_STEP_BUDGET;
+    globals = symbol_table_init ( );
+    for ( size_t i = 0; i < program->n_children; i++ )
+    {
+        node_t *node = program->children[i];
+        if ( node->type == FUNCTION )
+        {
+            symbol_t *symbol = malloc ( sizeof(symbol_t) );
+            *symbol = (symbol_t) { .name = node->children[0]->data, .type = SYMBOL_FUNCTION, .node = node };
+            // Names defined twice are reported when the symbol tables are created
+            if ( symbol_table_insert ( globals, symbol ) == INSERT_COLLISION )
+                free ( symbol );
+            continue;
+        }
+        // Functions in other modules are left out, so calls to them are never pure
+        if ( node->type == EXTERN_FUNCTION )
+            continue;
+
+        node_t *global_variable_list = node->children[0];
+        for ( size_t j = 0; j < global_variable_list->n_children; j++ )
+        {
+            node_t *var = global_variable_list->children[j];
+            symbol_t *symbol = malloc ( sizeof(symbol_t) );
+            *symbol = (symbol_t) {
+                .name = var->type == ARRAY_INDEXING ? var->children[0]->data : var->data,
+                .type = var->type == ARRAY_INDEXING ? SYMBOL_GLOBAL_ARRAY : SYMBOL_GLOBAL_VAR,
+                .node = var
+            };
+            if ( symbol_table_insert ( globals, symbol ) == INSERT_COLLISION )
+                free ( symbol );
+        }
+    }
+
+    functions = calloc ( globals->n_symbols + 1, sizeof(function_info_t) );
+
+    // Translate all functions, which also finds the names that are shadowed
+    for ( size_t i = 0; i < globals->n_symbols; i++ )
+    {
+        symbol_t *function = globals->symbols[i];
+        if ( function->type != SYMBOL_FUNCTION )
+            continue;
+
+        node_t *parameters = function->node->children[1];
+        scope_length = n_slots = 0;
+        loop_depth = 0;
+        translation_failed = false;
+        for ( size_t j = 0; j < parameters->n_children; j++ )
+            declare ( parameters->children[j]->data );
+
+        code_t *body = translate ( function->node->children[2] );
+        if ( translation_failed )
+            body = NULL;
+        functions[i] = (function_info_t) {
+            .body = body,
+            .n_parameters = parameters->n_children,
+            .n_slots = n_slots,
+            .pure = body != NULL,
+            .shadowed = functions[i].shadowed
+        };
+    }
+
+    // A function that calls an impure function is also impure. Repeat until no more impure functions are found
+    bool changed = true;
+    while ( changed )
+    {
+        changed = false;
+        for ( size_t i = 0; i < globals->n_symbols; i++ )
+        {
+            if ( !functions[i].pure )
+                continue;
+
+            // Walk the translated code without recursion, using a list as a stack
+            size_t stack_capacity = 16, stack_length = 0;
+            code_t **stack = malloc ( stack_capacity * sizeof(code_t*) );
+            stack[stack_length++] = functions[i].body;
+            while ( stack_length > 0 && functions[i].pure )
+            {
+                code_t *code = stack[--stack_length];
+                if ( code->kind == CODE_CALL && !functions[code->value].pure )
+                {
+                    functions[i].pure = false;
+                    changed = true;
+                }
+                if ( stack_length + code->n_children > stack_capacity )
+                {
+                    stack_capacity = ( stack_length + code->n_children ) * 2;
+                    stack = realloc ( stack, stack_capacity * sizeof(code_t*) );
+                }
+                for ( size_t j = 0; j < code->n_children; j++ )
+                    stack[stack_length++] = code->children[j];
+            }
+            free ( stack );
+        }
+    }
+}
+
+node_t* evaluate_pure_call ( node_t *node )
+{
+    if ( globals == NULL || node->type != FUNCTION_CALL )
+        return node;
+
+    symbol_t *function = symbol_hashmap_lookup ( globals->hashmap, node->children[0]->data );
+    if ( function == NULL || function->type != SYMBOL_FUNCTION )
+        return node;
+
+    function_info_t *info = &functions[function->sequence_number];
+    node_t *arguments = node->children[1];
+    // Calls to shadowed names might not be calls to the function, and calls with the wrong number of arguments
+    // are reported when names are bound
+    if ( !info->pure || info->shadowed || info->too_slow || arguments->n_children != info->n_parameters
+         || program_steps_left == 0 )
+        return node;
+
+    int64_t argument_values[arguments->n_children + 1];
+    for ( size_t i = 0; i < arguments->n_children; i++ )
+    {
+        if ( arguments->children[i]->type != NUMBER_DATA )
+            return node;
+        argument_values[i] = arguments->children[i]->value;
+    }
+
+    // The steps count against the budget of the program too, whether the evaluation succeeds or not
+    size_t budget = program_steps_left < EVALUATION_STEP_BUDGET ? program_steps_left : EVALUATION_STEP_BUDGET;
+    steps_left = budget;
+    call_depth = 0;
+    frame_base = frame_top = 0;
+    if ( setjmp ( give_up ) != 0 )
+    {
+        program_steps_left -= budget - steps_left;
+        if ( steps_left == 0 )
+            info->too_slow = true;
+        return node;
+    }
+
+    if ( info->n_slots > frames_capacity )
+    {
+        frames_capacity = info->n_slots * 2;
+        frames = realloc ( frames, frames_capacity * sizeof(int64_t) );
+    }
+    memcpy ( frames, argument_values, arguments->n_children * sizeof(int64_t) );
+
+    int64_t value = call_function ( info );
+    program_steps_left -= budget - steps_left;
+    return number_node_create ( value );
+}
+
+void destroy_pure_functions ( void )
+{
+    if ( globals == NULL )
+        return;
+    arena_free_all ( &code_arena );
+    free ( functions );
+    symbol_table_destroy ( globals );
+    free ( scope_names );
+    free ( scope_slots );
+    free ( frames );
+    globals = NULL;
+    functions = NULL;
+    scope_names = NULL;
+    scope_slots = NULL;
+    frames = NULL;
+    scope_capacity = frames_capacity = 0;
+}
+
+/* Internal matters */
+
+/* ==================== Translation ==================== */
+
+static code_t *code_create ( code_kind_t kind, int64_t value, size_t n_children )
+{
+    code_t *code = arena_alloc ( &code_arena, sizeof(code_t) );
+    *code = (code_t) {
+        .kind = kind,
+        .value = value,
+        .children = arena_alloc ( &code_arena, n_children * sizeof(code_t*) ),
+        .n_children = n_children
+    };
+    return code;
+}
+
+/* Gives the declared name the next slot, and marks any function with the same name as shadowed */
+static void declare ( const char *name )
+{
+    symbol_t *global = symbol_hashmap_lookup ( globals->hashmap, name );
+    if ( global != NULL && global->type == SYMBOL_FUNCTION )
+        functions[global->sequence_number].shadowed = true;
+
+    if ( scope_length == scope_capacity )
+    {
+        scope_capacity = scope_capacity * 2 + 16;
+        scope_names = realloc ( scope_names, scope_capacity * sizeof(char*) );
+        scope_slots = realloc ( scope_slots, scope_capacity * sizeof(size_t) );
+    }
+    scope_names[scope_length] = name;
+    scope_slots[scope_length] = n_slots++;
+    scope_length++;
+}
+
+/* Returns the slot of the innermost variable with the given name, or -1 if there is none */
+static int64_t find_slot ( const char *name )
+{
+    for ( size_t i = scope_length; i > 0; i-- )
+        if ( scope_names[i-1] == name ) // Names are interned
+            return scope_slots[i-1];
+    return -1;
+}
+
+/* Translates the node, using the current scope to resolve names.
+ * Anything that makes the function impure sets translation_failed, but the translation continues,
+ * so that all declarations in the function are seen. */
+static code_t *translate ( node_t *node )
+{
+    code_t *code = NULL;
+    switch ( node->type )
+    {
+        case NUMBER_DATA:
+            return code_create ( CODE_CONSTANT, node->value, 0 );
+
+        case IDENTIFIER_DATA: {
+            int64_t slot = find_slot ( node->data );
+            if ( slot < 0 )
+            {
+                // Global variables, or names that don't exist
+                translation_failed = true;
+                return NULL;
+            }
+            return code_create ( CODE_VARIABLE, slot, 0 );
+        }
+
+        case EXPRESSION:
+        case RELATION:
+            code = code_create ( CODE_OPERATION, node->operator, node->n_children );
+            for ( size_t i = 0; i < node->n_children; i++ )
+                code->children[i] = translate ( node->children[i] );
+            return code;
+
+        case FUNCTION_CALL: {
+            node_t *arguments = node->children[1];
+            symbol_t *function = symbol_hashmap_lookup ( globals->hashmap, node->children[0]->data );
+            if ( find_slot ( node->children[0]->data ) >= 0 || function == NULL || function->type != SYMBOL_FUNCTION ||
+                 function->node->children[1]->n_children != arguments->n_children )
+                translation_failed = true;
+
+            code = code_create ( CODE_CALL, function ? function->sequence_number : 0, arguments->n_children );
+            for ( size_t i = 0; i < arguments->n_children; i++ )
+                code->children[i] = translate ( arguments->children[i] );
+            return code;
+        }
+
+        case BLOCK: {
+            size_t outer_scope_length = scope_length;
+            if ( node->n_children == 2 )
+            {
+                node_t *declaration_list = node->children[0];
+                for ( size_t i = 0; i < declaration_list->n_children; i++ )
+                    for ( size_t j = 0; j < declaration_list->children[i]->n_children; j++ )
+                        declare ( declaration_list->children[i]->children[j]->data );
+            }
+            code = translate ( node->children[node->n_children-1] );
+            scope_length = outer_scope_length;
+            return code;
+        }
+
+        case LIST:
+            code = code_create ( CODE_BLOCK, 0, node->n_children );
+            for ( size_t i = 0; i < node->n_children; i++ )
+                code->children[i] = translate ( node->children[i] );
+            return code;
+
+        case ASSIGNMENT_STATEMENT: {
+            int64_t slot = -1;
+            if ( node->children[0]->type == IDENTIFIER_DATA )
+                slot = find_slot ( node->children[0]->data );
+            if ( slot < 0 )
+                translation_failed = true;
+            code = code_create ( CODE_ASSIGNMENT, slot, 1 );
+            code->children[0] = translate ( node->children[1] );
+            return code;
+        }
+
+        case RETURN_STATEMENT:
+            code = code_create ( CODE_RETURN, 0, 1 );
+            code->children[0] = translate ( node->children[0] );
+            return code;
+
+        case IF_STATEMENT:
+            code = code_create ( CODE_IF, 0, node->n_children );
+            for ( size_t i = 0; i < node->n_children; i++ )
+                code->children[i] = translate ( node->children[i] );
+            return code;
+
+        case WHILE_STATEMENT:
+            code = code_create ( CODE_WHILE, 0, 2 );
+            code->children[0] = translate ( node->children[0] );
+            loop_depth++;
+            code->children[1] = translate ( node->children[1] );
+            loop_depth--;
+            return code;
+
+        case BREAK_STATEMENT:
+            // Breaks outside of loops are reported when names are bound
+            if ( loop_depth == 0 )
+                translation_failed = true;
+            return code_create ( CODE_BREAK, 0, 0 );
+
+        default:
+            // Printing, and use of global arrays, makes a function impure
+            translation_failed = true;
+            return NULL;
+    }
+    return code;
+}
+
+/* ==================== Evaluation ==================== */
+
+/* Counts a step of the evaluation, giving up if there are none left */
+#define STEP() do { if ( steps_left == 0 ) longjmp ( give_up, 1 ); steps_left--; } while ( false )
+
+static int64_t evaluate_operation ( operator_t op, int64_t lhs, int64_t rhs )
+{
+    // Arithmetic wraps around, like in the generated code
+    switch ( op )
+    {
+        case OPERATOR_ADD: return (int64_t) ( (uint64_t) lhs + (uint64_t) rhs );
+        case OPERATOR_SUBTRACT: return (int64_t) ( (uint64_t) lhs - (uint64_t) rhs );
+        case OPERATOR_MULTIPLY: return (int64_t) ( (uint64_t) lhs * (uint64_t) rhs );
+        case OPERATOR_DIVIDE:
+            // These would crash the program, so leave them for runtime
+            if ( rhs == 0 || ( lhs == INT64_MIN && rhs == -1 ) )
+                longjmp ( give_up, 1 );
+            return lhs / rhs;
+        // The shift instructions only use the lowest 6 bits of the shift amount
+        case OPERATOR_SHIFT_LEFT: return (int64_t) ( (uint64_t) lhs << ( rhs & 63 ) );
+        case OPERATOR_SHIFT_RIGHT: return lhs >> ( rhs & 63 );
+        case OPERATOR_EQUAL: return lhs == rhs;
+        case OPERATOR_NOT_EQUAL: return lhs != rhs;
+        case OPERATOR_LESS: return lhs < rhs;
+        case OPERATOR_GREATER: return lhs > rhs;
+        case OPERATOR_LESS_EQUAL: return lhs <= rhs;
+        case OPERATOR_GREATER_EQUAL: return lhs >= rhs;
+    }
+    assert ( false && "Unknown operation" );
+    return 0;
+}
+
+/* Calls the function, with the arguments already placed in the slots at the top of the frames */
+static int64_t call_function ( function_info_t *function )
+{
+    if ( ++call_depth > MAX_CALL_DEPTH )
+        longjmp ( give_up, 1 );
+
+    // Local variables start out as 0
+    for ( size_t i = frame_top + function->n_parameters; i < frame_top + function->n_slots; i++ )
+        frames[i] = 0;
+
+    size_t outer_frame_base = frame_base;
+    frame_base = frame_top;
+    frame_top += function->n_slots;
+
+    int64_t result = execute ( function->body ) == FLOW_RETURN ? return_value : 0;
+
+    frame_top = frame_base;
+    frame_base = outer_frame_base;
+    call_depth--;
+    return result;
+}
+
+static int64_t evaluate ( code_t *code )
+{
+    STEP ( );
+    switch ( code->kind )
+    {
+        case CODE_CONSTANT:
+            return code->value;
+        case CODE_VARIABLE:
+            return frames[frame_base + code->value];
+        case CODE_OPERATION: {
+            // Negation is subtraction from 0
+            int64_t lhs = code->n_children == 2 ? evaluate ( code->children[0] ) : 0;
+            int64_t rhs = evaluate ( code->children[code->n_children-1] );
+            return evaluate_operation ( code->value, lhs, rhs );
+        }
+        case CODE_CALL: {
+            function_info_t *function = &functions[code->value];
+            // Make sure the frame of the callee fits
+            if ( frame_top + code->n_children + function->n_slots > frames_capacity )
+            {
+                frames_capacity = ( frame_top + code->n_children + function->n_slots ) * 2;
+                frames = realloc ( frames, frames_capacity * sizeof(int64_t) );
+            }
+
+            // The arguments are evaluated into the slots after the current top, where the callee's frame starts.
+            // Calls made while evaluating the arguments use the space after them
+            size_t callee_frame = frame_top;
+            for ( size_t i = 0; i < code->n_children; i++ )
+            {
+                int64_t argument = evaluate ( code->children[i] );
+                frames[callee_frame + i] = argument;
+                frame_top = callee_frame + i + 1;
+            }
+            frame_top = callee_frame;
+            return call_function ( function );
+        }
+        default:
+            assert ( false && "Unknown expression code" );
+            return 0;
+    }
+}
+
+static flow_t execute ( code_t *code )
+{
+    STEP ( );
+    switch ( code->kind )
+    {
+        case CODE_BLOCK:
+            for ( size_t i = 0; i < code->n_children; i++ )
+            {
+                flow_t flow = execute ( code->children[i] );
+                if ( flow != FLOW_NORMAL )
+                    return flow;
+            }
+            return FLOW_NORMAL;
+        case CODE_ASSIGNMENT: {
+            // Calls in the expression can move the frames, so the slot is only found after it is evaluated
+            int64_t value = evaluate ( code->children[0] );
+            frames[frame_base + code->value] = value;
+            return FLOW_NORMAL;
+        }
+        case CODE_RETURN:
+            return_value = evaluate ( code->children[0] );
+            return FLOW_RETURN;
+        case CODE_IF:
+            if ( evaluate ( code->children[0] ) )
+                return execute ( code->children[1] );
+            if ( code->n_children == 3 )
+                return execute ( code->children[2] );
+            return FLOW_NORMAL;
+        case CODE_WHILE:
+            while ( evaluate ( code->children[0] ) )
+            {
+                flow_t flow = execute ( code->children[1] );
+                if ( flow == FLOW_BREAK )
+                    break;
+                if ( flow == FLOW_RETURN )
+                    return flow;
+            }
+            return FLOW_NORMAL;
+        case CODE_BREAK:
+            return FLOW_BREAK;
+        case CODE_CALL:
+            evaluate ( code );
+            return FLOW_NORMAL;
+        default:
+            assert ( false && "Unknown statement code" );
+            return FLOW_NORMAL;
+    }
+}
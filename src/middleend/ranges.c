@@ -0,0 +1,1060 @@
+#include "vslc.h"
+#include "ranges.h"
+
+// The analysis is an abstract interpretation of each function body, where every local variable
+// and parameter has an interval of possible values. Loops are iterated until the intervals stop growing.
+//
+// Since parameters, array elements and return values are shared between functions,
+// they get one interval each for the whole program, called summaries.
+// When a summary grows, the functions depending on it are put on a worklist to be analyzed again,
+// until no summary grows anymore. Global variables are never tracked, since any function call could change them.
+//
+// Array accesses are assumed to stay inside the .bss section. A store with an index that
+// isn't known to be within bounds is assumed to possibly hit any array.
+
+#define FULL_RANGE ((range_t) { INT64_MIN, INT64_MAX })
+#define EMPTY_RANGE ((range_t) { INT64_MAX, INT64_MIN })
+#define SINGLE_VALUE(value) ((range_t) { (value), (value) })
+#define RANGE_IS_EMPTY(range) ((range).min > (range).max)
+
+// After a loop has been iterated, or a summary has grown, this many times, growing bounds are set to the extremes
+#define WIDEN_AFTER_ITERATIONS 3
+
+// The possible values of every local variable and parameter at one point in a function
+typedef struct
+{
+    range_t *values; // Indexed by the symbol's sequence number in the function's symbol table
+    size_t n_values;
+    bool reachable;
+} state_t;
+
+// What the analysis found out about a single node
+typedef struct
+{
+    node_t *node;
+    range_t range;
+    bool can_be_true, can_be_false; // Only used for relations
+
+    // Only used for while loops: the last state the loop was iterated from, the stable state at its start,
+    // and the state after it, found with the summaries as of loop_version
+    state_t loop_entry, loop_start, loop_exit;
+    size_t loop_version;
+} node_record_t;
+
+/* All summaries are kept in one list.
+ * A global array has one summary for all its elements.
+ * A function has one summary for its return value, followed by one summary per parameter.
+ */
+static _Thread_local range_t *summaries;
+static _Thread_local int *summary_changes; // How many times each summary has grown
+static _Thread_local size_t summary_version; // How many times any summary has grown
+static _Thread_local size_t n_summaries;
+static _Thread_local size_t *summary_position; // Indexed by sequence number in the global symbol table
+
+#define ARRAY_SUMMARY(array) (&summaries[summary_position[(array)->sequence_number]])
+#define RETURN_SUMMARY(function) (&summaries[summary_position[(function)->sequence_number]])
+#define PARAMETER_SUMMARY(function, i) (&summaries[summary_position[(function)->sequence_number] + 1 + (i)])
+
+// Takes in a symbol of type SYMBOL_FUNCTION, and returns how many parameters the function takes
+#define FUNC_PARAM_COUNT(func) ((func)->node->children[1]->n_children)
+
+/* For each function, the functions that call it. For each array, the functions that read from it.
+ * Indexed by sequence number in the global symbol table */
+typedef struct
+{
+    symbol_t **functions;
+    size_t length, capacity;
+} function_list_t;
+static _Thread_local function_list_t *dependents;
+
+/* The functions that must be analyzed again, as a queue */
+static _Thread_local symbol_t **worklist;
+static _Thread_local size_t worklist_start, worklist_length;
+static _Thread_local bool *in_worklist; // Indexed by sequence number in the global symbol table
+
+static _Thread_local symbol_t **arrays;
+static _Thread_local size_t n_arrays;
+
+/* The state of the analysis */
+static _Thread_local symbol_t *current_function;
+static _Thread_local state_t *break_state; // Collects the states of break statements in the innermost loop
+static _Thread_local bool recording; // Set during the final pass, when results are recorded for each node
+
+/* A hashmap from nodes to what was found out about them */
+static _Thread_local node_record_t *records;
+static _Thread_local size_t records_capacity;
+static _Thread_local size_t n_records;
+
+static void find_dependents ( symbol_t *function, node_t *node );
+static void add_to_worklist ( symbol_t *function );
+static void join_summary ( symbol_t *symbol, size_t offset, range_t value );
+static void analyze_function ( symbol_t *function );
+static range_t analyze_expression ( state_t *state, node_t *expression );
+static void analyze_statement ( state_t *state, node_t *node );
+static node_record_t *find_record ( node_t *node, bool create );
+static node_t *rewrite_subtree ( node_t *node );
+
+/* External interface */
+
+/* Analyzes all functions until the summaries are stable, then records the final results */
+void analyze_ranges ( void )
+{
+    size_t n_symbols = global_symbols->n_symbols;
+    summary_position = malloc ( ( n_symbols + 1 ) * sizeof(size_t) );
+    arrays = malloc ( ( n_symbols + 1 ) * sizeof(symbol_t*) );
+    n_summaries = n_arrays = 0;
+    for ( size_t i = 0; i < n_symbols; i++ )
+    {
+        symbol_t *symbol = global_symbols->symbols[i];
+        summary_position[i] = n_summaries;
+        if ( symbol->type == SYMBOL_GLOBAL_ARRAY )
+        {
+            arrays[n_arrays++] = symbol;
+            n_summaries += 1;
+        }
+        else if ( symbol->type == SYMBOL_FUNCTION )
+            n_summaries += 1 + FUNC_PARAM_COUNT ( symbol );
+    }
+
+    summaries = malloc ( ( n_summaries + 1 ) * sizeof(range_t) );
+    summary_changes = calloc ( n_summaries + 1, sizeof(int) );
+    dependents = calloc ( n_symbols + 1, sizeof(function_list_t) );
+    worklist = malloc ( ( n_symbols + 1 ) * sizeof(symbol_t*) );
+    in_worklist = calloc ( n_symbols + 1, sizeof(bool) );
+    worklist_start = worklist_length = 0;
+
+    symbol_t *entry_function = NULL;
+    for ( size_t i = 0; i < n_symbols; i++ )
+    {
+        symbol_t *symbol = global_symbols->symbols[i];
+        if ( symbol->type == SYMBOL_GLOBAL_ARRAY )
+        {
+            // Arrays live in .bss, so all elements start out as 0
+            *ARRAY_SUMMARY ( symbol ) = SINGLE_VALUE ( 0 );
+        }
+        else if ( symbol->type == SYMBOL_FUNCTION )
+        {
+            *RETURN_SUMMARY ( symbol ) = EMPTY_RANGE;
+            // Parameters get their values from calls, except for the entry function, which gets them from argv.
+            // In a module, every function can be called from other modules
+            bool called_from_outside = entry_function == NULL || compile_as_module;
+            for ( size_t j = 0; j < FUNC_PARAM_COUNT ( symbol ); j++ )
+                *PARAMETER_SUMMARY ( symbol, j ) = called_from_outside ? FULL_RANGE : EMPTY_RANGE;
+            if ( entry_function == NULL )
+                entry_function = symbol;
+
+            find_dependents ( symbol, symbol->node->children[2] );
+            add_to_worklist ( symbol );
+        }
+    }
+
+    while ( worklist_length > 0 )
+    {
+        symbol_t *function = worklist[worklist_start];
+        worklist_start = ( worklist_start + 1 ) % n_symbols;
+        worklist_length--;
+        in_worklist[function->sequence_number] = false;
+        analyze_function ( function );
+    }
+
+    // The summaries are now stable, so one more pass gives the final results
+    recording = true;
+    for ( size_t i = 0; i < n_symbols; i++ )
+        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+            analyze_function ( global_symbols->symbols[i] );
+    recording = false;
+
+    for ( size_t i = 0; i < n_symbols; i++ )
+        free ( dependents[i].functions );
+    free ( dependents );
+    free ( worklist );
+    free ( in_worklist );
+    free ( arrays );
+    free ( summary_changes );
+}
+
+/* Looks up the range of the expression, recorded during the final pass of the analysis */
+bool expression_range ( node_t *expression, range_t *range )
+{
+    node_record_t *record = find_record ( expression, false );
+    if ( record == NULL || RANGE_IS_EMPTY ( record->range ) )
+        return false;
+    *range = record->range;
+    return true;
+}
+
+/* Looks up the possible outcomes of the relation, recorded during the final pass of the analysis */
+relation_outcome_t relation_outcome ( node_t *relation )
+{
+    node_record_t *record = find_record ( relation, false );
+    if ( record == NULL || !( record->can_be_true || record->can_be_false ) )
+        return RELATION_UNREACHABLE;
+    if ( !record->can_be_false )
+        return RELATION_ALWAYS_TRUE;
+    if ( !record->can_be_true )
+        return RELATION_ALWAYS_FALSE;
+    return RELATION_UNKNOWN;
+}
+
+/* Frees the summaries and all recorded results */
+void destroy_ranges ( void )
+{
+    for ( size_t i = 0; i < records_capacity; i++ )
+    {
+        free ( records[i].loop_entry.values );
+        free ( records[i].loop_start.values );
+        free ( records[i].loop_exit.values );
+    }
+    free ( summaries );
+    free ( summary_position );
+    free ( records );
+    dependents = NULL;
+    worklist = NULL;
+    in_worklist = NULL;
+    arrays = NULL;
+    summary_changes = NULL;
+    summaries = NULL;
+    summary_position = NULL;
+    records = NULL;
+    n_summaries = n_records = records_capacity = summary_version = 0;
+}
+
+/* Rewrites all function bodies using the results of the analysis.
+ * Afterwards the tree is simplified again, to fold the constants that were found.
+ */
+void optimize_with_ranges ( void )
+{
+    analyze_ranges ( );
+    for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+    {
+        symbol_t *symbol = global_symbols->symbols[i];
+        if ( symbol->type == SYMBOL_FUNCTION )
+            symbol->node->children[2] = rewrite_subtree ( symbol->node->children[2] );
+    }
+    destroy_ranges ( );
+
+    simplify_tree ( );
+}
+
+/* Internal matters */
+
+/* ==================== Interval arithmetic ==================== */
+
+static range_t range_join ( range_t a, range_t b )
+{
+    if ( RANGE_IS_EMPTY ( a ) )
+        return b;
+    if ( RANGE_IS_EMPTY ( b ) )
+        return a;
+    return (range_t) { a.min < b.min ? a.min : b.min, a.max > b.max ? a.max : b.max };
+}
+
+static range_t range_intersect ( range_t a, range_t b )
+{
+    return (range_t) { a.min > b.min ? a.min : b.min, a.max < b.max ? a.max : b.max };
+}
+
+/* Returns the smallest range containing all the given values */
+static range_t range_of_values ( int64_t *values, size_t n_values )
+{
+    range_t result = EMPTY_RANGE;
+    for ( size_t i = 0; i < n_values; i++ )
+        result = range_join ( result, SINGLE_VALUE ( values[i] ) );
+    return result;
+}
+
+/* Calculates the range of the binary or unary operation.
+ * Any overflow means the result can wrap around to anything, so the full range is returned.
+ */
+static range_t range_operation ( operator_t op, range_t a, range_t b, size_t n_operands )
+{
+    if ( RANGE_IS_EMPTY ( a ) || ( n_operands == 2 && RANGE_IS_EMPTY ( b ) ) )
+        return EMPTY_RANGE;
+
+    int64_t corners[4];
+    if ( n_operands == 1 )
+    {
+        assert ( op == OPERATOR_SUBTRACT );
+        if ( a.min == INT64_MIN )
+            return FULL_RANGE;
+        return (range_t) { -a.max, -a.min };
+    }
+    else if ( op == OPERATOR_ADD )
+    {
+        if ( __builtin_add_overflow ( a.min, b.min, &corners[0] ) ||
+             __builtin_add_overflow ( a.max, b.max, &corners[1] ) )
+            return FULL_RANGE;
+        return range_of_values ( corners, 2 );
+    }
+    else if ( op == OPERATOR_SUBTRACT )
+    {
+        if ( __builtin_sub_overflow ( a.min, b.max, &corners[0] ) ||
+             __builtin_sub_overflow ( a.max, b.min, &corners[1] ) )
+            return FULL_RANGE;
+        return range_of_values ( corners, 2 );
+    }
+    else if ( op == OPERATOR_MULTIPLY )
+    {
+        if ( __builtin_mul_overflow ( a.min, b.min, &corners[0] ) ||
+             __builtin_mul_overflow ( a.min, b.max, &corners[1] ) ||
+             __builtin_mul_overflow ( a.max, b.min, &corners[2] ) ||
+             __builtin_mul_overflow ( a.max, b.max, &corners[3] ) )
+            return FULL_RANGE;
+        return range_of_values ( corners, 4 );
+    }
+    else if ( op == OPERATOR_DIVIDE )
+    {
+        // With a divisor of fixed sign, the quotient is monotonic in both operands.
+        // INT64_MIN / -1 overflows, and is avoided by requiring that -1 isn't a possible divisor
+        if ( ( b.min <= 0 && b.max >= 0 ) || ( b.min <= -1 && b.max >= -1 && a.min == INT64_MIN ) )
+            return FULL_RANGE;
+        corners[0] = a.min / b.min;
+        corners[1] = a.min / b.max;
+        corners[2] = a.max / b.min;
+        corners[3] = a.max / b.max;
+        return range_of_values ( corners, 4 );
+    }
+    else if ( op == OPERATOR_SHIFT_LEFT || op == OPERATOR_SHIFT_RIGHT )
+    {
+        // The shift instructions only use the lowest 6 bits of the shift amount
+        if ( b.min < 0 || b.max > 63 )
+            return FULL_RANGE;
+        if ( op == OPERATOR_SHIFT_RIGHT )
+        {
+            // Arithmetic right shifts are monotonic in both operands, for a given sign of the value
+            corners[0] = a.min >> b.min;
+            corners[1] = a.min >> b.max;
+            corners[2] = a.max >> b.min;
+            corners[3] = a.max >> b.max;
+            return range_of_values ( corners, 4 );
+        }
+        // A left shift is a multiplication by a power of two
+        if ( b.max == 63 ||
+             __builtin_mul_overflow ( a.min, (int64_t) 1 << b.min, &corners[0] ) ||
+             __builtin_mul_overflow ( a.min, (int64_t) 1 << b.max, &corners[1] ) ||
+             __builtin_mul_overflow ( a.max, (int64_t) 1 << b.min, &corners[2] ) ||
+             __builtin_mul_overflow ( a.max, (int64_t) 1 << b.max, &corners[3] ) )
+            return FULL_RANGE;
+        return range_of_values ( corners, 4 );
+    }
+
+    assert ( false && "Unknown expression operation" );
+    return FULL_RANGE;
+}
+
+/* ==================== Summaries ==================== */
+
+/* Adds the function to the list of functions that depend on the symbol, unless it was the last one added */
+static void add_dependent ( symbol_t *symbol, symbol_t *function )
+{
+    function_list_t *list = &dependents[symbol->sequence_number];
+    if ( list->length > 0 && list->functions[list->length-1] == function )
+        return;
+    if ( list->length == list->capacity )
+    {
+        list->capacity = list->capacity * 2 + 4;
+        list->functions = realloc ( list->functions, list->capacity * sizeof(symbol_t*) );
+    }
+    list->functions[list->length++] = function;
+}
+
+/* Finds the functions called, and the arrays read, by the function */
+static void find_dependents ( symbol_t *function, node_t *node )
+{
+    symbol_t *symbol = node->symbol;
+    if ( symbol != NULL && ( symbol->type == SYMBOL_FUNCTION || symbol->type == SYMBOL_GLOBAL_ARRAY ) )
+        add_dependent ( symbol, function );
+
+    for ( size_t i = 0; i < node->n_children; i++ )
+        find_dependents ( function, node->children[i] );
+}
+
+static void add_to_worklist ( symbol_t *function )
+{
+    if ( in_worklist[function->sequence_number] )
+        return;
+    in_worklist[function->sequence_number] = true;
+    size_t n_symbols = global_symbols->n_symbols;
+    worklist[( worklist_start + worklist_length ) % n_symbols] = function;
+    worklist_length++;
+}
+
+/* Joins the value into a summary of the symbol, which is an array or a function.
+ * The offset is 0 for array elements and return values, and 1 + i for parameter i.
+ * If the summary grows, the functions depending on it are put on the worklist.
+ */
+static void join_summary ( symbol_t *symbol, size_t offset, range_t value )
+{
+    size_t position = summary_position[symbol->sequence_number] + offset;
+    range_t old = summaries[position];
+    range_t new = range_join ( old, value );
+    if ( new.min == old.min && new.max == old.max )
+        return;
+
+    // Make sure the summary stops growing eventually
+    if ( ++summary_changes[position] > WIDEN_AFTER_ITERATIONS && !RANGE_IS_EMPTY ( old ) )
+    {
+        if ( new.min < old.min )
+            new.min = INT64_MIN;
+        if ( new.max > old.max )
+            new.max = INT64_MAX;
+    }
+    summaries[position] = new;
+    summary_version++;
+
+    if ( offset > 0 )
+    {
+        add_to_worklist ( symbol );
+        return;
+    }
+    function_list_t *list = &dependents[symbol->sequence_number];
+    for ( size_t i = 0; i < list->length; i++ )
+        add_to_worklist ( list->functions[i] );
+}
+
+/* ==================== Analysis states ==================== */
+
+static state_t state_copy ( state_t *state )
+{
+    state_t result = *state;
+    result.values = malloc ( state->n_values * sizeof(range_t) + 1 );
+    memcpy ( result.values, state->values, state->n_values * sizeof(range_t) );
+    return result;
+}
+
+/* An unreachable state, which is the starting point when joining states */
+static state_t state_unreachable ( size_t n_values )
+{
+    state_t result = {
+        .values = malloc ( n_values * sizeof(range_t) + 1 ),
+        .n_values = n_values,
+        .reachable = false
+    };
+    for ( size_t i = 0; i < n_values; i++ )
+        result.values[i] = EMPTY_RANGE;
+    return result;
+}
+
+/* Replaces the contents of dest with source, and frees source */
+static void state_move ( state_t *dest, state_t *source )
+{
+    free ( dest->values );
+    *dest = *source;
+}
+
+/* Updates dest to also include every possibility in source */
+static void state_join ( state_t *dest, state_t *source )
+{
+    if ( !source->reachable )
+        return;
+    if ( !dest->reachable )
+    {
+        memcpy ( dest->values, source->values, source->n_values * sizeof(range_t) );
+        dest->reachable = true;
+        return;
+    }
+    for ( size_t i = 0; i < dest->n_values; i++ )
+        dest->values[i] = range_join ( dest->values[i], source->values[i] );
+}
+
+static bool state_equal ( state_t *a, state_t *b )
+{
+    if ( a->reachable != b->reachable )
+        return false;
+    if ( !a->reachable )
+        return true;
+    for ( size_t i = 0; i < a->n_values; i++ )
+        if ( a->values[i].min != b->values[i].min || a->values[i].max != b->values[i].max )
+            return false;
+    return true;
+}
+
+/* Returns true if every possibility in b is also in a */
+static bool state_includes ( state_t *a, state_t *b )
+{
+    if ( !b->reachable )
+        return true;
+    if ( !a->reachable )
+        return false;
+    for ( size_t i = 0; i < a->n_values; i++ )
+        if ( !RANGE_IS_EMPTY ( b->values[i] ) &&
+             ( b->values[i].min < a->values[i].min || b->values[i].max > a->values[i].max ) )
+            return false;
+    return true;
+}
+
+/* Sets every bound that grew since the previous state to its extreme, to make loops stop growing */
+static void state_widen ( state_t *state, state_t *previous )
+{
+    if ( !state->reachable || !previous->reachable )
+        return;
+    for ( size_t i = 0; i < state->n_values; i++ )
+    {
+        if ( state->values[i].min < previous->values[i].min )
+            state->values[i].min = INT64_MIN;
+        if ( state->values[i].max > previous->values[i].max )
+            state->values[i].max = INT64_MAX;
+    }
+}
+
+/* Returns the range the tracked variable is stored in, or NULL if the node isn't a tracked variable */
+static range_t *state_variable ( state_t *state, node_t *node )
+{
+    if ( node->type != IDENTIFIER_DATA || node->symbol == NULL )
+        return NULL;
+    if ( node->symbol->type != SYMBOL_LOCAL_VAR && node->symbol->type != SYMBOL_PARAMETER )
+        return NULL;
+    return &state->values[node->symbol->sequence_number];
+}
+
+/* ==================== Recording results ==================== */
+
+static size_t hash_node ( node_t *node, size_t capacity )
+{
+    return ( (uintptr_t) node >> 4 ) * 0x9E3779B97F4A7C15ull % capacity;
+}
+
+/* Finds the record of the given node, optionally creating it if it doesn't exist */
+static node_record_t *find_record ( node_t *node, bool create )
+{
+    if ( create && ( n_records + 1 ) * 2 > records_capacity )
+    {
+        // Keep the fill ratio below 1/2, re-inserting all records into the larger list
+        node_record_t *old_records = records;
+        size_t old_capacity = records_capacity;
+        records_capacity = records_capacity * 2 + 64;
+        records = calloc ( records_capacity, sizeof(node_record_t) );
+        for ( size_t i = 0; i < old_capacity; i++ )
+        {
+            if ( old_records[i].node == NULL )
+                continue;
+            size_t bucket = hash_node ( old_records[i].node, records_capacity );
+            while ( records[bucket].node != NULL )
+                bucket = ( bucket + 1 ) % records_capacity;
+            records[bucket] = old_records[i];
+        }
+        free ( old_records );
+    }
+
+    if ( records_capacity == 0 )
+        return NULL;
+
+    size_t bucket = hash_node ( node, records_capacity );
+    while ( records[bucket].node != NULL )
+    {
+        if ( records[bucket].node == node )
+            return &records[bucket];
+        bucket = ( bucket + 1 ) % records_capacity;
+    }
+
+    if ( !create )
+        return NULL;
+
+    records[bucket] = (node_record_t) { .node = node, .range = EMPTY_RANGE };
+    n_records++;
+    return &records[bucket];
+}
+
+/* In the final pass, adds the range to everything the expression has been seen to evaluate to */
+static void record_range ( node_t *expression, range_t range )
+{
+    if ( !recording )
+        return;
+    node_record_t *record = find_record ( expression, true );
+    record->range = range_join ( record->range, range );
+}
+
+/* ==================== Expressions ==================== */
+
+/* Joins the argument ranges into the callee's parameter summaries, and returns the range of the return value */
+static range_t analyze_function_call ( state_t *state, node_t *call )
+{
+    symbol_t *function = call->children[0]->symbol;
+    node_t *arguments = call->children[1];
+
+    // The arguments are evaluated from right to left
+    range_t argument_ranges[arguments->n_children + 1];
+    for ( size_t i = arguments->n_children; i > 0; i-- )
+        argument_ranges[i-1] = analyze_expression ( state, arguments->children[i-1] );
+
+    // Calls that are wrong are reported when names are bound
+    if ( function == NULL || function->type != SYMBOL_FUNCTION || FUNC_PARAM_COUNT ( function ) != arguments->n_children )
+        return FULL_RANGE;
+
+    if ( !state->reachable )
+        return EMPTY_RANGE;
+
+    for ( size_t i = 0; i < arguments->n_children; i++ )
+        join_summary ( function, 1 + i, argument_ranges[i] );
+
+    return *RETURN_SUMMARY ( function );
+}
+
+/* Returns the range of an ARRAY_INDEXING node when it is read */
+static range_t analyze_array_read ( state_t *state, node_t *node )
+{
+    analyze_expression ( state, node->children[1] );
+    symbol_t *array = node->children[0]->symbol;
+    if ( array == NULL || array->type != SYMBOL_GLOBAL_ARRAY )
+        return FULL_RANGE;
+    return *ARRAY_SUMMARY ( array );
+}
+
+/* Returns the range of values the expression can have, given the state before it is evaluated */
+static range_t analyze_expression ( state_t *state, node_t *expression )
+{
+    range_t result;
+    switch ( expression->type )
+    {
+        case NUMBER_DATA:
+            result = SINGLE_VALUE ( expression->value );
+            break;
+        case IDENTIFIER_DATA: {
+            range_t *variable = state_variable ( state, expression );
+            result = variable ? *variable : FULL_RANGE;
+            break;
+        }
+        case ARRAY_INDEXING:
+            result = analyze_array_read ( state, expression );
+            break;
+        case FUNCTION_CALL:
+            result = analyze_function_call ( state, expression );
+            break;
+        case EXPRESSION: {
+            // Binary operations evaluate the right hand side first
+            range_t rhs = EMPTY_RANGE;
+            if ( expression->n_children == 2 )
+                rhs = analyze_expression ( state, expression->children[1] );
+            range_t lhs = analyze_expression ( state, expression->children[0] );
+            result = range_operation ( expression->operator, lhs, rhs, expression->n_children );
+            break;
+        }
+        default:
+            assert ( false && "Unknown expression type" );
+            result = FULL_RANGE;
+    }
+
+    if ( !state->reachable )
+        return EMPTY_RANGE;
+
+    record_range ( expression, result );
+    return result;
+}
+
+/* ==================== Conditions ==================== */
+
+/* Returns the relation operator that is true exactly when the given one is false */
+static operator_t negate_relation ( operator_t op )
+{
+    switch ( op )
+    {
+        case OPERATOR_EQUAL: return OPERATOR_NOT_EQUAL;
+        case OPERATOR_NOT_EQUAL: return OPERATOR_EQUAL;
+        case OPERATOR_LESS: return OPERATOR_GREATER_EQUAL;
+        case OPERATOR_GREATER_EQUAL: return OPERATOR_LESS;
+        case OPERATOR_GREATER: return OPERATOR_LESS_EQUAL;
+        case OPERATOR_LESS_EQUAL: return OPERATOR_GREATER;
+        default: assert ( false && "Unknown relation operator" );
+    }
+    return op;
+}
+
+/* Returns the relation operator with the operands swapped, so that a < b becomes b > a */
+static operator_t swap_relation ( operator_t op )
+{
+    switch ( op )
+    {
+        case OPERATOR_LESS: return OPERATOR_GREATER;
+        case OPERATOR_GREATER: return OPERATOR_LESS;
+        case OPERATOR_LESS_EQUAL: return OPERATOR_GREATER_EQUAL;
+        case OPERATOR_GREATER_EQUAL: return OPERATOR_LESS_EQUAL;
+        default: return op;
+    }
+}
+
+/* Returns the values of x that can make "x op y" true, when y is in the given range */
+static range_t range_satisfying ( operator_t op, range_t x, range_t y )
+{
+    if ( RANGE_IS_EMPTY ( y ) )
+        return EMPTY_RANGE;
+
+    switch ( op )
+    {
+        case OPERATOR_EQUAL:
+            return range_intersect ( x, y );
+        case OPERATOR_NOT_EQUAL:
+            // Only a single value can be removed, and only from the ends of the range
+            if ( y.min == y.max && x.min == y.min )
+                return x.min == INT64_MAX ? EMPTY_RANGE : (range_t) { x.min + 1, x.max };
+            if ( y.min == y.max && x.max == y.min )
+                return x.max == INT64_MIN ? EMPTY_RANGE : (range_t) { x.min, x.max - 1 };
+            return x;
+        case OPERATOR_LESS:
+            return y.max == INT64_MIN ? EMPTY_RANGE : range_intersect ( x, (range_t) { INT64_MIN, y.max - 1 } );
+        case OPERATOR_LESS_EQUAL:
+            return range_intersect ( x, (range_t) { INT64_MIN, y.max } );
+        case OPERATOR_GREATER:
+            return y.min == INT64_MAX ? EMPTY_RANGE : range_intersect ( x, (range_t) { y.min + 1, INT64_MAX } );
+        case OPERATOR_GREATER_EQUAL:
+            return range_intersect ( x, (range_t) { y.min, INT64_MAX } );
+        default:
+            assert ( false && "Unknown relation operator" );
+            return x;
+    }
+}
+
+/* Narrows down the variables in the state, assuming "lhs op rhs" is true.
+ * If the relation can't be true, the state becomes unreachable.
+ */
+static void refine_state ( state_t *state, operator_t op, node_t *lhs, range_t lhs_range, node_t *rhs, range_t rhs_range )
+{
+    if ( !state->reachable )
+        return;
+
+    if ( RANGE_IS_EMPTY ( range_satisfying ( op, lhs_range, rhs_range ) ) )
+    {
+        state->reachable = false;
+        return;
+    }
+
+    range_t *lhs_variable = state_variable ( state, lhs );
+    if ( lhs_variable != NULL )
+        *lhs_variable = range_satisfying ( op, lhs_range, rhs_range );
+
+    // The operand ranges were calculated before the refinement,
+    // so comparing a variable with itself only narrows it down once, which is still correct
+    range_t *rhs_variable = state_variable ( state, rhs );
+    if ( rhs_variable != NULL && rhs_variable != lhs_variable )
+        *rhs_variable = range_satisfying ( swap_relation ( op ), rhs_range, lhs_range );
+}
+
+/* Evaluates the relation in the given state, and splits it into the states where it is true and false */
+static void analyze_relation ( state_t *state, node_t *relation, state_t *if_true, state_t *if_false )
+{
+    operator_t op = relation->operator;
+    node_t *lhs = relation->children[0];
+    node_t *rhs = relation->children[1];
+
+    range_t rhs_range = analyze_expression ( state, rhs );
+    range_t lhs_range = analyze_expression ( state, lhs );
+
+    *if_true = state_copy ( state );
+    *if_false = state_copy ( state );
+    refine_state ( if_true, op, lhs, lhs_range, rhs, rhs_range );
+    refine_state ( if_false, negate_relation ( op ), lhs, lhs_range, rhs, rhs_range );
+
+    if ( recording && state->reachable )
+    {
+        node_record_t *record = find_record ( relation, true );
+        record->can_be_true |= if_true->reachable;
+        record->can_be_false |= if_false->reachable;
+    }
+}
+
+/* ==================== Statements ==================== */
+
+static void analyze_assignment_statement ( state_t *state, node_t *statement )
+{
+    node_t *dest = statement->children[0];
+    range_t value = analyze_expression ( state, statement->children[1] );
+
+    if ( dest->type == IDENTIFIER_DATA )
+    {
+        range_t *variable = state_variable ( state, dest );
+        if ( variable != NULL )
+            *variable = value;
+        return;
+    }
+
+    // Stores to arrays change the summary of the array, or of all arrays if the index might be out of bounds
+    range_t index = analyze_expression ( state, dest->children[1] );
+    symbol_t *array = dest->children[0]->symbol;
+    if ( !state->reachable || array == NULL || array->type != SYMBOL_GLOBAL_ARRAY )
+        return;
+
+    node_t *length = array->node->children[1];
+    if ( length->type == NUMBER_DATA && index.min >= 0 && index.max < length->value )
+    {
+        join_summary ( array, 0, value );
+        return;
+    }
+
+    for ( size_t i = 0; i < n_arrays; i++ )
+        join_summary ( arrays[i], 0, value );
+}
+
+static void analyze_if_statement ( state_t *state, node_t *statement )
+{
+    state_t then_state, else_state;
+    analyze_relation ( state, statement->children[0], &then_state, &else_state );
+
+    analyze_statement ( &then_state, statement->children[1] );
+    if ( statement->n_children == 3 )
+        analyze_statement ( &else_state, statement->children[2] );
+
+    // After the if statement, the state is whatever came out of either branch
+    state_join ( &then_state, &else_state );
+    state_move ( state, &then_state );
+    free ( else_state.values );
+}
+
+/* Analyzes the body of the loop once, starting from the state at the start of the loop.
+ * Returns the state at the end of the body, and sets exit_state to the state after the loop */
+static state_t analyze_loop_body ( state_t *loop_start, node_t *statement, state_t *exit_state )
+{
+    state_t body_state;
+    analyze_relation ( loop_start, statement->children[0], &body_state, exit_state );
+
+    state_t breaks = state_unreachable ( loop_start->n_values );
+    state_t *outer_break_state = break_state;
+    break_state = &breaks;
+    analyze_statement ( &body_state, statement->children[1] );
+    break_state = outer_break_state;
+
+    // The loop is left either when the condition is false, or through a break
+    state_join ( exit_state, &breaks );
+    free ( breaks.values );
+    return body_state;
+}
+
+/*
+* Analyzes a while loop, by repeatedly analyzing the body until the state at the start of the loop stops changing.
+* During the iterations nothing is recorded, since the states are not final.
+*
+* An enclosing loop reaches the loop again in each of its iterations, so the stable state is kept in the loop's record.
+* When the loop is reached with no more possibilities than last time, and no summary has grown since, the stable state
+* still holds, and is reused. When it is reached with more, the iterations start from the stable state.
+* That way each nesting level is only iterated a few times, instead of a few times per iteration of the level above.
+* In the final pass, the body is analyzed once more from the stable state, to record the results.
+*/
+static void analyze_while_statement ( state_t *state, node_t *statement )
+{
+    bool was_recording = recording;
+    recording = false;
+
+    // A loop that can't be reached only takes one iteration to find out, and isn't kept
+    node_record_t *record = find_record ( statement, true );
+    bool iterated_before = record->loop_entry.values != NULL && state->reachable;
+    state_t loop_start, exit_state;
+    if ( iterated_before && record->loop_version == summary_version && state_includes ( &record->loop_entry, state ) )
+    {
+        loop_start = state_copy ( &record->loop_start );
+        exit_state = state_copy ( &record->loop_exit );
+    }
+    else
+    {
+        loop_start = state_copy ( state );
+        if ( iterated_before && state_includes ( state, &record->loop_entry ) )
+            state_join ( &loop_start, &record->loop_start );
+
+        // Summaries that grow while the loop is analyzed, such as through a return in its body,
+        // were not seen by the earlier iterations, so the stable state is only found with the summaries from before
+        size_t version = summary_version;
+
+        for ( int iteration = 0; ; iteration++ )
+        {
+            state_t body_state = analyze_loop_body ( &loop_start, statement, &exit_state );
+
+            // The next iteration can start either from before the loop, or from the end of the body
+            state_t next_start = state_copy ( state );
+            state_join ( &next_start, &body_state );
+            free ( body_state.values );
+            if ( iteration >= WIDEN_AFTER_ITERATIONS )
+                state_widen ( &next_start, &loop_start );
+
+            if ( state_equal ( &next_start, &loop_start ) )
+            {
+                free ( next_start.values );
+                break;
+            }
+            free ( exit_state.values );
+            state_move ( &loop_start, &next_start );
+        }
+
+        // The body may have added records, which moves them
+        record = find_record ( statement, true );
+        if ( state->reachable )
+        {
+            free ( record->loop_entry.values );
+            free ( record->loop_start.values );
+            free ( record->loop_exit.values );
+            record->loop_entry = state_copy ( state );
+            record->loop_start = state_copy ( &loop_start );
+            record->loop_exit = state_copy ( &exit_state );
+            record->loop_version = version;
+        }
+    }
+
+    // Go through the loop one last time, with the final state at the start of the loop
+    recording = was_recording;
+    if ( recording )
+    {
+        free ( exit_state.values );
+        state_t body_state = analyze_loop_body ( &loop_start, statement, &exit_state );
+        free ( body_state.values );
+    }
+    free ( loop_start.values );
+    state_move ( state, &exit_state );
+}
+
+/* Updates the state to be the state after the given statement has been executed */
+static void analyze_statement ( state_t *state, node_t *node )
+{
+    switch ( node->type )
+    {
+        case BLOCK: {
+            node_t *statement_list = node->children[node->n_children-1];
+            for ( size_t i = 0; i < statement_list->n_children; i++ )
+                analyze_statement ( state, statement_list->children[i] );
+            break;
+        }
+        case ASSIGNMENT_STATEMENT:
+            analyze_assignment_statement ( state, node );
+            break;
+        case PRINT_STATEMENT: {
+            node_t *print_items = node->children[0];
+            for ( size_t i = 0; i < print_items->n_children; i++ )
+                if ( print_items->children[i]->type != STRING_LIST_REFERENCE )
+                    analyze_expression ( state, print_items->children[i] );
+            break;
+        }
+        case RETURN_STATEMENT: {
+            range_t value = analyze_expression ( state, node->children[0] );
+            if ( state->reachable )
+                join_summary ( current_function, 0, value );
+            state->reachable = false;
+            break;
+        }
+        case IF_STATEMENT:
+            analyze_if_statement ( state, node );
+            break;
+        case WHILE_STATEMENT:
+            analyze_while_statement ( state, node );
+            break;
+        case BREAK_STATEMENT:
+            // Breaks outside of loops are reported when names are bound
+            if ( break_state != NULL )
+                state_join ( break_state, state );
+            state->reachable = false;
+            break;
+        case FUNCTION_CALL:
+            analyze_function_call ( state, node );
+            break;
+        default:
+            assert ( false && "Unknown statement type" );
+    }
+}
+
+/* Analyzes the function body, starting with the parameter summaries, and all local variables set to 0 */
+static void analyze_function ( symbol_t *function )
+{
+    current_function = function;
+    symbol_table_t *symbols = function->function_symtable;
+
+    state_t state = state_unreachable ( symbols->n_symbols );
+    state.reachable = true;
+    for ( size_t i = 0; i < symbols->n_symbols; i++ )
+    {
+        if ( symbols->symbols[i]->type == SYMBOL_PARAMETER )
+        {
+            state.values[i] = *PARAMETER_SUMMARY ( function, i );
+            // A function that is never called never runs
+            if ( RANGE_IS_EMPTY ( state.values[i] ) )
+                state.reachable = false;
+        }
+        else
+            state.values[i] = SINGLE_VALUE ( 0 );
+    }
+
+    analyze_statement ( &state, function->node->children[2] );
+
+    // Falling off the end of the function returns 0
+    if ( state.reachable )
+        join_summary ( function, 0, SINGLE_VALUE ( 0 ) );
+    free ( state.values );
+}
+
+/* ==================== Rewriting ==================== */
+
+/* Returns true if evaluating the expression may have side effects */
+static bool has_function_call ( node_t *node )
+{
+    if ( node->type == FUNCTION_CALL )
+        return true;
+    for ( size_t i = 0; i < node->n_children; i++ )
+        if ( has_function_call ( node->children[i] ) )
+            return true;
+    return false;
+}
+
+/* Returns a statement that does nothing */
+static node_t *empty_statement ( void )
+{
+    return node_create ( BLOCK, NULL, 1, node_create ( LIST, NULL, 0 ) );
+}
+
+
+/* Rewrites nodes bottom up, using the recorded ranges */
+static node_t *rewrite_subtree ( node_t *node )
+{
+    range_t range;
+    switch ( node->type )
+    {
+        case IDENTIFIER_DATA:
+            // Global variables always have the full range, so only local variables and parameters are replaced
+            if ( expression_range ( node, &range ) && range.min == range.max )
+                return number_node_create ( range.min );
+            return node;
+
+        case ASSIGNMENT_STATEMENT:
+            // The destination of an assignment is not a read, but the index of an array element is
+            if ( node->children[0]->type == ARRAY_INDEXING )
+                node->children[0]->children[1] = rewrite_subtree ( node->children[0]->children[1] );
+            node->children[1] = rewrite_subtree ( node->children[1] );
+            return node;
+
+        case FUNCTION_CALL:
+            node->children[1] = rewrite_subtree ( node->children[1] );
+            return node;
+
+        case ARRAY_INDEXING:
+            node->children[1] = rewrite_subtree ( node->children[1] );
+            return node;
+
+        default:
+            break;
+    }
+
+    // The relations are checked before their operands are rewritten, since the rewrite creates new nodes
+    if ( node->type == IF_STATEMENT && !has_function_call ( node->children[0] ) )
+    {
+        relation_outcome_t outcome = relation_outcome ( node->children[0] );
+        if ( outcome == RELATION_ALWAYS_TRUE )
+            return rewrite_subtree ( node->children[1] );
+        if ( outcome == RELATION_ALWAYS_FALSE && node->n_children == 3 )
+            return rewrite_subtree ( node->children[2] );
+        if ( outcome == RELATION_ALWAYS_FALSE )
+            return empty_statement ( );
+    }
+    if ( node->type == WHILE_STATEMENT && !has_function_call ( node->children[0] ) )
+    {
+        if ( relation_outcome ( node->children[0] ) == RELATION_ALWAYS_FALSE )
+            return empty_statement ( );
+    }
+
+    // Division by a power of two is a right shift, as long as the dividend is never negative
+    if ( node->type == EXPRESSION && node->n_children == 2 && node->operator == OPERATOR_DIVIDE &&
+         node->children[1]->type == NUMBER_DATA && expression_range ( node->children[0], &range ) && range.min >= 0 )
+    {
+        int64_t divisor = node->children[1]->value;
+        if ( divisor > 1 && ( divisor & ( divisor - 1 ) ) == 0 )
+        {
+            node->operator = OPERATOR_SHIFT_RIGHT;
+            node->children[1]->value = __builtin_ctzll ( divisor );
+        }
+    }
+
+    for ( size_t i = 0; i < node->n_children; i++ )
+        node->children[i] = rewrite_subtree ( node->children[i] );
+    return node;
+}
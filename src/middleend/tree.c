@@ -1,12 +1,18 @@
 #define NODETYPES_IMPLEMENTATION
 #include "vslc.h"
+#include "pure_functions.h"
+#include "arena.h"
+#include "intern.h"
+#include "time_report.h"
 
 // Global root for abstract syntax tree
-node_t *root;
+_Thread_local node_t *root;
+
+// All nodes, child lists and node data are allocated here, and freed together with the tree
+static _Thread_local arena_t tree_arena;
 
 // Declarations of internal functions, defined further down
 static void node_print ( node_t *node, int nesting );
-static void destroy_subtree ( node_t *discard );
 static node_t* simplify_subtree ( node_t *node );
 
 // Outputs the entire syntax tree to the terminal
@@ -18,41 +24,134 @@ void print_syntax_tree ( void )
         node_print ( root, 0 );
 }
 
-// Cleans up the entire syntax tree
+// Cleans up the entire syntax tree, everything else allocated with tree_alloc, and the interned identifiers
 void destroy_syntax_tree ( void )
 {
-    destroy_subtree ( root );
+    arena_free_all ( &tree_arena );
+    destroy_interned_strings ( );
+    root = NULL;
+}
+
+// Like destroy_syntax_tree, but keeps some of the memory for the next syntax tree made on this thread
+void reset_syntax_tree ( void )
+{
+    arena_reset ( &tree_arena );
+    reset_interned_strings ( );
     root = NULL;
 }
 
-// Modifies the syntax tree, performing constant folding where possible
+// Modifies the syntax tree, performing constant folding where possible.
+// Calls to pure functions with constant arguments are also folded, by evaluating them
 void simplify_tree ( void )
 {
+    find_pure_functions ( root );
     root = simplify_subtree( root );
+    destroy_pure_functions ( );
 }
 
-// Initialize a node with type, data, and children
-node_t* node_create ( node_type_t type, void *data, size_t n_children, ... )
+// Simplifies one global without find_pure_functions, so that evaluate_pure_call leaves every call alone
+node_t* simplify_global ( node_t *global )
 {
-    node_t* result = malloc ( sizeof ( node_t ) );
+    return simplify_subtree ( global );
+}
+
+// Allocates memory that lives as long as the syntax tree
+void* tree_alloc ( size_t size )
+{
+    return arena_alloc ( &tree_arena, size );
+}
+
+// Copies the string into memory that lives as long as the syntax tree
+char* tree_strdup ( const char *string )
+{
+    return arena_strdup ( &tree_arena, string );
+}
+
+arena_mark_t tree_mark ( void )
+{
+    return arena_mark ( &tree_arena );
+}
+
+// Frees the nodes allocated after the mark. Nothing may point to them anymore
+void tree_release ( arena_mark_t mark )
+{
+    arena_release ( &tree_arena, mark );
+}
+
+// Returns the smallest power of two that is at least n, or 0 if n is 0
+static size_t list_capacity ( size_t n )
+{
+    size_t capacity = n > 0 ? 1 : 0;
+    while ( capacity < n )
+        capacity *= 2;
+    return capacity;
+}
+
+// Initialize a node with type and children, reading the children from the va_list.
+// The extra data is left for the caller to fill in
+static node_t* node_create_va ( node_type_t type, size_t n_children, va_list child_list )
+{
+    node_t* result = tree_alloc ( sizeof ( node_t ) );
+    created_nodes[type]++;
+
+    // Lists get room to grow, see append_to_list_node
+    size_t capacity = type == LIST ? list_capacity ( n_children ) : n_children;
 
     // Initialize every field in the struct
     *result = (node_t) {
         .type = type,
         .n_children = n_children,
-        .children = (node_t **) malloc ( n_children * sizeof ( node_t * ) ),
+        .children = (node_t **) tree_alloc ( capacity * sizeof ( node_t * ) ),
 
-        .data = data,
+        .data = NULL,
         .symbol = NULL,
     };
 
-    // Read each child node from the va_list
-    va_list child_list;
-    va_start ( child_list, n_children );
     for ( size_t i = 0; i < n_children; i++ )
         result->children[i] = va_arg ( child_list, node_t * );
+
+    return result;
+}
+
+// Initialize a node with type, data, and children
+node_t* node_create ( node_type_t type, void *data, size_t n_children, ... )
+{
+    va_list child_list;
+    va_start ( child_list, n_children );
+    node_t* result = node_create_va ( type, n_children, child_list );
     va_end ( child_list );
 
+    result->data = data;
+    return result;
+}
+
+// Initialize an EXPRESSION or RELATION node with its operator, and children
+node_t* operator_node_create ( node_type_t type, operator_t operator, size_t n_children, ... )
+{
+    assert ( type == EXPRESSION || type == RELATION );
+
+    va_list child_list;
+    va_start ( child_list, n_children );
+    node_t* result = node_create_va ( type, n_children, child_list );
+    va_end ( child_list );
+
+    result->operator = operator;
+    return result;
+}
+
+// Initialize a NUMBER_DATA node, holding the number in the node itself
+node_t* number_node_create ( int64_t value )
+{
+    node_t* result = node_create ( NUMBER_DATA, NULL, 0 );
+    result->value = value;
+    return result;
+}
+
+// Create a STRING_DATA node, referring to the string literal in the source
+node_t* string_node_create ( source_slice_t slice )
+{
+    node_t* result = node_create ( STRING_DATA, NULL, 0 );
+    result->slice = slice;
     return result;
 }
 
@@ -61,16 +160,18 @@ node_t* append_to_list_node ( node_t* list_node, node_t* element )
 {
     assert ( list_node->type == LIST );
 
-    // Calculate the minimum size of the new allocation
-    size_t min_allocation_size = list_node->n_children + 1;
-
-    // Round up to the next power of two
-    size_t new_allocation_size = 1;
-    while ( new_allocation_size < min_allocation_size )
-        new_allocation_size *= 2;
-
-    // Resize the allocation
-    list_node->children = realloc ( list_node->children, new_allocation_size * sizeof(node_t *) );
+    // The children of a list are allocated with room for a power of two elements.
+    // When that room is full, the children are moved to an allocation twice as large.
+    // Lists are only ever shrunk after they are built, which can leave more room than assumed here, but never less
+    size_t n_children = list_node->n_children;
+    if ( list_capacity ( n_children ) == n_children )
+    {
+        size_t new_capacity = n_children > 0 ? n_children * 2 : 1;
+        node_t **children = tree_alloc ( new_capacity * sizeof(node_t *) );
+        if ( n_children > 0 )
+            memcpy ( children, list_node->children, n_children * sizeof(node_t *) );
+        list_node->children = children;
+    }
 
     // Insert the new element and increase child count by 1
     list_node->children[list_node->n_children] = element;
@@ -82,76 +183,64 @@ node_t* append_to_list_node ( node_t* list_node, node_t* element )
 // Prints out the given node and all its children recursively
 static void node_print ( node_t *node, int nesting )
 {
-    printf ( "%*s", nesting, "" );
+    fprintf ( output_stream, "%*s", nesting, "" );
 
     if ( node == NULL )
     {
-        printf ( "(NULL)\n");
+        fprintf ( output_stream, "(NULL)\n");
         return;
     }
 
-    printf ( "%s", node_strings[node->type] );
+    fprintf ( output_stream, "%s", node_strings[node->type] );
 
     // For nodes with extra data, print the data with the correct type
-    if ( node->type == IDENTIFIER_DATA ||
-         node->type == EXPRESSION ||
-         node->type == RELATION ||
-         node->type == STRING_DATA)
+    if ( node->type == IDENTIFIER_DATA )
+    {
+        fprintf ( output_stream, "(%s)", (char *) node->data );
+    }
+    else if ( node->type == STRING_DATA )
+    {
+        fprintf ( output_stream, "(%.*s)", (int) node->slice.length, SLICE_TEXT ( node->slice ) );
+    }
+    else if ( node->type == EXPRESSION || node->type == RELATION )
     {
-        printf ( "(%s)", (char *) node->data );
+        fprintf ( output_stream, "(%s)", OPERATOR_NAMES[node->operator] );
     }
     else if ( node->type == NUMBER_DATA )
     {
-        printf ( "(%ld)", *(int64_t *) node->data );
+        fprintf ( output_stream, "(%ld)", node->value );
     }
     else if ( node->type == STRING_LIST_REFERENCE )
     {
         // Prints the index of the string in the string_list
-        printf ( "(%zu)", (size_t) node->data );
+        fprintf ( output_stream, "(%zu)", (size_t) node->data );
     }
 
     // If the node has a symbol, print that as well
     if ( node->symbol )
     {
-        printf ( " %s(%zu)", SYMBOL_TYPE_NAMES[node->symbol->type], node->symbol->sequence_number );
+        fprintf ( output_stream, " %s(%zu)", SYMBOL_TYPE_NAMES[node->symbol->type], node->symbol->sequence_number );
     }
 
-    putchar ( '\n' );
+    fputc ( '\n', output_stream );
 
     // Recursively print children, with some more indentation
     for ( size_t i = 0; i < node->n_children; i++ )
         node_print ( node->children[i], nesting + 1 );
 }
 
-// Frees the memory owned by the given node, but does not touch its children
-static void node_finalize ( node_t *discard )
-{
-    if ( discard == NULL )
-        return;
-
-    // Only free data if the data field is owned by the node
-    switch ( discard->type )
-    {
-        case IDENTIFIER_DATA:
-        case NUMBER_DATA:
-        case STRING_DATA:
-            free ( discard->data );
-        default:
-            break;
-    }
-    free ( discard->children );
-    free ( discard );
-}
-
-// Recursively frees the memory owned by the given node, and all its children
-static void destroy_subtree ( node_t *discard )
+// Copies the given node, and all its children. The copies share the data and symbols of the originals
+node_t* copy_subtree ( node_t *node )
 {
-    if ( discard == NULL )
-        return;
+    node_t *copy = tree_alloc ( sizeof ( node_t ) );
+    created_nodes[node->type]++;
+    *copy = *node;
 
-     for ( size_t i = 0; i < discard->n_children; i++ )
-        destroy_subtree ( discard->children[i] );
-     node_finalize ( discard );
+    size_t capacity = node->type == LIST ? list_capacity ( node->n_children ) : node->n_children;
+    copy->children = (node_t **) tree_alloc ( capacity * sizeof ( node_t * ) );
+    for ( size_t i = 0; i < node->n_children; i++ )
+        copy->children[i] = copy_subtree ( node->children[i] );
+    return copy;
 }
 
 // Recursively replaces EXPRESSION nodes representing mathematical operations
@@ -168,46 +257,50 @@ static node_t* constant_fold_node ( node_t *node )
             return node;
     }
 
-    char* op = node->data;
-    int64_t* result = malloc ( sizeof(int64_t) );
+    operator_t op = node->operator;
+    int64_t result;
 
     if ( node->n_children == 1 ) {
-        int64_t operand = *(int64_t*) node->children[0]->data;
+        int64_t operand = node->children[0]->value;
 
-        if ( strcmp ( op, "-" ) == 0 )
-            *result = -operand;
-        else
+        if ( op != OPERATOR_SUBTRACT ) {
             assert ( false && "Unknown unary operator" );
+            return node;
+        }
+        result = -operand;
     }
     else if ( node->n_children == 2 ) {
-        int64_t lhs = *(int64_t*) node->children[0]->data;
-        int64_t rhs = *(int64_t*) node->children[1]->data;
-
-        if ( strcmp ( op, "+" ) == 0 )
-            *result = lhs + rhs;
-        else if ( strcmp ( op, "-" ) == 0 )
-            *result = lhs - rhs;
-        else if ( strcmp ( op, "*" ) == 0 )
-            *result = lhs * rhs;
-        else if ( strcmp ( op, "/" ) == 0 )
-            *result = lhs / rhs;
-        else if ( strcmp ( op, "<<" ) == 0 )
-            *result = lhs << rhs;
-        else if ( strcmp ( op, ">>" ) == 0 )
-            *result = lhs >> rhs;
-        else
-            assert ( false && "Unknown binary operator" );
+        int64_t lhs = node->children[0]->value;
+        int64_t rhs = node->children[1]->value;
+
+        // Division that would trap at runtime is left for the program to do
+        if ( op == OPERATOR_DIVIDE && ( rhs == 0 || ( lhs == INT64_MIN && rhs == -1 ) ) )
+            return node;
+
+        switch ( op )
+        {
+            case OPERATOR_ADD: result = lhs + rhs; break;
+            case OPERATOR_SUBTRACT: result = lhs - rhs; break;
+            case OPERATOR_MULTIPLY: result = lhs * rhs; break;
+            case OPERATOR_DIVIDE: result = lhs / rhs; break;
+            // Shifts only use the lowest 6 bits of the shift amount, like the shift instructions
+            case OPERATOR_SHIFT_LEFT: result = (int64_t) ( (uint64_t) lhs << ( rhs & 63 ) ); break;
+            case OPERATOR_SHIFT_RIGHT: result = lhs >> ( rhs & 63 ); break;
+            default:
+                assert ( false && "Unknown binary operator" );
+                return node;
+        }
     }
-    else
+    else {
         assert ( false && "Unknown expression type" );
+        return node;
+    }
 
-    // Clean up the old subtree
-    destroy_subtree ( node );
-
-    return node_create ( NUMBER_DATA, result, 0);
+    return number_node_create ( result );
 }
 
-// Recursively replaces multiplication and division by powers of two, with bitshifts
+// Recursively replaces multiplication by powers of two, with bitshifts.
+// Division is only replaced in ranges.c, since a right shift rounds negative numbers the wrong way
 static node_t* peephole_optimize_node ( node_t* node )
 {
     if ( node->type != EXPRESSION ||
@@ -215,36 +308,27 @@ static node_t* peephole_optimize_node ( node_t* node )
          node->children[1]->type != NUMBER_DATA )
         return node;
 
-    char* op = node->data;
-    char* new_op;
+    operator_t op = node->operator;
 
-    if ( strcmp ( op, "*" ) == 0 )
-        new_op = "<<";
-    else if ( strcmp ( op, "/" ) == 0 )
-        new_op = ">>";
-    else
+    if ( op != OPERATOR_MULTIPLY && op != OPERATOR_DIVIDE )
         return node;
 
-    int64_t rhs = *(int64_t *) node->children[1]->data;
+    int64_t rhs = node->children[1]->value;
 
-    // Multiplication and division by 1 is a no-op, return the LHS and destroy the rest
-    if ( rhs == 1 ) {
-        node_t* lhs_node = node->children[0];
-        node->children[0] = NULL;
-        destroy_subtree ( node );
-        return lhs_node;
-    }
+    // Multiplication and division by 1 is a no-op, return the LHS
+    if ( rhs == 1 )
+        return node->children[0];
 
-    // Only works for positive powers of two
-    if ( rhs <= 0 || __builtin_popcount(rhs) != 1 )
+    // Only works for multiplication by positive powers of two
+    if ( op != OPERATOR_MULTIPLY || rhs <= 0 || __builtin_popcountll(rhs) != 1 )
         return node;
 
     int powerOfTwo = 1;
     while (rhs >> powerOfTwo != 1)
         powerOfTwo += 1;
 
-    node->data = new_op;
-    *(int64_t*)node->children[1]->data = powerOfTwo;
+    node->operator = OPERATOR_SHIFT_LEFT;
+    node->children[1]->value = powerOfTwo;
     return node;
 }
 
@@ -259,6 +343,7 @@ static node_t* simplify_subtree( node_t* node )
 
     node = constant_fold_node ( node );
     node = peephole_optimize_node ( node );
+    node = evaluate_pure_call ( node );
 
     return node;
 }
@@ -0,0 +1,335 @@
+#include "server.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define PROTOCOL_VERSION 3
+
+// The same limit as for source files, see source.c
+#define MAX_SOURCE_LENGTH UINT32_MAX
+
+// The request and response lines are far shorter than this
+#define MAX_LINE_LENGTH 256
+
+/* ==================== Reading and writing sockets ==================== */
+
+static bool write_all ( int connection, const char *data, size_t length )
+{
+    while ( length > 0 )
+    {
+        ssize_t written = write ( connection, data, length );
+        if ( written < 0 && errno == EINTR )
+            continue;
+        if ( written <= 0 )
+            return false;
+        data += written;
+        length -= written;
+    }
+    return true;
+}
+
+static bool read_all ( int connection, char *data, size_t length )
+{
+    while ( length > 0 )
+    {
+        ssize_t got = read ( connection, data, length );
+        if ( got < 0 && errno == EINTR )
+            continue;
+        if ( got <= 0 )
+            return false;
+        data += got;
+        length -= got;
+    }
+    return true;
+}
+
+/* Reads up to and including a newline, which is replaced by the terminating null byte.
+ * One byte at a time, so that nothing after the line is read */
+static bool read_line ( int connection, char *line, size_t size )
+{
+    for ( size_t i = 0; i < size; i++ )
+    {
+        if ( !read_all ( connection, &line[i], 1 ) )
+            return false;
+        if ( line[i] == '\n' )
+        {
+            line[i] = '\0';
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool make_address ( const char *path, struct sockaddr_un *address )
+{
+    *address = (struct sockaddr_un) { .sun_family = AF_UNIX };
+    if ( strlen ( path ) >= sizeof(address->sun_path) )
+    {
+        fprintf ( stderr, "error: the socket path '%s' is too long\n", path );
+        return false;
+    }
+    strcpy ( address->sun_path, path );
+    return true;
+}
+
+/* ==================== The server ==================== */
+
+static int listener;                   // The socket every worker accepts connections on
+static vslc_options_t server_options;  // The options given to --server, which requests add to
+
+static void respond ( int connection, bool success, vslc_buffer_t output, const char *reports, const char *error )
+{
+    char header[MAX_LINE_LENGTH];
+    int header_length = snprintf ( header, sizeof(header), "vslc-response %d %d %zu %zu %zu\n",
+                                   PROTOCOL_VERSION, success, output.length, strlen ( reports ), strlen ( error ) );
+    // If the client has gone away, there is no one to tell, so the rest is not sent
+    if ( write_all ( connection, header, header_length ) && write_all ( connection, output.data, output.length ) )
+        if ( write_all ( connection, reports, strlen ( reports ) ) )
+            write_all ( connection, error, strlen ( error ) );
+}
+
+/* Compiles the source of one request, and sends back the result */
+static void serve_request ( int connection )
+{
+    char line[MAX_LINE_LENGTH];
+    int version, flags[9], time_report, jobs;
+    unsigned long long length;
+    if ( !read_line ( connection, line, sizeof(line) )
+        || sscanf ( line, "vslc-request %d %d %d %d %d %d %d %d %d %d %d %d %llu", &version, &flags[0], &flags[1],
+                    &flags[2], &flags[3], &flags[4], &flags[5], &flags[6], &flags[7], &flags[8], &time_report, &jobs,
+                    &length ) != 13
+        || version != PROTOCOL_VERSION || time_report < VSLC_TIME_REPORT_NONE || time_report > VSLC_TIME_REPORT_JSON
+        || jobs < 0 || length > MAX_SOURCE_LENGTH )
+    {
+        respond ( connection, false, (vslc_buffer_t) { 0 }, "", "error: the request is not one this server understands" );
+        return;
+    }
+
+    char *source = malloc ( length + 1 );
+    if ( source == NULL || !read_all ( connection, source, length ) )
+    {
+        free ( source );
+        return;
+    }
+
+    vslc_options_t options = server_options;
+    options.print_full_tree = flags[0];
+    options.print_tree_after_simplify = flags[1];
+    options.print_symbol_table_contents = flags[2];
+    options.generate_program = flags[3];
+    options.use_freestanding_runtime = flags[4];
+    options.report_dead_code = flags[5];
+    options.no_main = flags[6];
+    options.stream = flags[7];
+    options.profile = flags[8];
+    options.time_report = time_report;
+    options.jobs = jobs;
+
+    vslc_context_t *context = vslc_context_create ( &options );
+    vslc_buffer_t output;
+    bool success = vslc_compile ( context, source, length, &output );
+    free ( source );
+    respond ( connection, success, output, vslc_reports ( context ), success ? "" : vslc_error ( context ) );
+    vslc_context_destroy ( context );
+}
+
+/* Each worker serves one connection at a time, for as long as the server runs */
+static void *serve ( void *argument )
+{
+    // The arenas of the last request are reused by the next one
+    vslc_keep_thread_memory ( true );
+    for ( ;; )
+    {
+        int connection = accept ( listener, NULL, NULL );
+        if ( connection < 0 )
+        {
+            // These only fail the connection being accepted, or pass with time
+            if ( errno == EINTR || errno == ECONNABORTED || errno == EMFILE || errno == ENFILE
+                || errno == ENOBUFS || errno == ENOMEM )
+                continue;
+            fprintf ( stderr, "error: could not accept connections: %s\n", strerror ( errno ) );
+            exit ( EXIT_FAILURE );
+        }
+        serve_request ( connection );
+        close ( connection );
+    }
+    return NULL;
+}
+
+int run_server ( const char *socket_path, int n_workers, const vslc_options_t *options )
+{
+    struct sockaddr_un address;
+    if ( !make_address ( socket_path, &address ) )
+        return EXIT_FAILURE;
+
+    // A socket left behind by a server that didn't exit cleanly is replaced, but not one that is still served
+    struct stat status;
+    if ( lstat ( socket_path, &status ) == 0 && S_ISSOCK ( status.st_mode ) )
+    {
+        int probe = socket ( AF_UNIX, SOCK_STREAM, 0 );
+        bool served = connect ( probe, (struct sockaddr*) &address, sizeof(address) ) == 0;
+        close ( probe );
+        if ( served )
+        {
+            fprintf ( stderr, "error: a server is already running on '%s'\n", socket_path );
+            return EXIT_FAILURE;
+        }
+        unlink ( socket_path );
+    }
+
+    listener = socket ( AF_UNIX, SOCK_STREAM, 0 );
+    mode_t old_mask = umask ( 077 ); // Only the user running the server may connect to it
+    bool bound = bind ( listener, (struct sockaddr*) &address, sizeof(address) ) == 0;
+    umask ( old_mask );
+    if ( !bound || listen ( listener, SOMAXCONN ) != 0 )
+    {
+        fprintf ( stderr, "error: could not listen on '%s': %s\n", socket_path, strerror ( errno ) );
+        return EXIT_FAILURE;
+    }
+
+    // Clients that go away are noticed as failed writes instead
+    signal ( SIGPIPE, SIG_IGN );
+
+    // The workers inherit the blocked signals, so that only this thread receives them
+    sigset_t stop_signals;
+    sigemptyset ( &stop_signals );
+    sigaddset ( &stop_signals, SIGINT );
+    sigaddset ( &stop_signals, SIGTERM );
+    sigaddset ( &stop_signals, SIGHUP );
+    pthread_sigmask ( SIG_BLOCK, &stop_signals, NULL );
+
+    server_options = *options;
+    int n_started = 0;
+    for ( ; n_started < n_workers; n_started++ )
+    {
+        pthread_t thread;
+        if ( pthread_create ( &thread, NULL, serve, NULL ) != 0 )
+            break;
+        pthread_detach ( thread );
+    }
+    if ( n_started == 0 )
+    {
+        fprintf ( stderr, "error: could not start any worker threads\n" );
+        unlink ( socket_path );
+        return EXIT_FAILURE;
+    }
+
+    int signal_number;
+    sigwait ( &stop_signals, &signal_number );
+    unlink ( socket_path );
+    return EXIT_SUCCESS;
+}
+
+/* ==================== The client ==================== */
+
+/* Reads all of the file, or stdin if path is NULL, into memory allocated with malloc */
+static bool read_source ( const char *path, char **source, size_t *length )
+{
+    FILE *input = path != NULL ? fopen ( path, "r" ) : stdin;
+    if ( input == NULL )
+        return false;
+
+    FILE *buffer = open_memstream ( source, length );
+    char chunk[1 << 16];
+    size_t got;
+    while ( ( got = fread ( chunk, 1, sizeof(chunk), input ) ) > 0 )
+        fwrite ( chunk, 1, got, buffer );
+    bool failed = ferror ( input );
+    fclose ( buffer );
+    if ( input != stdin )
+        fclose ( input );
+    if ( failed )
+        free ( *source );
+    return !failed;
+}
+
+/* Copies length bytes from the connection to the stream */
+static bool copy_out ( int connection, unsigned long long length, FILE *stream )
+{
+    char chunk[1 << 16];
+    while ( length > 0 )
+    {
+        size_t size = length < sizeof(chunk) ? length : sizeof(chunk);
+        if ( !read_all ( connection, chunk, size ) )
+            return false;
+        fwrite ( chunk, 1, size, stream );
+        length -= size;
+    }
+    return true;
+}
+
+int run_client ( const char *socket_path, const char *path, const vslc_options_t *options )
+{
+    char *source;
+    size_t length;
+    if ( !read_source ( path, &source, &length ) )
+    {
+        if ( path != NULL )
+            fprintf ( stderr, "error: could not read '%s': %s\n", path, strerror ( errno ) );
+        else
+            fprintf ( stderr, "error: could not read stdin: %s\n", strerror ( errno ) );
+        return EXIT_FAILURE;
+    }
+    if ( length > MAX_SOURCE_LENGTH )
+    {
+        fprintf ( stderr, "error: '%s' is too large, the limit is 4 GiB\n", path != NULL ? path : "stdin" );
+        free ( source );
+        return EXIT_FAILURE;
+    }
+
+    struct sockaddr_un address;
+    if ( !make_address ( socket_path, &address ) )
+    {
+        free ( source );
+        return EXIT_FAILURE;
+    }
+    int connection = socket ( AF_UNIX, SOCK_STREAM, 0 );
+    if ( connect ( connection, (struct sockaddr*) &address, sizeof(address) ) != 0 )
+    {
+        fprintf ( stderr, "error: could not connect to a server on '%s': %s\n", socket_path, strerror ( errno ) );
+        close ( connection );
+        free ( source );
+        return EXIT_FAILURE;
+    }
+    signal ( SIGPIPE, SIG_IGN );
+
+    char line[MAX_LINE_LENGTH];
+    int line_length = snprintf ( line, sizeof(line), "vslc-request %d %d %d %d %d %d %d %d %d %d %d %d %zu\n",
+        PROTOCOL_VERSION, options->print_full_tree, options->print_tree_after_simplify,
+        options->print_symbol_table_contents, options->generate_program, options->use_freestanding_runtime,
+        options->report_dead_code, options->no_main, options->stream, options->profile, options->time_report,
+        options->jobs, length );
+    bool sent = write_all ( connection, line, line_length ) && write_all ( connection, source, length );
+    free ( source );
+
+    int version, success;
+    unsigned long long output_length, reports_length, error_length;
+    bool answered = sent && read_line ( connection, line, sizeof(line) )
+        && sscanf ( line, "vslc-response %d %d %llu %llu %llu", &version, &success,
+                    &output_length, &reports_length, &error_length ) == 5
+        && version == PROTOCOL_VERSION;
+
+    // Like vslc, whatever was output before an error is still printed
+    answered = answered && copy_out ( connection, output_length, stdout )
+        && copy_out ( connection, reports_length, stderr )
+        && copy_out ( connection, error_length, stderr );
+    close ( connection );
+
+    if ( !answered )
+    {
+        fprintf ( stderr, "error: the server on '%s' did not answer\n", socket_path );
+        return EXIT_FAILURE;
+    }
+    if ( !success )
+        fputc ( '\n', stderr );
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
+}
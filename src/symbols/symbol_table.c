@@ -1,11 +1,30 @@
 #include "symbol_table.h"
 #include "symbols.h"
+#include "intern.h"
 
 #include <assert.h>
 #include <stdlib.h>
 #include <string.h>
 
-static insert_result_t symbol_hashmap_insert ( symbol_hashmap_t *hashmap, symbol_t *symbol );
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+// Each insertion into a scope is logged, together with the symbol it shadowed.
+// Each scope starts with a marker entry, which remembers where the outer scope started
+typedef struct scope_log_entry
+{
+    symbol_t *symbol;         // The inserted symbol, or NULL for the start of a scope
+    symbol_t *shadowed;       // The symbol from an outer scope with the same name, or NULL if there is none
+    size_t outer_scope_start; // Only used for the start of a scope
+} scope_log_entry_t;
+
+static void symbol_hashmap_insert ( symbol_hashmap_t *hashmap, symbol_t *symbol );
+static void symbol_hashmap_place ( symbol_hashmap_t *hashmap, symbol_hashmap_bucket_t entry );
+static symbol_hashmap_bucket_t *symbol_hashmap_find ( symbol_hashmap_t *hashmap, const char *name );
+static void symbol_hashmap_erase ( symbol_hashmap_t *hashmap, symbol_hashmap_bucket_t *bucket );
+static void symbol_hashmap_clear ( symbol_hashmap_t *hashmap );
+static void scope_log_append ( symbol_table_t *table, scope_log_entry_t entry );
 
 // ================== Symbol table code =================
 // Initializes a symboltable with 0 entries. Will be resized upon first insertion
@@ -16,7 +35,11 @@ symbol_table_t* symbol_table_init ( void )
         .symbols = NULL,
         .n_symbols = 0,
         .capacity = 0,
-        .hashmap = symbol_hashmap_init ( )
+        .hashmap = symbol_hashmap_init ( ),
+        .scope_log = NULL,
+        .scope_log_length = 0,
+        .scope_log_capacity = 0,
+        .scope_start = 0
     };
     return result;
 }
@@ -24,10 +47,23 @@ symbol_table_t* symbol_table_init ( void )
 // Adds a symbol to both the symbol table, and its hashmap (if possible)
 insert_result_t symbol_table_insert ( symbol_table_t *table, struct symbol *symbol )
 {
-    // Inserts can fail, if the hashmap already contains the name
-    if ( symbol_hashmap_insert ( table->hashmap, symbol ) == INSERT_COLLISION )
+    symbol_hashmap_t *hashmap = table->hashmap;
+    symbol_hashmap_bucket_t *bucket = symbol_hashmap_find ( hashmap, symbol->name );
+    symbol_t *shadowed = bucket != NULL ? bucket->symbol : NULL;
+
+    // Inserts can fail, if the name is already used in the same scope
+    if ( shadowed != NULL && shadowed->sequence_number >= table->scope_start )
         return INSERT_COLLISION;
 
+    // A symbol from an outer scope is replaced in its bucket, to be put back when the scope is popped
+    if ( shadowed != NULL )
+        bucket->symbol = symbol;
+    else
+        symbol_hashmap_insert ( hashmap, symbol );
+
+    if ( table->scope_log_length > 0 )
+        scope_log_append ( table, (scope_log_entry_t) { .symbol = symbol, .shadowed = shadowed } );
+
     // If the table is full, resize the list
     if ( table->n_symbols + 1 >= table->capacity )
     {
@@ -42,134 +78,276 @@ insert_result_t symbol_table_insert ( symbol_table_t *table, struct symbol *symb
     return INSERT_OK;
 }
 
+// Logs the start of a scope. Every symbol already in the table belongs to outer scopes
+void symbol_table_push_scope ( symbol_table_t *table )
+{
+    scope_log_append ( table, (scope_log_entry_t) { .symbol = NULL, .outer_scope_start = table->scope_start } );
+    table->scope_start = table->n_symbols;
+}
+
+// Undoes the insertions of the innermost scope, newest first, until its start is found
+void symbol_table_pop_scope ( symbol_table_t *table )
+{
+    symbol_hashmap_t *hashmap = table->hashmap;
+    while ( true )
+    {
+        assert ( table->scope_log_length > 0 && "Popped a scope that was never pushed" );
+        scope_log_entry_t entry = table->scope_log[--table->scope_log_length];
+        if ( entry.symbol == NULL )
+        {
+            table->scope_start = entry.outer_scope_start;
+            return;
+        }
+
+        symbol_hashmap_bucket_t *bucket = symbol_hashmap_find ( hashmap, entry.symbol->name );
+        assert ( bucket != NULL && bucket->symbol == entry.symbol );
+        if ( entry.shadowed != NULL )
+            bucket->symbol = entry.shadowed;
+        else
+            symbol_hashmap_erase ( hashmap, bucket );
+    }
+}
+
+// Adds an entry to the end of the scope log, resizing it if needed
+static void scope_log_append ( symbol_table_t *table, scope_log_entry_t entry )
+{
+    if ( table->scope_log_length == table->scope_log_capacity )
+    {
+        table->scope_log_capacity = table->scope_log_capacity*2 + 8;
+        table->scope_log = realloc ( table->scope_log, table->scope_log_capacity * sizeof(scope_log_entry_t) );
+    }
+    table->scope_log[table->scope_log_length++] = entry;
+}
+
+// Removes the marked symbols from the list, and inserts the rest into an emptied hashmap
+void symbol_table_remove_symbols ( symbol_table_t *table, const bool *remove )
+{
+    size_t n_kept = 0;
+    for ( size_t i = 0; i < table->n_symbols; i++ )
+    {
+        symbol_t *symbol = table->symbols[i];
+        if ( remove[i] ) {
+            free ( symbol );
+            continue;
+        }
+        symbol->sequence_number = n_kept;
+        table->symbols[n_kept++] = symbol;
+    }
+    table->n_symbols = n_kept;
+
+    // Most symbols might be removed, so empty the hashmap and insert the rest again, instead of leaving deleted buckets
+    symbol_hashmap_clear ( table->hashmap );
+    for ( size_t i = 0; i < table->n_symbols; i++ )
+        symbol_hashmap_insert ( table->hashmap, table->symbols[i] );
+}
+
 // Destroys the given symbol table, its hashmap, and all the symbols it owns
 void symbol_table_destroy ( symbol_table_t *table )
 {
     for ( int i = 0; i < table->n_symbols; i++ )
         free ( table->symbols[i] );
     free ( table->symbols );
+    free ( table->scope_log );
     symbol_hashmap_destroy ( table->hashmap );
     free ( table );
 }
 
 // ==================== Hashmap code ====================
 
+// The hashmap is laid out like a SwissTable. The buckets are split into groups of 16, and each bucket has a control byte.
+// The control byte of a full bucket holds the lowest 7 bits of its entry's hash,
+// so all 16 buckets of a group can be checked against a name at once, and names are only compared in buckets that match.
+// The rest of the hash picks the group where probing starts. Groups are probed 1, 2, 3, ... groups apart,
+// which visits every group, since the number of groups is a power of two.
+// Probing stops at the first group with an empty bucket.
+
+#define GROUP_SIZE 16
+#define CONTROL_EMPTY ((int8_t) -128)
+#define CONTROL_DELETED ((int8_t) -2)
+
+// The control byte of a full bucket, and the first group to probe, taken from different bits of the hash
+#define HASH_CONTROL(hash) ((int8_t) ( (hash) & 0x7F ))
+#define HASH_GROUP(hash) ((hash) >> 7)
+
+// Returns a mask with bit i set, if control byte i of the group equals the given byte
+static uint32_t group_match ( const int8_t *group, int8_t control )
+{
+#ifdef __SSE2__
+    __m128i bytes = _mm_loadu_si128 ( (const __m128i *) group );
+    return _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( bytes, _mm_set1_epi8 ( control ) ) );
+#else
+    uint32_t mask = 0;
+    for ( int i = 0; i < GROUP_SIZE; i++ )
+        mask |= (uint32_t) ( group[i] == control ) << i;
+    return mask;
+#endif
+}
+
+// Returns a mask with bit i set, if bucket i of the group is empty or deleted. Only those control bytes are negative
+static uint32_t group_match_free ( const int8_t *group )
+{
+#ifdef __SSE2__
+    return _mm_movemask_epi8 ( _mm_loadu_si128 ( (const __m128i *) group ) );
+#else
+    uint32_t mask = 0;
+    for ( int i = 0; i < GROUP_SIZE; i++ )
+        mask |= (uint32_t) ( group[i] < 0 ) << i;
+    return mask;
+#endif
+}
+
 // Initializes a hashmap with 0 buckets. Will be resized upon first insertion
 symbol_hashmap_t* symbol_hashmap_init()
 {
     symbol_hashmap_t *result = malloc ( sizeof(symbol_hashmap_t) );
     *result = (symbol_hashmap_t) {
+        .control = NULL,
         .buckets = NULL,
         .n_buckets = 0,
         .n_entries = 0,
+        .n_deleted = 0,
         .backup = NULL
     };
     return result;
 }
 
-// Calculates a naive 64-bit hash of the given string
-static uint64_t hash_string ( const char* string )
+// Allocates new buckets, and inserts all entries again, which also gets rid of deleted buckets.
+// The number of buckets is doubled, unless getting rid of the deleted buckets makes enough room
+static void symbol_hashmap_resize ( symbol_hashmap_t *hashmap )
 {
-    assert( string != NULL );
-    uint64_t hash = 31;
-    for (const char *c = string; *c != '\0'; c++)
-        hash = hash * 257 + *c;
-    return hash;
-}
-
-// Allocates a larger list of buckets, and inserts all hashmap entries again
-static void symbol_hashmap_resize ( symbol_hashmap_t *hashmap, size_t new_capacity )
-{
-    symbol_t **old_buckets = hashmap->buckets;
+    int8_t *old_control = hashmap->control;
+    symbol_hashmap_bucket_t *old_buckets = hashmap->buckets;
     size_t old_capacity = hashmap->n_buckets;
 
-    // Use calloc, since it initalizes the memory to 0, aka NULL entries
-    hashmap->buckets = calloc ( new_capacity, sizeof(symbol_t*) );
+    size_t new_capacity = old_capacity;
+    if ( old_capacity == 0 )
+        new_capacity = GROUP_SIZE;
+    else if ( hashmap->n_entries * 2 >= old_capacity )
+        new_capacity = old_capacity * 2;
+
+    // The buckets come right after the control bytes. There are at least 16 control bytes, so the buckets are aligned
+    hashmap->control = malloc ( new_capacity * ( 1 + sizeof(symbol_hashmap_bucket_t) ) );
+    hashmap->buckets = (symbol_hashmap_bucket_t *) ( hashmap->control + new_capacity );
     hashmap->n_buckets = new_capacity;
-    hashmap->n_entries = 0;
+    symbol_hashmap_clear ( hashmap );
 
-    // Now re-insert all entries from the old buckets
-    for (int i = 0; i < old_capacity; i++ )
+    // Now re-insert all entries from the old buckets. There is room for them, so the size doesn't need to be checked
+    for ( size_t i = 0; i < old_capacity; i++ )
     {
-        if (old_buckets[i] != NULL)
-            symbol_hashmap_insert ( hashmap, old_buckets[i] );
+        if ( old_control[i] >= 0 )
+            symbol_hashmap_place ( hashmap, old_buckets[i] );
     }
 
-    free ( old_buckets );
+    free ( old_control );
 }
 
-// Performs insertion into the hashmap.
-// The hashmap uses open addressing, with up to one entry per bucket.
-// If our first choice of bucket is full, we look at the next bucket, until we find room.
-static insert_result_t symbol_hashmap_insert ( symbol_hashmap_t *hashmap, symbol_t *symbol )
+// Inserts a symbol, whose name must not already be in the hashmap
+static void symbol_hashmap_insert ( symbol_hashmap_t *hashmap, symbol_t *symbol )
 {
-    // Make sure that the fill ratio of the hashmap never exeeds 1/2
-    int new_size = hashmap->n_entries + 1;
-    if ( new_size*2 > hashmap->n_buckets )
-        symbol_hashmap_resize ( hashmap, hashmap->n_buckets*2 + 8 );
+    // Make sure that at most 7/8 of the buckets are full or deleted, so every probe sequence reaches an empty bucket
+    if ( ( hashmap->n_entries + hashmap->n_deleted + 1 ) * 8 > hashmap->n_buckets * 7 )
+        symbol_hashmap_resize ( hashmap );
 
-    // Now calculate the position of the new entry
-    uint64_t hash = hash_string ( symbol->name );
-    size_t bucket = hash % hashmap->n_buckets;
+    symbol_hashmap_place ( hashmap, (symbol_hashmap_bucket_t) { .name = symbol->name, .symbol = symbol } );
+}
 
-    // Iterate until we find an empty bucket
-    while ( hashmap->buckets[bucket] != NULL )
-    {
-        // Check if the existing entry is a name collision
-        if ( strcmp(hashmap->buckets[bucket]->name, symbol->name) == 0 )
-            return INSERT_COLLISION; // An entry with the same name already exists
-        // Go to the next bucket
-        bucket = (bucket + 1) % hashmap->n_buckets;
-    }
+// Puts the entry in the first empty or deleted bucket of its probe sequence
+static void symbol_hashmap_place ( symbol_hashmap_t *hashmap, symbol_hashmap_bucket_t entry )
+{
+    uint64_t hash = interned_hash ( entry.name );
+    size_t group_mask = hashmap->n_buckets / GROUP_SIZE - 1;
+    size_t group = HASH_GROUP ( hash ) & group_mask;
+    uint32_t free_buckets;
+    for ( size_t step = 1; ( free_buckets = group_match_free ( hashmap->control + group * GROUP_SIZE ) ) == 0; step++ )
+        group = ( group + step ) & group_mask;
 
-    // We found an emoty bucket, insert the symbol here
-    hashmap->buckets[bucket] = symbol;
+    size_t bucket = group * GROUP_SIZE + __builtin_ctz ( free_buckets );
+    if ( hashmap->control[bucket] == CONTROL_DELETED )
+        hashmap->n_deleted--;
+    hashmap->control[bucket] = HASH_CONTROL ( hash );
+    hashmap->buckets[bucket] = entry;
     hashmap->n_entries++;
-    return INSERT_OK; // We successfully inserted a new symbol
 }
 
-// Performs lookup in the hashmap.
-// Hashes the given string, and checks if the resulting bucket contains the item.
-// Since the hashmap uses open addressing, the entry can also be in the next bucket,
-// so we iterate until we either find the item, or find an empty bucket.
-//
-// If the key isn't found in this hashmap, but we have a backup, lookup continues there.
-// Otherwise, NULL is returned.
-symbol_t * symbol_hashmap_lookup ( symbol_hashmap_t *hashmap, const char* name )
+// Returns the bucket holding the symbol with the given name, or NULL if there is none.
+// Only this hashmap is searched, not its backup
+static symbol_hashmap_bucket_t *symbol_hashmap_find ( symbol_hashmap_t *hashmap, const char *name )
 {
-    uint64_t hash = hash_string ( name );
+    if ( hashmap->n_buckets == 0 )
+        return NULL;
 
-    // Loop through the linked list of hashmaps and backup hashmaps
-    while ( hashmap != NULL )
+    uint64_t hash = interned_hash ( name );
+    size_t group_mask = hashmap->n_buckets / GROUP_SIZE - 1;
+    size_t group = HASH_GROUP ( hash ) & group_mask;
+    for ( size_t step = 1; ; step++ )
     {
-        // Skip any hashmaps with 0 buckets
-        if ( hashmap->n_buckets == 0 )
+        const int8_t *control = hashmap->control + group * GROUP_SIZE;
+
+        // Names are interned, so only the buckets with the right control byte need a pointer comparison
+        for ( uint32_t match = group_match ( control, HASH_CONTROL ( hash ) ); match != 0; match &= match - 1 )
         {
-            hashmap = hashmap->backup;
-            continue;
+            size_t bucket = group * GROUP_SIZE + __builtin_ctz ( match );
+            if ( hashmap->buckets[bucket].name == name )
+                return &hashmap->buckets[bucket];
         }
 
-        size_t bucket = hash % hashmap->n_buckets;
-        while ( hashmap->buckets[bucket] != NULL )
-        {
-            // Check if the entry in the bucket has a matching name
-            if ( strcmp ( hashmap->buckets[bucket]->name, name ) == 0 )
-                return hashmap->buckets[bucket];
+        // If the name had been inserted, it would have been put in the empty bucket
+        if ( group_match ( control, CONTROL_EMPTY ) != 0 )
+            return NULL;
 
-            // Otherwise keep iterating until we find a hit, or an empty bucket
-            bucket = (bucket + 1) % hashmap->n_buckets;
-        }
+        group = ( group + step ) & group_mask;
+    }
+}
+
+// Removes the entry from the hashmap.
+// If the group has an empty bucket, no probe sequence has ever gone past it, so the bucket can become empty.
+// Otherwise it is marked as deleted, so that lookups still continue to the next group
+static void symbol_hashmap_erase ( symbol_hashmap_t *hashmap, symbol_hashmap_bucket_t *erased )
+{
+    size_t bucket = erased - hashmap->buckets;
+    const int8_t *group = hashmap->control + bucket / GROUP_SIZE * GROUP_SIZE;
+    if ( group_match ( group, CONTROL_EMPTY ) != 0 )
+    {
+        hashmap->control[bucket] = CONTROL_EMPTY;
+    }
+    else
+    {
+        hashmap->control[bucket] = CONTROL_DELETED;
+        hashmap->n_deleted++;
+    }
+    hashmap->buckets[bucket] = (symbol_hashmap_bucket_t) { 0 };
+    hashmap->n_entries--;
+}
 
-        // No entry with the required name existed in the hashmap, so go to the backup
-        hashmap = hashmap->backup;
+// Makes every bucket empty, keeping the allocation
+static void symbol_hashmap_clear ( symbol_hashmap_t *hashmap )
+{
+    if ( hashmap->n_buckets > 0 )
+        memset ( hashmap->control, CONTROL_EMPTY, hashmap->n_buckets );
+    hashmap->n_entries = 0;
+    hashmap->n_deleted = 0;
+}
+
+// Performs lookup in the hashmap.
+// If the key isn't found in this hashmap, but we have a backup, lookup continues there.
+// Otherwise, NULL is returned.
+symbol_t * symbol_hashmap_lookup ( symbol_hashmap_t *hashmap, const char* name )
+{
+    // Loop through the linked list of hashmaps and backup hashmaps
+    for ( ; hashmap != NULL; hashmap = hashmap->backup )
+    {
+        symbol_hashmap_bucket_t *bucket = symbol_hashmap_find ( hashmap, name );
+        if ( bucket != NULL )
+            return bucket->symbol;
     }
 
     // The entry was never found, and we are all out of backups
     return NULL;
 }
 
+// The buckets share the allocation of the control bytes
 void symbol_hashmap_destroy ( symbol_hashmap_t *hashmap )
 {
-    free ( hashmap->buckets );
+    free ( hashmap->control );
     free ( hashmap );
 }
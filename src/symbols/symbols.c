@@ -1,19 +1,55 @@
 #include "vslc.h"
+#include "parallel.h"
 
 /* Global symbol table and string list */
-symbol_table_t *global_symbols;
-char **string_list;
-size_t string_list_len;
-size_t string_list_capacity;
+_Thread_local symbol_table_t *global_symbols;
+_Thread_local source_slice_t *string_list;
+_Thread_local size_t string_list_len;
+_Thread_local size_t string_list_capacity;
+
+// The string literals of one function, in the order they appear in it.
+// Their STRING_DATA nodes become references into the string list once every function is bound,
+// so that functions can be bound on several threads, and their strings still get the same positions
+typedef struct
+{
+    node_t **nodes;
+    size_t length;
+    size_t capacity;
+} function_strings_t;
+
+// The functions, and their strings, while names are being bound. Freed by destroy_tables if binding fails
+static _Thread_local symbol_t **functions;
+static _Thread_local function_strings_t *function_strings;
+static _Thread_local size_t n_functions;
+
+// With -stream, names can be used before the globals they refer to are declared.
+// Each such use is remembered, and checked by finish_streamed_tables once the whole program has been seen
+typedef struct
+{
+    symbol_t *symbol;
+    node_type_t use;    // FUNCTION_CALL, ARRAY_INDEXING, or IDENTIFIER_DATA for a variable
+    size_t n_arguments; // Of a FUNCTION_CALL
+} forward_reference_t;
+
+static _Thread_local bool streaming;
+static _Thread_local forward_reference_t *forward_references;
+static _Thread_local size_t n_forward_references;
+static _Thread_local size_t forward_references_capacity;
 
 static void find_globals ( void );
-static void bind_names ( symbol_table_t *local_symbols, node_t *root );
-static void push_local_scope ( symbol_table_t *local_symbols );
-static void pop_local_scope ( symbol_table_t *local_symbols );
+static void add_global_symbols ( node_t *node );
+static bool complete_forward_symbol ( char *name, symtype_t type, node_t *node, symbol_table_t *function_symtable );
+static void bind_identifier ( symbol_table_t *local_symbols, node_t *identifier, node_t *use );
+static void check_use ( symbol_t *symbol, node_type_t use, size_t n_arguments );
+static bool bind_names_in_parallel ( int jobs );
+static void bind_function ( symbol_t *function, function_strings_t *strings );
+static void bind_names ( symbol_table_t *local_symbols, function_strings_t *strings, node_t *root );
+static void add_function_strings ( void );
+static void destroy_function_lists ( void );
 static void print_symbol_table ( symbol_table_t *table, int nesting );
 static void destroy_symbol_tables ( void );
 
-static size_t add_string ( char* string );
+static size_t add_string ( source_slice_t string );
 static void print_string_list ( void );
 static void destroy_string_list ( void );
 
@@ -21,21 +57,68 @@ static void destroy_string_list ( void );
 
 /* Creates a global symbol table, and local symbol tables for each function.
  * While building the symbol tables:
- *  - All usages of symbols are bound to their symbol table entries.
+ *  - All usages of symbols are bound to their symbol table entries, and checked to be used as what they are.
  *  - All strings are entered into the string_list
+ * With jobs above 1, the functions are bound on that many threads, and the result is the same.
  */
-void create_tables ( void )
+void create_tables ( int jobs )
 {
     // Create a global symbol table, and make symbols for all globals
     find_globals ();
 
+    functions = malloc ( global_symbols->n_symbols * sizeof(symbol_t*) );
+    for ( size_t i = 0; i < global_symbols->n_symbols; i++ )
+        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+            functions[n_functions++] = global_symbols->symbols[i];
+    function_strings = calloc ( n_functions, sizeof(function_strings_t) );
+
     // For all functions, we want to fill their local symbol tables,
     // and bind all names found in the function body
-    for ( int i = 0; i < global_symbols->n_symbols; i++ )
+    if ( jobs <= 1 || !bind_names_in_parallel ( jobs ) )
+        for ( size_t i = 0; i < n_functions; i++ )
+            bind_function ( functions[i], &function_strings[i] );
+
+    add_function_strings ( );
+    destroy_function_lists ( );
+}
+
+/* Starts the symbol tables of a program compiled with -stream, where globals are added one at a time */
+void begin_streamed_tables ( void )
+{
+    global_symbols = symbol_table_init ( );
+    streaming = true;
+}
+
+/* Adds the symbols of one global to the tables, as soon as it is parsed.
+ * The names in a function are bound, and its strings added to the string list.
+ * Returns the symbol of a function, or NULL for other globals */
+symbol_t* add_streamed_global ( node_t *global )
+{
+    add_global_symbols ( global );
+    if ( global->type != FUNCTION )
+        return NULL;
+
+    // The lists are the same as for a program with only this function, so that destroy_tables frees them on errors
+    symbol_t *function = symbol_hashmap_lookup ( global_symbols->hashmap, global->children[0]->data );
+    functions = malloc ( sizeof(symbol_t*) );
+    functions[0] = function;
+    function_strings = calloc ( 1, sizeof(function_strings_t) );
+    n_functions = 1;
+    bind_function ( function, &function_strings[0] );
+    add_function_strings ( );
+    destroy_function_lists ( );
+    return function;
+}
+
+/* Checks every use of a name before its declaration, now that every global has been declared */
+void finish_streamed_tables ( void )
+{
+    for ( size_t i = 0; i < n_forward_references; i++ )
     {
-        symbol_t *symbol = global_symbols->symbols[i];
-        if ( symbol->type == SYMBOL_FUNCTION )
-            bind_names ( symbol->function_symtable, symbol->node->children[2] );
+        forward_reference_t *reference = &forward_references[i];
+        if ( reference->symbol->node == NULL )
+            compile_error ( "error: unrecognized symbol '%s'", reference->symbol->name );
+        check_use ( reference->symbol, reference->use, reference->n_arguments );
     }
 }
 
@@ -46,29 +129,40 @@ void create_tables ( void )
 void print_tables ( void )
 {
     print_symbol_table ( global_symbols, 0 );
-    printf ( "\n == STRING LIST == \n" );
+    fprintf ( output_stream, "\n == STRING LIST == \n" );
     print_string_list ( );
-    printf ( "\n == BOUND SYNTAX TREE == \n" );
+    fprintf ( output_stream, "\n == BOUND SYNTAX TREE == \n" );
     print_syntax_tree ( );
 }
 
-/* Destroys all symbol tables and the global string list */
+/* Destroys all symbol tables and the global string list.
+ * Also works on tables that are only partly built, when an error has stopped create_tables */
 void destroy_tables ( void )
 {
+    destroy_function_lists ( );
     destroy_symbol_tables ( );
     destroy_string_list ( );
+    free ( forward_references );
+    forward_references = NULL;
+    n_forward_references = 0;
+    forward_references_capacity = 0;
+    streaming = false;
 }
 
 /* Internal matters */
 
+// On a collision, the symbol is freed before the error is reported, along with a function's symbol table
 #define CREATE_AND_INSERT_SYMBOL(table, ...) do {                        \
     symbol_t *symbol = malloc(sizeof(symbol_t));                         \
     *symbol = (symbol_t) {                                               \
     __VA_ARGS__                                                          \
     };                                                                   \
     if ( symbol_table_insert ( (table), symbol ) == INSERT_COLLISION ) { \
-        fprintf ( stderr, "error: symbol '%s' already defined\n", symbol->name ); \
-        exit ( EXIT_FAILURE );                                           \
+        const char *name = symbol->name;                                 \
+        if ( symbol->type == SYMBOL_FUNCTION )                           \
+            symbol_table_destroy ( symbol->function_symtable );          \
+        free ( symbol );                                                 \
+        compile_error ( "error: symbol '%s' already defined", name );    \
     }                                                                    \
     } while(false)
 
@@ -79,96 +173,171 @@ static void find_globals ( void )
 {
     global_symbols = symbol_table_init ( );
     for ( int i = 0; i < root->n_children; i++ )
+        add_global_symbols ( root->children[i] );
+}
+
+/* Adds the symbols declared by one global declaration, function or extern function */
+static void add_global_symbols ( node_t *node )
+{
+    if ( node->type == GLOBAL_DECLARATION )
     {
-        node_t *node = root->children[i];
-        if ( node->type == GLOBAL_DECLARATION )
+        node_t *global_variable_list = node->children[0];
+        for ( int j = 0; j < global_variable_list->n_children; j++ )
         {
-            node_t *global_variable_list = node->children[0];
-            for ( int j = 0; j < global_variable_list->n_children; j++ )
-            {
-                node_t *var = global_variable_list->children[j];
-                char* name;
-                symtype_t symtype;
+            node_t *var = global_variable_list->children[j];
+            char* name;
+            symtype_t symtype;
 
-                // The global variable list can both contain arrays and normal variables.
-                if ( var->type == ARRAY_INDEXING )
-                {
-                    name = var->children[0]->data;
-                    symtype = SYMBOL_GLOBAL_ARRAY;
-                }
-                else
-                {
-                    assert ( var->type == IDENTIFIER_DATA );
-                    name = var->data;
-                    symtype = SYMBOL_GLOBAL_VAR;
-                }
+            // The global variable list can both contain arrays and normal variables.
+            if ( var->type == ARRAY_INDEXING )
+            {
+                name = var->children[0]->data;
+                symtype = SYMBOL_GLOBAL_ARRAY;
+                // The length has been simplified already, so any constant expression is a number by now
+                if ( var->children[1]->type != NUMBER_DATA )
+                    compile_error ( "error: length of array '%s' is not compile time known", name );
+            }
+            else
+            {
+                assert ( var->type == IDENTIFIER_DATA );
+                name = var->data;
+                symtype = SYMBOL_GLOBAL_VAR;
+            }
 
+            if ( !complete_forward_symbol ( name, symtype, var, NULL ) )
                 CREATE_AND_INSERT_SYMBOL( global_symbols,
                                           .name = name,
                                           .type = symtype,
                                           .node = var,
                                           .function_symtable = NULL );
-            }
         }
-        else if ( node->type == FUNCTION )
-        {
-            // Functions have their own local symbol table. We make it now, and add the function parameters
-            symbol_table_t *function_symtable = symbol_table_init ( );
-            // We let the global hashmap be the backup of the local scope
-            function_symtable->hashmap->backup = global_symbols->hashmap;
-
-            node_t *parameters = node->children[1];
-            for ( int j = 0; j < parameters->n_children; j++ ) {
-                CREATE_AND_INSERT_SYMBOL( function_symtable,
-                                          .name = parameters->children[j]->data,
-                                          .type = SYMBOL_PARAMETER,
-                                          .node = parameters->children[j],
-                                          .function_symtable = NULL );
-            }
+    }
+    else if ( node->type == FUNCTION )
+    {
+        // Functions have their own local symbol table. We make it now, and add the function parameters.
+        // The function is inserted first, so that its symbol table is owned by the global symbol table
+        symbol_table_t *function_symtable = symbol_table_init ( );
+        // We let the global hashmap be the backup of the local scope
+        function_symtable->hashmap->backup = global_symbols->hashmap;
 
+        char *name = node->children[0]->data;
+        if ( !complete_forward_symbol ( name, SYMBOL_FUNCTION, node, function_symtable ) )
             CREATE_AND_INSERT_SYMBOL( global_symbols,
-                                      .name = node->children[0]->data,
+                                      .name = name,
                                       .type = SYMBOL_FUNCTION,
                                       .node = node,
                                       .function_symtable = function_symtable );
+
+        node_t *parameters = node->children[1];
+        for ( int j = 0; j < parameters->n_children; j++ ) {
+            CREATE_AND_INSERT_SYMBOL( function_symtable,
+                                      .name = parameters->children[j]->data,
+                                      .type = SYMBOL_PARAMETER,
+                                      .node = parameters->children[j],
+                                      .function_symtable = NULL );
         }
-        else
-        {
-            assert ( false && "Unknown global node type" );
-        }
+    }
+    else if ( node->type == EXTERN_FUNCTION )
+    {
+        // Functions in other modules are only called, so they only need a symbol with their parameter list
+        char *name = node->children[0]->data;
+        if ( !complete_forward_symbol ( name, SYMBOL_EXTERN_FUNCTION, node, NULL ) )
+            CREATE_AND_INSERT_SYMBOL( global_symbols,
+                                      .name = name,
+                                      .type = SYMBOL_EXTERN_FUNCTION,
+                                      .node = node,
+                                      .function_symtable = NULL );
+    }
+    else
+    {
+        assert ( false && "Unknown global node type" );
     }
 }
 
+/* With -stream, a global may have been used before it was declared, which made a symbol without a node for it,
+ * see bind_identifier. The declaration completes that symbol. Returns false if there is no such symbol */
+static bool complete_forward_symbol ( char *name, symtype_t type, node_t *node, symbol_table_t *function_symtable )
+{
+    if ( !streaming )
+        return false;
+    symbol_t *symbol = symbol_hashmap_lookup ( global_symbols->hashmap, name );
+    if ( symbol == NULL || symbol->node != NULL )
+        return false;
+
+    symbol->type = type;
+    symbol->node = node;
+    symbol->function_symtable = function_symtable;
+    return true;
+}
+
+// What the threads binding names need. The thread-local lists above belong to the calling thread
+typedef struct
+{
+    symbol_t **functions;
+    function_strings_t *strings;
+} binding_t;
+
+static void bind_names_task ( void *context, int thread, size_t task )
+{
+    binding_t *binding = context;
+    symbol_t *function = binding->functions[task];
+    bind_function ( function, &binding->strings[task] );
+}
+
+/* Binds the names of the functions on several threads, see parallel.h.
+ * Each function only changes its own symbol table, and only reads the global one.
+ * Returns false without binding anything if no thread could be started */
+static bool bind_names_in_parallel ( int jobs )
+{
+    binding_t binding = { .functions = functions, .strings = function_strings };
+    parallel_tasks_t tasks = { .n_tasks = n_functions, .context = &binding, .run_task = bind_names_task };
+    size_t failed_function;
+    char *error;
+    bool started = run_in_parallel ( &tasks, jobs, &failed_function, &error );
+    if ( error != NULL )
+        rethrow_error ( error );
+    return started;
+}
+
+// How many while loops the statement being bound is inside of, to find break statements outside of loops
+static _Thread_local int loop_depth;
+
+/* Binds the names in the body of the function */
+static void bind_function ( symbol_t *function, function_strings_t *strings )
+{
+    loop_depth = 0;
+    bind_names ( function->function_symtable, strings, function->node->children[2] );
+}
+
 /* A recursive function that traverses the body of a function, and:
  *  - Adds variable declarations to the function's local symbol table.
  *  - Pushes and pops local variable scopes when entering blocks.
  *  - Binds identifiers to the symbol it references.
- *  - Moves STRING_DATA nodes' data into the global string list,
- *    and replaces the node with a STRING_LIST_REFERENCE node.
- *    This node's data is the string's position in the list casted to a void*
+ *  - Adds STRING_DATA nodes to the function's strings, see add_function_strings
  */
-static void bind_names ( symbol_table_t *local_symbols, node_t *node )
+static void bind_names ( symbol_table_t *local_symbols, function_strings_t *strings, node_t *node )
 {
     switch ( node->type )
     {
-        // Can either be a variable in an expression, or the name of a function in a function call
-        // Either way, we wish to associate it with its symbol
-        case IDENTIFIER_DATA: {
-            symbol_t* symbol = symbol_hashmap_lookup ( local_symbols->hashmap, node->data );
-            if ( symbol == NULL ) {
-                fprintf ( stderr, "error: unrecognized symbol '%s'\n", (char*)node->data );
-                exit ( EXIT_FAILURE );
-            }
-            node->symbol = symbol;
+        // A variable in an expression, which we wish to associate with its symbol
+        case IDENTIFIER_DATA:
+            bind_identifier ( local_symbols, node, node );
+            break;
+
+        // The names of called functions and indexed arrays are bound along with the call or indexing,
+        // which tells how the name is used, in case it is declared further down, see bind_identifier
+        case FUNCTION_CALL:
+        case ARRAY_INDEXING:
+            bind_identifier ( local_symbols, node->children[0], node );
+            bind_names ( local_symbols, strings, node->children[1] );
             break;
-        }
 
         // Blocks may contain a list of declarations.
         // In such cases, a scope gets pushed, the declarations get added, and the name binding continues in the body
         case BLOCK:
             if ( node->n_children == 2 )
             {
-                push_local_scope ( local_symbols );
+                symbol_table_push_scope ( local_symbols );
                 // Iterate through all declarations in the delcaration list
                 node_t *decl_list = node->children[0];
                 for (int i = 0; i < decl_list->n_children; i++ )
@@ -184,45 +353,134 @@ static void bind_names ( symbol_table_t *local_symbols, node_t *node )
                                           .function_symtable = local_symbols );
                     }
                 }
-                bind_names ( local_symbols, node->children[1] );
-                pop_local_scope ( local_symbols );
+                bind_names ( local_symbols, strings, node->children[1] );
+                symbol_table_pop_scope ( local_symbols );
             } else {
                 // If the block only contains statements, and no declaration list, there is no need to make a scope
-                bind_names ( local_symbols, node->children[0] );
+                bind_names ( local_symbols, strings, node->children[0] );
             }
             break;
 
-        // Strings get inserted into the global string list
-        // The STRING_DATA node gets replaced by a STRING_LIST_REFERENCE node
-        case STRING_DATA: {
-            size_t position = add_string ( node->data );
-            node->type = STRING_LIST_REFERENCE;
-            node->data = (void*) position;
+        case WHILE_STATEMENT:
+            loop_depth++;
+            bind_names ( local_symbols, strings, node->children[0] );
+            bind_names ( local_symbols, strings, node->children[1] );
+            loop_depth--;
+            break;
+
+        case BREAK_STATEMENT:
+            if ( loop_depth == 0 )
+                compile_error ( "error: 'break' statement used outside of a while-loop" );
+            break;
+
+        // Strings are collected, and entered into the global string list later
+        case STRING_DATA:
+            if ( strings->length == strings->capacity )
+            {
+                strings->capacity = strings->capacity * 2 + 8;
+                strings->nodes = realloc ( strings->nodes, strings->capacity * sizeof(node_t*) );
+            }
+            strings->nodes[strings->length++] = node;
             break;
-        }
 
         // For all other nodes, recurse through its children
         default:
             for (int i = 0; i < node->n_children; i++)
-                bind_names ( local_symbols, node->children[i] );
+                bind_names ( local_symbols, strings, node->children[i] );
             break;
     }
 }
 
-/* Creates a new empty hashmap for the symbol table, using the outer scope's hashmap as backup */
-static void push_local_scope ( symbol_table_t *table )
+/* Associates the identifier with the symbol of its name, and checks that it is used as what it is. The use is
+ * the identifier itself, or the function call or array indexing it is the name of.
+ * With -stream, a name that isn't declared yet gets a global symbol without a node, of the type its use suggests,
+ * which its declaration completes later. Until then, every use of it is remembered for finish_streamed_tables,
+ * which checks it instead */
+static void bind_identifier ( symbol_table_t *local_symbols, node_t *identifier, node_t *use )
 {
-    symbol_hashmap_t *hashmap = symbol_hashmap_init ( );
-    hashmap->backup = table->hashmap;
-    table->hashmap = hashmap;
+    symbol_t *symbol = symbol_hashmap_lookup ( local_symbols->hashmap, identifier->data );
+    if ( symbol == NULL && !streaming )
+        compile_error ( "error: unrecognized symbol '%s'", (char*)identifier->data );
+
+    if ( symbol == NULL )
+    {
+        symbol = malloc ( sizeof(symbol_t) );
+        *symbol = (symbol_t) {
+            .name = identifier->data,
+            .type = use->type == FUNCTION_CALL ? SYMBOL_FUNCTION
+                  : use->type == ARRAY_INDEXING ? SYMBOL_GLOBAL_ARRAY : SYMBOL_GLOBAL_VAR,
+            .node = NULL,
+            .function_symtable = NULL
+        };
+        symbol_table_insert ( global_symbols, symbol );
+    }
+
+    if ( symbol->node == NULL )
+    {
+        if ( n_forward_references == forward_references_capacity )
+        {
+            forward_references_capacity = forward_references_capacity * 2 + 8;
+            forward_references = realloc ( forward_references,
+                                           forward_references_capacity * sizeof(forward_reference_t) );
+        }
+        forward_references[n_forward_references++] = (forward_reference_t) {
+            .symbol = symbol,
+            .use = use->type,
+            .n_arguments = use->type == FUNCTION_CALL ? use->children[1]->n_children : 0
+        };
+    }
+    else
+        check_use ( symbol, use->type, use->type == FUNCTION_CALL ? use->children[1]->n_children : 0 );
+    identifier->symbol = symbol;
 }
 
-/* Destroys the hashmap, and replaces it with the outer scope's hashmap */
-static void pop_local_scope ( symbol_table_t *table )
+/* Reports an error if the symbol is used as something it isn't. The use is FUNCTION_CALL, with the number of
+ * arguments given, ARRAY_INDEXING, or IDENTIFIER_DATA for a variable.
+ * Every function is checked, before unused ones are removed, so whether a program is valid never depends on that */
+static void check_use ( symbol_t *symbol, node_type_t use, size_t n_arguments )
 {
-    symbol_hashmap_t *hashmap = table->hashmap;
-    table->hashmap = hashmap->backup;
-    symbol_hashmap_destroy ( hashmap );
+    bool is_function = symbol->type == SYMBOL_FUNCTION || symbol->type == SYMBOL_EXTERN_FUNCTION;
+    if ( use == FUNCTION_CALL && !is_function )
+        compile_error ( "error: '%s' is not a function", symbol->name );
+    if ( use == FUNCTION_CALL && symbol->node->children[1]->n_children != n_arguments )
+        compile_error ( "error: function '%s' expects '%zu' arguments, but '%zu' were given",
+                        symbol->name, symbol->node->children[1]->n_children, n_arguments );
+    if ( use == ARRAY_INDEXING && symbol->type != SYMBOL_GLOBAL_ARRAY )
+        compile_error ( "error: symbol '%s' is not an array", symbol->name );
+    if ( use == IDENTIFIER_DATA && is_function )
+        compile_error ( "error: symbol '%s' is a function, not a variable", symbol->name );
+    if ( use == IDENTIFIER_DATA && symbol->type == SYMBOL_GLOBAL_ARRAY )
+        compile_error ( "error: symbol '%s' is an array, not a variable", symbol->name );
+}
+
+/* Moves the strings of every function into the global string list, in the order of the functions.
+ * Each STRING_DATA node is replaced by a STRING_LIST_REFERENCE node.
+ * This node's data is the string's position in the list casted to a void*
+ */
+static void add_function_strings ( void )
+{
+    for ( size_t i = 0; i < n_functions; i++ )
+    {
+        for ( size_t j = 0; j < function_strings[i].length; j++ )
+        {
+            node_t *node = function_strings[i].nodes[j];
+            size_t position = add_string ( node->slice );
+            node->type = STRING_LIST_REFERENCE;
+            node->data = (void*) position;
+        }
+    }
+}
+
+/* Frees the lists used while binding names */
+static void destroy_function_lists ( void )
+{
+    for ( size_t i = 0; function_strings != NULL && i < n_functions; i++ )
+        free ( function_strings[i].nodes );
+    free ( function_strings );
+    free ( functions );
+    function_strings = NULL;
+    functions = NULL;
+    n_functions = 0;
 }
 
 /* Prints the given symbol table, with sequence number, symbol names and types.
@@ -234,7 +492,7 @@ static void print_symbol_table ( symbol_table_t *table, int nesting )
     {
         symbol_t *symbol = table->symbols[i];
 
-        printf ( "%*s%ld: %s(%s)\n", nesting*4, "",
+        fprintf ( output_stream, "%*s%ld: %s(%s)\n", nesting*4, "",
                  symbol->sequence_number, SYMBOL_TYPE_NAMES[symbol->type], symbol->name );
 
         if ( symbol->type == SYMBOL_FUNCTION )
@@ -245,24 +503,29 @@ static void print_symbol_table ( symbol_table_t *table, int nesting )
 /* Frees up the memory used by the global symbol table, all local symbol tables, and their symbols */
 static void destroy_symbol_tables ( void )
 {
-    // First destory all local symbol tables, by looking for functions among the globals
+    if ( global_symbols == NULL )
+        return;
+
+    // First destory all local symbol tables, by looking for functions among the globals.
+    // With -stream, they are destroyed as soon as each function is generated, or never made for undeclared names
     for ( int i = 0; i < global_symbols->n_symbols; i++ )
     {
-        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION )
+        if ( global_symbols->symbols[i]->type == SYMBOL_FUNCTION && global_symbols->symbols[i]->function_symtable != NULL )
             symbol_table_destroy ( global_symbols->symbols[i]->function_symtable );
     }
     // Then destroy the global symbol table
     symbol_table_destroy ( global_symbols );
+    global_symbols = NULL;
 }
 
 /* Adds the given string to the global string list, resizing if needed.
- * Takes ownership of the string, and returns its position in the string list.
+ * The string's text stays in the source, and is not copied. Returns its position in the string list.
  */
-static size_t add_string ( char *string )
+static size_t add_string ( source_slice_t string )
 {
     if ( string_list_len + 1 >= string_list_capacity ) {
         string_list_capacity = string_list_capacity * 2 + 8;
-        string_list = realloc ( string_list, string_list_capacity * sizeof(char*) );
+        string_list = realloc ( string_list, string_list_capacity * sizeof(source_slice_t) );
     }
     string_list[string_list_len] = string;
     return string_list_len++;
@@ -272,13 +535,14 @@ static size_t add_string ( char *string )
 static void print_string_list ( void )
 {
     for ( size_t i = 0; i < string_list_len; i++ )
-        printf ( "%ld: %s\n", i, string_list[i] );
+        fprintf ( output_stream, "%ld: %.*s\n", i, (int) string_list[i].length, SLICE_TEXT ( string_list[i] ) );
 }
 
-/* Frees all strings in the global string list, and the string list itself */
+/* Frees the global string list. The strings themselves belong to the source */
 static void destroy_string_list ( void )
 {
-    for ( int i = 0; i < string_list_len; i++ )
-        free ( string_list[i] );
     free ( string_list );
+    string_list = NULL;
+    string_list_len = 0;
+    string_list_capacity = 0;
 }
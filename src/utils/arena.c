@@ -0,0 +1,115 @@
+#include "arena.h"
+
+#include <stdalign.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Most allocations share blocks of this size. Larger allocations get a block of their own
+#define ARENA_BLOCK_SIZE (256 * 1024)
+
+#define ALIGNMENT alignof(max_align_t)
+
+_Thread_local size_t arena_allocations;
+_Thread_local size_t arena_allocated_bytes;
+
+typedef struct arena_block
+{
+    struct arena_block *previous;
+    size_t size;
+    alignas(max_align_t) char data[];
+} arena_block_t;
+
+// Makes a new block with room for at least size bytes, and makes it the current block
+static void arena_grow ( arena_t *arena, size_t size )
+{
+    size_t block_size = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+    arena_block_t *block = malloc ( sizeof(arena_block_t) + block_size );
+
+    block->previous = arena->blocks;
+    block->size = block_size;
+    arena->blocks = block;
+    arena->position = block->data;
+    arena->end = block->data + block_size;
+}
+
+void* arena_alloc ( arena_t *arena, size_t size )
+{
+    if ( size == 0 )
+        return NULL;
+
+    // Round up, so that the next allocation is also aligned
+    size = ( size + ALIGNMENT - 1 ) & ~( ALIGNMENT - 1 );
+    if ( (size_t) ( arena->end - arena->position ) < size )
+        arena_grow ( arena, size );
+    arena_allocations++;
+    arena_allocated_bytes += size;
+
+    void *result = arena->position;
+    arena->position += size;
+    return result;
+}
+
+char* arena_strdup ( arena_t *arena, const char *string )
+{
+    size_t length = strlen ( string ) + 1;
+    char *result = arena_alloc ( arena, length );
+    memcpy ( result, string, length );
+    return result;
+}
+
+void arena_free_all ( arena_t *arena )
+{
+    arena_block_t *block = arena->blocks;
+    while ( block != NULL )
+    {
+        arena_block_t *previous = block->previous;
+        free ( block );
+        block = previous;
+    }
+    *arena = (arena_t) { 0 };
+}
+
+void arena_reset ( arena_t *arena )
+{
+    arena_block_t *block = arena->blocks;
+    while ( block != NULL && block->previous != NULL )
+    {
+        arena_block_t *previous = block->previous;
+        free ( block );
+        block = previous;
+    }
+
+    // Blocks made for one large allocation are not kept
+    if ( block != NULL && block->size > ARENA_BLOCK_SIZE )
+    {
+        free ( block );
+        block = NULL;
+    }
+    arena->blocks = block;
+    arena->position = block != NULL ? block->data : NULL;
+    arena->end = block != NULL ? block->data + block->size : NULL;
+}
+
+arena_mark_t arena_mark ( arena_t *arena )
+{
+    return (arena_mark_t) { .block = arena->blocks, .position = arena->position };
+}
+
+void arena_release ( arena_t *arena, arena_mark_t mark )
+{
+    if ( mark.block == NULL )
+    {
+        arena_reset ( arena );
+        return;
+    }
+
+    while ( arena->blocks != mark.block )
+    {
+        arena_block_t *previous = arena->blocks->previous;
+        free ( arena->blocks );
+        arena->blocks = previous;
+    }
+    arena->position = mark.position;
+    arena->end = mark.block->data + mark.block->size;
+}
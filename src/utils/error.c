@@ -0,0 +1,42 @@
+#include "error.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+_Thread_local error_handler_t *error_handler = NULL;
+
+_Noreturn void compile_error ( const char *format, ... )
+{
+    va_list arguments;
+    va_start ( arguments, format );
+
+    if ( error_handler == NULL )
+    {
+        vfprintf ( stderr, format, arguments );
+        fputc ( '\n', stderr );
+        va_end ( arguments );
+        exit ( EXIT_FAILURE );
+    }
+
+    size_t length;
+    FILE *message = open_memstream ( &error_handler->message, &length );
+    vfprintf ( message, format, arguments );
+    fclose ( message );
+    va_end ( arguments );
+
+    longjmp ( error_handler->jump, 1 );
+}
+
+_Noreturn void rethrow_error ( char *message )
+{
+    if ( error_handler == NULL )
+    {
+        fprintf ( stderr, "%s\n", message );
+        free ( message );
+        exit ( EXIT_FAILURE );
+    }
+
+    error_handler->message = message;
+    longjmp ( error_handler->jump, 1 );
+}
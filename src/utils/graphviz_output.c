@@ -1,37 +1,43 @@
 #include "vslc.h"
 
 static void graphviz_node_print_internal ( node_t *node ) {
-    printf ( "node%p [label=\"%s", node, node_strings[node->type] );
+    fprintf ( output_stream, "node%p [label=\"%s", node, node_strings[node->type] );
     if ( node->type == IDENTIFIER_DATA || node->type == STRING_DATA || node->type == EXPRESSION || node->type == RELATION ) {
-        printf ( "\\n" );
-        if ( node->data == NULL ) {
-            printf ( "NULL" );
+        fprintf ( output_stream, "\\n" );
+        const char *text = node->type == EXPRESSION || node->type == RELATION ? OPERATOR_NAMES[node->operator] : node->data;
+        size_t length = text == NULL ? 0 : strlen ( text );
+        if ( node->type == STRING_DATA ) {
+            text = SLICE_TEXT ( node->slice );
+            length = node->slice.length;
+        }
+        if ( text == NULL ) {
+            fprintf ( output_stream, "NULL" );
         } else {
-            for ( char* c = (char*)node->data; *c != '\0'; c++ ) {
+            for ( const char* c = text; c != text + length; c++ ) {
                 switch(*c) {
-                    case '\\': printf ( "\\\\" ); break;
-                    case '"': printf ( "\\\"" ); break;
-                    default: putchar ( *c ); break;
+                    case '\\': fprintf ( output_stream, "\\\\" ); break;
+                    case '"': fprintf ( output_stream, "\\\"" ); break;
+                    default: fputc ( *c, output_stream ); break;
                 }
             }
         }
     } else if ( node->type == NUMBER_DATA ) {
-        printf ( "\\n%ld", *(int64_t*)node->data );
+        fprintf ( output_stream, "\\n%ld", node->value );
     }
-    printf ( "\"];\n" );
+    fprintf ( output_stream, "\"];\n" );
     for ( int i = 0; i < node->n_children; i++ ) {
         node_t *child = node->children[i];
         if ( child == NULL )
-            printf ( "node%p -- node%pNULL%d ;\n", node, node, i );
+            fprintf ( output_stream, "node%p -- node%pNULL%d ;\n", node, node, i );
         else {
-            printf ( "node%p -- node%p ;\n", node, child );
+            fprintf ( output_stream, "node%p -- node%p ;\n", node, child );
             graphviz_node_print_internal(child);
         }
     }
 }
 
 void graphviz_node_print ( node_t *root ) {
-    printf ( "graph \"\" {\n node[shape=box];\n" );
+    fprintf ( output_stream, "graph \"\" {\n node[shape=box];\n" );
     graphviz_node_print_internal ( root );
-    printf( "}\n" );
+    fprintf( output_stream, "}\n" );
 }
@@ -0,0 +1,136 @@
+#include "intern.h"
+#include "arena.h"
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct interned_string
+{
+    uint64_t hash;
+    size_t length;
+    char text[];
+} interned_string_t;
+
+// The interned strings, and the hash set used to find them
+static _Thread_local arena_t intern_arena;
+static _Thread_local interned_string_t **table;
+static _Thread_local size_t table_capacity; // Always 0 or a power of two
+static _Thread_local size_t table_entries;
+
+// Finds the header in front of the text of an interned string
+static interned_string_t* header_of ( const char *interned )
+{
+    return (interned_string_t *) ( interned - offsetof ( interned_string_t, text ) );
+}
+
+// Mixes the bits of x, so that every input bit affects every output bit (the MurmurHash3 finalizer)
+static uint64_t mix ( uint64_t x )
+{
+    x ^= x >> 33;
+    x *= 0xff51afd7ed558ccd;
+    x ^= x >> 33;
+    x *= 0xc4ceb9fe1a85ec53;
+    x ^= x >> 33;
+    return x;
+}
+
+// Calculates a 64-bit hash of the text, 8 characters at a time.
+// All bits of the hash are well mixed, since hashmaps use both the lowest and the highest bits
+static uint64_t hash_text ( const char *text, size_t length )
+{
+    uint64_t hash = length * 0x9e3779b97f4a7c15;
+    size_t i = 0;
+    for ( ; i + 8 <= length; i += 8 )
+    {
+        uint64_t word;
+        memcpy ( &word, text + i, 8 );
+        hash = ( hash ^ mix ( word ) ) * 0x9e3779b97f4a7c15;
+    }
+    uint64_t rest = 0;
+    memcpy ( &rest, text + i, length - i );
+    return mix ( hash ^ rest );
+}
+
+// Doubles the size of the table, and inserts all entries again
+static void grow_table ( void )
+{
+    size_t old_capacity = table_capacity;
+    interned_string_t **old_table = table;
+
+    table_capacity = table_capacity > 0 ? table_capacity * 2 : 1024;
+    table = calloc ( table_capacity, sizeof(interned_string_t*) );
+
+    for ( size_t i = 0; i < old_capacity; i++ )
+    {
+        if ( old_table[i] == NULL )
+            continue;
+        size_t bucket = old_table[i]->hash & ( table_capacity - 1 );
+        while ( table[bucket] != NULL )
+            bucket = ( bucket + 1 ) & ( table_capacity - 1 );
+        table[bucket] = old_table[i];
+    }
+    free ( old_table );
+}
+
+char* intern ( const char *text, size_t length )
+{
+    // Keep the fill ratio of the table at most 1/2
+    if ( ( table_entries + 1 ) * 2 > table_capacity )
+        grow_table ( );
+
+    uint64_t hash = hash_text ( text, length );
+    size_t bucket = hash & ( table_capacity - 1 );
+    while ( table[bucket] != NULL )
+    {
+        interned_string_t *entry = table[bucket];
+        if ( entry->hash == hash && entry->length == length && memcmp ( entry->text, text, length ) == 0 )
+            return entry->text;
+        bucket = ( bucket + 1 ) & ( table_capacity - 1 );
+    }
+
+    interned_string_t *entry = arena_alloc ( &intern_arena, sizeof(interned_string_t) + length + 1 );
+    entry->hash = hash;
+    entry->length = length;
+    memcpy ( entry->text, text, length );
+    entry->text[length] = '\0';
+
+    table[bucket] = entry;
+    table_entries++;
+    return entry->text;
+}
+
+uint64_t interned_hash ( const char *interned )
+{
+    return header_of ( interned )->hash;
+}
+
+size_t interned_length ( const char *interned )
+{
+    return header_of ( interned )->length;
+}
+
+// A larger table is freed by reset_interned_strings, rather than cleared and kept
+#define MAX_KEPT_TABLE_CAPACITY 65536
+
+void destroy_interned_strings ( void )
+{
+    arena_free_all ( &intern_arena );
+    free ( table );
+    table = NULL;
+    table_capacity = 0;
+    table_entries = 0;
+}
+
+void reset_interned_strings ( void )
+{
+    if ( table_capacity > MAX_KEPT_TABLE_CAPACITY )
+    {
+        destroy_interned_strings ( );
+        return;
+    }
+    arena_reset ( &intern_arena );
+    if ( table != NULL )
+        memset ( table, 0, table_capacity * sizeof(interned_string_t*) );
+    table_entries = 0;
+}
@@ -0,0 +1,90 @@
+#include "parallel.h"
+#include "error.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+
+// What the threads of one run_in_parallel call share
+typedef struct
+{
+    const parallel_tasks_t *tasks;
+    atomic_size_t next_task; // The next task no thread has started on
+    atomic_bool failed;      // Set when a task fails, so that no more tasks are started
+} shared_t;
+
+typedef struct
+{
+    pthread_t thread;
+    int number;
+    shared_t *shared;
+    error_handler_t handler;
+    size_t failed_task; // The task that failed on this thread, or n_tasks
+} worker_t;
+
+static void *run_tasks ( void *argument )
+{
+    worker_t *worker = argument;
+    shared_t *shared = worker->shared;
+    const parallel_tasks_t *tasks = shared->tasks;
+
+    if ( tasks->start_thread != NULL )
+        tasks->start_thread ( tasks->context, worker->number );
+
+    error_handler = &worker->handler;
+    while ( !atomic_load ( &shared->failed ) )
+    {
+        size_t task = atomic_fetch_add ( &shared->next_task, 1 );
+        if ( task >= tasks->n_tasks )
+            break;
+
+        if ( setjmp ( worker->handler.jump ) != 0 )
+        {
+            worker->failed_task = task;
+            atomic_store ( &shared->failed, true );
+            break;
+        }
+        tasks->run_task ( tasks->context, worker->number, task );
+    }
+    error_handler = NULL;
+
+    if ( tasks->stop_thread != NULL )
+        tasks->stop_thread ( tasks->context, worker->number );
+    return NULL;
+}
+
+bool run_in_parallel ( const parallel_tasks_t *tasks, int n_threads, size_t *failed_task, char **error )
+{
+    shared_t shared = { .tasks = tasks };
+    if ( n_threads > tasks->n_tasks )
+        n_threads = tasks->n_tasks;
+
+    worker_t *workers = calloc ( n_threads, sizeof(worker_t) );
+    int n_started = 0;
+    for ( ; n_started < n_threads; n_started++ )
+    {
+        worker_t *worker = &workers[n_started];
+        *worker = (worker_t) { .number = n_started, .shared = &shared, .failed_task = tasks->n_tasks };
+        if ( pthread_create ( &worker->thread, NULL, run_tasks, worker ) != 0 )
+            break;
+    }
+
+    // Several tasks may fail before the others notice. Only the first one is reported
+    *failed_task = tasks->n_tasks;
+    *error = NULL;
+    for ( int i = 0; i < n_started; i++ )
+    {
+        pthread_join ( workers[i].thread, NULL );
+        if ( workers[i].failed_task < *failed_task )
+        {
+            free ( *error );
+            *failed_task = workers[i].failed_task;
+            *error = workers[i].handler.message;
+        }
+        else
+            free ( workers[i].handler.message );
+    }
+
+    free ( workers );
+    return n_started > 0;
+}
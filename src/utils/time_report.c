@@ -0,0 +1,238 @@
+#include "time_report.h"
+#include "vslc.h"
+
+#include <sys/resource.h>
+#include <time.h>
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+#define MAX(a, b) ( (a) > (b) ? (a) : (b) )
+
+static const char *PHASE_NAMES[_PHASE_COUNT] = {
+    [PHASE_NONE] = "none",
+    [PHASE_PARSE] = "parse",
+    [PHASE_SIMPLIFY] = "simplify",
+    [PHASE_BIND] = "bind",
+    [PHASE_RANGES] = "ranges",
+    [PHASE_DEAD_CODE] = "dead-code",
+    [PHASE_PROFILE] = "profile",
+    [PHASE_GENERATE] = "generate",
+};
+
+_Thread_local size_t created_nodes[_NODE_COUNT];
+
+// Where the counters were when the current phase started, or what a phase added up to
+typedef struct
+{
+    double wall;       // In seconds
+    double cpu;
+    size_t allocations;
+    size_t allocated_bytes;
+    long long heap_bytes;
+    long peak_rss_kb;
+} measurement_t;
+
+static _Thread_local bool measuring;
+static _Thread_local phase_t current_phase;
+static _Thread_local measurement_t phase_start;
+static _Thread_local measurement_t phases[_PHASE_COUNT];
+static _Thread_local bool phase_ran[_PHASE_COUNT];
+
+// The symbols of the functions counted by time_report_count_function
+static _Thread_local size_t n_function_tables, n_function_symbols, max_function_symbols;
+
+static double seconds ( clockid_t clock )
+{
+    struct timespec now;
+    clock_gettime ( clock, &now );
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* The bytes in use on the heap, or 0 if the C library can't tell */
+static long long heap_in_use ( void )
+{
+#if defined(__GLIBC__) && ( __GLIBC__ > 2 || __GLIBC_MINOR__ >= 33 )
+    struct mallinfo2 info = mallinfo2 ( );
+    return (long long) ( info.uordblks + info.hblkhd );
+#else
+    return 0;
+#endif
+}
+
+static long peak_rss_kb ( void )
+{
+    struct rusage usage;
+    getrusage ( RUSAGE_SELF, &usage );
+#ifdef __APPLE__
+    return usage.ru_maxrss / 1024; // In bytes on macOS, and in KB elsewhere
+#else
+    return usage.ru_maxrss;
+#endif
+}
+
+static measurement_t measure ( void )
+{
+    return (measurement_t) {
+        .wall = seconds ( CLOCK_MONOTONIC ),
+        .cpu = seconds ( CLOCK_PROCESS_CPUTIME_ID ),
+        .allocations = arena_allocations,
+        .allocated_bytes = arena_allocated_bytes,
+        .heap_bytes = heap_in_use ( ),
+        .peak_rss_kb = peak_rss_kb ( ),
+    };
+}
+
+void time_report_start ( bool enabled )
+{
+    measuring = enabled;
+    if ( !enabled )
+        return;
+    memset ( created_nodes, 0, sizeof(created_nodes) );
+    memset ( phases, 0, sizeof(phases) );
+    memset ( phase_ran, 0, sizeof(phase_ran) );
+    n_function_tables = n_function_symbols = max_function_symbols = 0;
+    current_phase = PHASE_NONE;
+    phase_start = measure ( );
+}
+
+phase_t time_report_phase ( phase_t phase )
+{
+    phase_t previous = current_phase;
+    if ( !measuring || phase == previous )
+        return previous;
+
+    measurement_t now = measure ( );
+    measurement_t *total = &phases[previous];
+    total->wall += now.wall - phase_start.wall;
+    total->cpu += now.cpu - phase_start.cpu;
+    total->allocations += now.allocations - phase_start.allocations;
+    total->allocated_bytes += now.allocated_bytes - phase_start.allocated_bytes;
+    total->heap_bytes += now.heap_bytes - phase_start.heap_bytes;
+    total->peak_rss_kb = MAX ( total->peak_rss_kb, now.peak_rss_kb );
+    phase_ran[previous] = true;
+
+    current_phase = phase;
+    phase_start = now;
+    return previous;
+}
+
+void time_report_count_function ( const symbol_table_t *function_symtable )
+{
+    if ( !measuring )
+        return;
+    n_function_tables++;
+    n_function_symbols += function_symtable->n_symbols;
+    max_function_symbols = MAX ( max_function_symbols, function_symtable->n_symbols );
+}
+
+/* Prints the string as a JSON string, with quotes */
+static void print_json_string ( FILE *stream, const char *string )
+{
+    fputc ( '"', stream );
+    for ( const char *c = string; *c != '\0'; c++ )
+    {
+        if ( *c == '"' || *c == '\\' )
+            fprintf ( stream, "\\%c", *c );
+        else if ( (unsigned char) *c < 0x20 )
+            fprintf ( stream, "\\u%04x", *c );
+        else
+            fputc ( *c, stream );
+    }
+    fputc ( '"', stream );
+}
+
+static void print_json_measurement ( FILE *stream, const measurement_t *m )
+{
+    fprintf ( stream, "\"wall_ms\": %.3f, \"cpu_ms\": %.3f, \"allocations\": %zu, \"allocated_bytes\": %zu, "
+              "\"heap_change_bytes\": %lld, \"peak_rss_kb\": %ld",
+              m->wall * 1e3, m->cpu * 1e3, m->allocations, m->allocated_bytes, m->heap_bytes, m->peak_rss_kb );
+}
+
+static void print_text_measurement ( FILE *stream, const char *name, const measurement_t *m )
+{
+    fprintf ( stream, "  %-10s %10.3f %10.3f %12zu %13zu %+15lld %12ld\n", name, m->wall * 1e3, m->cpu * 1e3,
+              m->allocations, m->allocated_bytes / 1024, m->heap_bytes / 1024, m->peak_rss_kb );
+}
+
+void time_report_print ( const char *path, bool json )
+{
+    time_report_phase ( PHASE_NONE );
+
+    measurement_t total = { 0 };
+    for ( phase_t phase = PHASE_PARSE; phase < _PHASE_COUNT; phase++ )
+    {
+        total.wall += phases[phase].wall;
+        total.cpu += phases[phase].cpu;
+        total.allocations += phases[phase].allocations;
+        total.allocated_bytes += phases[phase].allocated_bytes;
+        total.heap_bytes += phases[phase].heap_bytes;
+        total.peak_rss_kb = MAX ( total.peak_rss_kb, phases[phase].peak_rss_kb );
+    }
+
+    size_t n_nodes = 0;
+    for ( node_type_t type = 0; type < _NODE_COUNT; type++ )
+        n_nodes += created_nodes[type];
+
+    // The functions that are still in the tables. With -stream they have been counted already
+    size_t n_globals = global_symbols != NULL ? global_symbols->n_symbols : 0;
+    for ( size_t i = 0; i < n_globals; i++ )
+        if ( global_symbols->symbols[i]->function_symtable != NULL )
+            time_report_count_function ( global_symbols->symbols[i]->function_symtable );
+    measuring = false;
+
+    size_t string_bytes = 0;
+    for ( size_t i = 0; i < string_list_len; i++ )
+        string_bytes += string_list[i].length;
+
+    FILE *stream = report_stream;
+    if ( json )
+    {
+        fprintf ( stream, "{\"compiler\": \"%s\", \"file\": ", VSLC_BUILD_ID );
+        if ( path != NULL )
+            print_json_string ( stream, path );
+        else
+            fputs ( "null", stream );
+
+        fputs ( ", \"phases\": [", stream );
+        bool first = true;
+        for ( phase_t phase = PHASE_PARSE; phase < _PHASE_COUNT; phase++ )
+        {
+            if ( !phase_ran[phase] )
+                continue;
+            fprintf ( stream, "%s{\"name\": \"%s\", ", first ? "" : ", ", PHASE_NAMES[phase] );
+            print_json_measurement ( stream, &phases[phase] );
+            fputc ( '}', stream );
+            first = false;
+        }
+        fputs ( "], \"total\": {", stream );
+        print_json_measurement ( stream, &total );
+
+        fprintf ( stream, "}, \"nodes\": {\"total\": %zu", n_nodes );
+        for ( node_type_t type = 0; type < _NODE_COUNT; type++ )
+            if ( created_nodes[type] > 0 )
+                fprintf ( stream, ", \"%s\": %zu", node_strings[type], created_nodes[type] );
+
+        fprintf ( stream, "}, \"symbols\": {\"global\": %zu, \"function_tables\": %zu, \"function_symbols\": %zu, "
+                  "\"max_function_symbols\": %zu}, \"strings\": {\"count\": %zu, \"bytes\": %zu}}\n",
+                  n_globals, n_function_tables, n_function_symbols, max_function_symbols,
+                  string_list_len, string_bytes );
+        return;
+    }
+
+    fprintf ( stream, "Time report%s%s\n", path != NULL ? " for " : "", path != NULL ? path : "" );
+    fprintf ( stream, "  %-10s %10s %10s %12s %13s %15s %12s\n", "phase", "wall ms", "CPU ms", "allocations",
+              "allocated KB", "heap change KB", "peak RSS KB" );
+    for ( phase_t phase = PHASE_PARSE; phase < _PHASE_COUNT; phase++ )
+        if ( phase_ran[phase] )
+            print_text_measurement ( stream, PHASE_NAMES[phase], &phases[phase] );
+    print_text_measurement ( stream, "total", &total );
+
+    fprintf ( stream, "Nodes created: %zu\n", n_nodes );
+    for ( node_type_t type = 0; type < _NODE_COUNT; type++ )
+        if ( created_nodes[type] > 0 )
+            fprintf ( stream, "  %-24s %10zu\n", node_strings[type], created_nodes[type] );
+    fprintf ( stream, "Symbols: %zu global, %zu in %zu function tables, at most %zu in one\n",
+              n_globals, n_function_symbols, n_function_tables, max_function_symbols );
+    fprintf ( stream, "Strings: %zu in the string list, %zu bytes\n", string_list_len, string_bytes );
+}
@@ -1,60 +1,131 @@
+// realpath is an XSI extension to POSIX
+#define _DEFAULT_SOURCE
 #include "vslc.h"
+#include "libvslc.h"
+#include "parallel.h"
+#include "server.h"
+// The tokens defined in parser.y
+#include "parser.h"
 
+#include <errno.h>
 #include <getopt.h>
+#include <time.h>
+#include <unistd.h>
 
 /* Command line option parsing for the main function */
 static void options ( int argc, char **argv );
-static bool
-    print_full_tree = false,
-    print_tree_after_simplify = false,
-    print_symbol_table_contents = false,
-    print_generated_program = false;
+static void dump_tokens ( void );
+static int compile_files ( void );
+static char **input_paths = NULL;
+static int n_input_paths = 0;
+static const char *input_path = NULL; // The only input file, or NULL when reading from stdin
+static bool dump_tokens_only = false;
+static const char *server_socket = NULL; // Set by --server
+static const char *client_socket = NULL; // Set by --client
+static vslc_options_t compile_options = { 0 };
 
-/* Entry point */
+/* Entry point. The compiler itself is in libvslc.c */
 int main ( int argc, char **argv )
 {
     options ( argc, argv );
 
-    yyparse ();       // Generated from grammar/bison, constructs syntax tree
-    yylex_destroy (); // Free buffers used by flex
-
-    // Operations in tree.c
-    if ( print_full_tree )
-        print_syntax_tree ();
+    if ( server_socket != NULL )
+    {
+        // Each request may ask for threads of its own, so -j is the number of requests served at a time
+        int workers = compile_options.jobs > 0 ? compile_options.jobs : (int) sysconf ( _SC_NPROCESSORS_ONLN );
+        return run_server ( server_socket, workers > 0 ? workers : 1, &compile_options );
+    }
+    if ( client_socket != NULL )
+        return run_client ( client_socket, input_path, &compile_options );
 
-    simplify_tree ();
-    if ( print_tree_after_simplify )
-        print_syntax_tree ();
+    if ( n_input_paths > 1 )
+        return compile_files ( );
 
-    // Operations in symbols.c
-    create_tables ();
-    if ( print_symbol_table_contents )
-        print_tables ();
+    if ( dump_tokens_only )
+    {
+        source_open ( input_path );
+        dump_tokens ();
+        source_close ();
+        return EXIT_SUCCESS;
+    }
 
-    // Operations in generator.c
-    if ( print_generated_program )
-        generate_program ();
+    // The output is printed as it is made, including whatever was output before an error
+    vslc_context_t *context = vslc_context_create ( &compile_options );
+    bool success = vslc_compile_file_to ( context, input_path, stdout );
+    fputs ( vslc_reports ( context ), stderr );
+    if ( !success )
+        fprintf ( stderr, "%s\n", vslc_error ( context ) );
 
-    destroy_tables ();          // In symbols.c
-    destroy_syntax_tree ();     // In tree.c
+    vslc_context_destroy ( context );
+    return success ? EXIT_SUCCESS : EXIT_FAILURE;
 }
 
 static const char *usage =
-"Usage vslc [OPTION...]\n"
+"Usage vslc [OPTION...] [FILE...]\n"
 "\n"
-"Input is read from stdin, output is printed to stdout.\n"
+"Input is read from FILE, or from stdin if no file is given. Output is printed to stdout.\n"
+"When several files are given, they are compiled at the same time, and the output of each is written\n"
+"to a file with its extension replaced by .s, or by .txt without -c. Then a summary of the times is printed on stderr.\n"
+"Nothing is compiled if an output would overwrite an input, or the output of another file.\n"
 "\n"
 "\t-h\tOutput this text and halt\n\n"
 "\t-t\tOutput the abstract syntax tree\n"
 "\t-T\tOutput the abstract syntax tree after simplification\n"
 "\t-s\tOutput the symbol table contents\n"
-"\t-c\tCompile and generate assembly output\n";
+"\t-c\tCompile and generate assembly output\n"
+"\t-p\tWith -c, make a program that counts the calls and rdtsc cycles of each function, and the calls between them.\n"
+"\t\tAt exit it writes them to $VSLC_PROFILE, or vslc.prof (Linux only)\n"
+"\t\tIt also counts how often each if statement takes its then-block, and how often each loop iterates\n"
+"\t-fprofile-use[=FILE]\tOptimize for the profile in FILE, vslc.prof by default, written by the program\n"
+"\t\tcompiled with -p: lay out branches and loops for the common case, unroll hot loops, inline small hot\n"
+"\t\tfunctions, and group the hot functions and the ones that never ran\n"
+"\t-nostdlib\tGenerate a program with its own runtime, that doesn't use libc (Linux only).\n"
+"\t\tLink it with 'gcc -nostdlib -static'\n"
+"\t--no-main\tCompile a module without main, whose functions are global symbols that other programs\n"
+"\t\tcan call after declaring them with 'extern func'. Link it with the main program\n"
+"\t-report-dead\tList the unused functions, globals and strings that are removed, on stderr\n"
+"\t-stream\tWith -c, generate each function as soon as it is parsed, and free it, so that the memory used\n"
+"\t\tdepends on the largest function instead of the whole program. Leaves out range analysis,\n"
+"\t\tthe folding of calls and the removal of dead code, which need the whole program\n"
+"\t-j N\tBind the names in functions and generate them on N threads. The output is the same as with one.\n"
+"\t\tWith several files, compile N files at a time instead\n"
+"\t-cache DIR\tReuse the code of functions that haven't changed since they were compiled with the same DIR\n"
+"\t-cache-size MB\tThe size limit of the cache directory, 256 MB by default\n"
+"\t-cache-stats\tPrint how many functions were found in the cache on stderr\n"
+"\t-ftime-report[=json]\tPrint the time, allocations and peak memory of each phase, and the number of nodes,\n"
+"\t\tsymbols and strings made, on stderr. As one line of JSON for each file with =json\n"
+"\t-dump-tokens\tOutput the line number, type and text of every token, and halt\n"
+"\t--server SOCKET\tKeep compiling on the Unix domain socket until interrupted, -j N requests at a time,\n"
+"\t\tone for each CPU by default. The -cache options apply to every request\n"
+"\t--client SOCKET\tHave the server on the socket compile FILE or stdin. The output is the same as without it\n";
+
+// Options that only have a long name get values outside the range of characters
+enum { OPTION_NOSTDLIB = 256, OPTION_REPORT_DEAD, OPTION_DUMP_TOKENS, OPTION_NO_MAIN,
+       OPTION_CACHE, OPTION_CACHE_SIZE, OPTION_CACHE_STATS, OPTION_SERVER, OPTION_CLIENT, OPTION_STREAM,
+       OPTION_TIME_REPORT, OPTION_PROFILE_USE };
+
+static const struct option long_options[] = {
+    { "nostdlib", no_argument, NULL, OPTION_NOSTDLIB },
+    { "report-dead", no_argument, NULL, OPTION_REPORT_DEAD },
+    { "dump-tokens", no_argument, NULL, OPTION_DUMP_TOKENS },
+    { "no-main", no_argument, NULL, OPTION_NO_MAIN },
+    { "stream", no_argument, NULL, OPTION_STREAM },
+    { "cache", required_argument, NULL, OPTION_CACHE },
+    { "cache-size", required_argument, NULL, OPTION_CACHE_SIZE },
+    { "cache-stats", no_argument, NULL, OPTION_CACHE_STATS },
+    { "server", required_argument, NULL, OPTION_SERVER },
+    { "client", required_argument, NULL, OPTION_CLIENT },
+    { "ftime-report", optional_argument, NULL, OPTION_TIME_REPORT },
+    { "fprofile-use", optional_argument, NULL, OPTION_PROFILE_USE },
+    { 0 }
+};
 
 
 static void options ( int argc, char **argv )
 {
     int o;
-    while ( (o=getopt(argc,argv,"htTsc")) != -1 )
+    // Long options may be given with a single dash, like -nostdlib
+    while ( (o=getopt_long_only(argc,argv,"htTscpj:",long_options,NULL)) != -1 )
     {
         switch ( o )
         {
@@ -64,16 +135,314 @@ static void options ( int argc, char **argv )
                 printf ( "%s", usage );
                 exit ( EXIT_SUCCESS );
                 break;
-            case 't':   print_full_tree = true;             break;
-            case 'T':   print_tree_after_simplify  = true;  break;
-            case 's':   print_symbol_table_contents = true; break;
-            case 'c':   print_generated_program = true;     break;
+            case 't':   compile_options.print_full_tree = true;             break;
+            case 'T':   compile_options.print_tree_after_simplify  = true;  break;
+            case 's':   compile_options.print_symbol_table_contents = true; break;
+            case 'c':   compile_options.generate_program = true;            break;
+            case 'p':
+#ifdef __APPLE__
+                fprintf ( stderr, "%s: -p is not supported on macOS\n", argv[0] );
+                exit ( EXIT_FAILURE );
+#endif
+                compile_options.profile = true;
+                break;
+            case OPTION_NOSTDLIB:
+#ifdef __APPLE__
+                fprintf ( stderr, "%s: -nostdlib is not supported on macOS\n", argv[0] );
+                exit ( EXIT_FAILURE );
+#endif
+                compile_options.use_freestanding_runtime = true;
+                break;
+            case 'j':
+                compile_options.jobs = atoi ( optarg );
+                if ( compile_options.jobs < 1 )
+                {
+                    fprintf ( stderr, "%s: -j expects a positive number of threads, not '%s'\n", argv[0], optarg );
+                    exit ( EXIT_FAILURE );
+                }
+                break;
+            case OPTION_REPORT_DEAD: compile_options.report_dead_code = true; break;
+            case OPTION_DUMP_TOKENS: dump_tokens_only = true; break;
+            case OPTION_NO_MAIN: compile_options.no_main = true; break;
+            case OPTION_STREAM: compile_options.stream = true; break;
+            case OPTION_CACHE: compile_options.cache_directory = optarg; break;
+            case OPTION_CACHE_SIZE:
+                if ( atoi ( optarg ) < 1 )
+                {
+                    fprintf ( stderr, "%s: -cache-size expects a positive number of megabytes, not '%s'\n", argv[0], optarg );
+                    exit ( EXIT_FAILURE );
+                }
+                compile_options.cache_max_size = (size_t) atoi ( optarg ) << 20;
+                break;
+            case OPTION_CACHE_STATS: compile_options.report_cache_stats = true; break;
+            case OPTION_SERVER: server_socket = optarg; break;
+            case OPTION_CLIENT: client_socket = optarg; break;
+            case OPTION_TIME_REPORT:
+                if ( optarg != NULL && strcmp ( optarg, "json" ) != 0 )
+                {
+                    fprintf ( stderr, "%s: -ftime-report expects no format, or =json, not '%s'\n", argv[0], optarg );
+                    exit ( EXIT_FAILURE );
+                }
+                compile_options.time_report = optarg != NULL ? VSLC_TIME_REPORT_JSON : VSLC_TIME_REPORT_TEXT;
+                break;
+            case OPTION_PROFILE_USE: compile_options.profile_path = optarg != NULL ? optarg : "vslc.prof"; break;
         }
     }
 
-    if ( optind != argc )
+    input_paths = &argv[optind];
+    n_input_paths = argc - optind;
+    if ( n_input_paths == 1 )
+        input_path = input_paths[0];
+
+    if ( n_input_paths > 1 && dump_tokens_only )
+    {
+        fprintf ( stderr, "%s: -dump-tokens takes at most one file\n", argv[0] );
+        exit ( EXIT_FAILURE );
+    }
+
+    if ( server_socket != NULL && ( client_socket != NULL || n_input_paths > 0 || dump_tokens_only ) )
+    {
+        fprintf ( stderr, "%s: --server takes no files, and can't be combined with --client or -dump-tokens\n", argv[0] );
+        exit ( EXIT_FAILURE );
+    }
+    if ( client_socket != NULL && ( n_input_paths > 1 || dump_tokens_only ) )
+    {
+        fprintf ( stderr, "%s: --client takes at most one file, and can't be combined with -dump-tokens\n", argv[0] );
+        exit ( EXIT_FAILURE );
+    }
+    if ( client_socket != NULL && compile_options.cache_directory != NULL )
+    {
+        fprintf ( stderr, "%s: the -cache options of --client are given to --server instead\n", argv[0] );
+        exit ( EXIT_FAILURE );
+    }
+    // The profile belongs to one program, and the server would read it relative to its own directory
+    if ( ( client_socket != NULL || server_socket != NULL ) && compile_options.profile_path != NULL )
     {
-        fprintf ( stderr, "%s: invalid positional argument '%s'\n", argv[0], argv[optind] );
+        fprintf ( stderr, "%s: -fprofile-use can't be combined with --client or --server\n", argv[0] );
         exit ( EXIT_FAILURE );
     }
 }
+
+/* ==================== Compiling several files ==================== */
+
+// What happened to one of the files
+typedef struct
+{
+    const char *path;
+    char *output_path;
+    char *error; // NULL if the file was compiled and written
+    double seconds;
+} file_result_t;
+
+static file_result_t *file_results;
+static vslc_options_t file_options; // Each file is compiled on a single thread
+
+static double seconds_now ( void )
+{
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Returns the path with its extension replaced, allocated with malloc */
+static char *output_path_for ( const char *path )
+{
+    const char *extension = compile_options.generate_program ? ".s" : ".txt";
+    const char *dot = strrchr ( path, '.' );
+    const char *slash = strrchr ( path, '/' );
+    size_t stem_length = ( dot != NULL && ( slash == NULL || dot > slash ) ) ? dot - path : strlen ( path );
+
+    char *output_path = malloc ( stem_length + strlen ( extension ) + 1 );
+    memcpy ( output_path, path, stem_length );
+    strcpy ( output_path + stem_length, extension );
+    return output_path;
+}
+
+/* Returns the path with its directory resolved, so that different ways of naming a file compare equal.
+ * The file itself doesn't have to exist. Allocated with malloc */
+static char *resolved_path ( const char *path )
+{
+    const char *slash = strrchr ( path, '/' );
+    char *directory = slash == NULL ? strdup ( "." ) : strndup ( path, slash - path + 1 );
+    char *resolved_directory = realpath ( directory, NULL );
+    free ( directory );
+    if ( resolved_directory == NULL )
+        return strdup ( path );
+
+    const char *name = slash == NULL ? path : slash + 1;
+    char *resolved = malloc ( strlen ( resolved_directory ) + strlen ( name ) + 2 );
+    sprintf ( resolved, "%s/%s", resolved_directory, name );
+    free ( resolved_directory );
+    return resolved;
+}
+
+/* Prints an error and returns false if any output file would overwrite an input file, or the output of another file.
+ * Files compiled at the same time would race on a shared output */
+static bool check_output_paths ( void )
+{
+    char **inputs = malloc ( n_input_paths * sizeof(char *) );
+    char **outputs = malloc ( n_input_paths * sizeof(char *) );
+    for ( int i = 0; i < n_input_paths; i++ )
+    {
+        inputs[i] = resolved_path ( input_paths[i] );
+        outputs[i] = resolved_path ( file_results[i].output_path );
+    }
+
+    bool unique = true;
+    for ( int i = 0; i < n_input_paths; i++ )
+        for ( int j = 0; j < n_input_paths; j++ )
+        {
+            if ( strcmp ( outputs[i], inputs[j] ) == 0 )
+            {
+                fprintf ( stderr, "error: the output of '%s' would overwrite the input '%s'\n", input_paths[i], input_paths[j] );
+                unique = false;
+            }
+            if ( j < i && strcmp ( outputs[i], outputs[j] ) == 0 )
+            {
+                fprintf ( stderr, "error: '%s' and '%s' would both be written to '%s'\n",
+                          input_paths[j], input_paths[i], file_results[i].output_path );
+                unique = false;
+            }
+        }
+
+    for ( int i = 0; i < n_input_paths; i++ )
+    {
+        free ( inputs[i] );
+        free ( outputs[i] );
+    }
+    free ( inputs );
+    free ( outputs );
+    return unique;
+}
+
+/* Returns a message for failing to write the output, allocated with malloc */
+static char *write_error ( const char *path )
+{
+    char *message;
+    size_t length;
+    FILE *stream = open_memstream ( &message, &length );
+    fprintf ( stream, "error: could not write '%s': %s", path, strerror ( errno ) );
+    fclose ( stream );
+    return message;
+}
+
+/* Compiles one file with a context of its own, and writes its output file if it succeeds */
+static void compile_file_task ( void *context, int thread, size_t task )
+{
+    file_result_t *result = &file_results[task];
+    double start = seconds_now ( );
+
+    vslc_context_t *compilation = vslc_context_create ( &file_options );
+    vslc_buffer_t output;
+    if ( vslc_compile_file ( compilation, result->path, &output ) )
+    {
+        FILE *file = fopen ( result->output_path, "w" );
+        if ( file == NULL )
+            result->error = write_error ( result->output_path );
+        else
+        {
+            size_t written = fwrite ( output.data, 1, output.length, file );
+            if ( fclose ( file ) != 0 || written != output.length )
+                result->error = write_error ( result->output_path );
+        }
+    }
+    else
+        result->error = strdup ( vslc_error ( compilation ) );
+    fputs ( vslc_reports ( compilation ), stderr );
+    vslc_context_destroy ( compilation );
+
+    result->seconds = seconds_now ( ) - start;
+}
+
+/* Compiles every input file, -j files at a time, and prints how long each of them took */
+static int compile_files ( void )
+{
+    int jobs = compile_options.jobs > 1 ? compile_options.jobs : 1;
+    if ( jobs > n_input_paths )
+        jobs = n_input_paths;
+    file_options = compile_options;
+    file_options.jobs = 1;
+
+    file_results = calloc ( n_input_paths, sizeof(file_result_t) );
+    for ( int i = 0; i < n_input_paths; i++ )
+        file_results[i] = (file_result_t) { .path = input_paths[i], .output_path = output_path_for ( input_paths[i] ) };
+    if ( !check_output_paths ( ) )
+    {
+        for ( int i = 0; i < n_input_paths; i++ )
+            free ( file_results[i].output_path );
+        free ( file_results );
+        return EXIT_FAILURE;
+    }
+
+    double start = seconds_now ( );
+    parallel_tasks_t tasks = { .n_tasks = n_input_paths, .run_task = compile_file_task };
+    size_t failed_task;
+    char *error;
+    if ( !run_in_parallel ( &tasks, jobs, &failed_task, &error ) )
+    {
+        jobs = 1;
+        for ( size_t i = 0; i < n_input_paths; i++ )
+            compile_file_task ( NULL, 0, i );
+    }
+    double total_seconds = seconds_now ( ) - start;
+
+    int n_failed = 0;
+    for ( int i = 0; i < n_input_paths; i++ )
+    {
+        file_result_t *result = &file_results[i];
+        if ( result->error == NULL )
+            fprintf ( stderr, "%10.3f ms  %s -> %s\n", result->seconds * 1e3, result->path, result->output_path );
+        else
+        {
+            fprintf ( stderr, "%10.3f ms  %s: %s\n", result->seconds * 1e3, result->path, result->error );
+            n_failed++;
+        }
+        free ( result->error );
+        free ( result->output_path );
+    }
+    fprintf ( stderr, "%10.3f ms  in total for %d files on %d thread%s, %d failed\n",
+              total_seconds * 1e3, n_input_paths, jobs, jobs == 1 ? "" : "s", n_failed );
+
+    free ( file_results );
+    return n_failed == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
+/* Returns the name of the token type. Single character tokens are named by their character */
+static const char* token_name ( int token )
+{
+    switch ( token )
+    {
+        case FUNC: return "FUNC";
+        case EXTERN: return "EXTERN";
+        case PRINT: return "PRINT";
+        case RETURN: return "RETURN";
+        case BREAK: return "BREAK";
+        case IF: return "IF";
+        case THEN: return "THEN";
+        case ELSE: return "ELSE";
+        case WHILE: return "WHILE";
+        case DO: return "DO";
+        case VAR: return "VAR";
+        case OPENBLOCK: return "OPENBLOCK";
+        case CLOSEBLOCK: return "CLOSEBLOCK";
+        case NUMBER: return "NUMBER";
+        case IDENTIFIER: return "IDENTIFIER";
+        case STRING: return "STRING";
+    }
+    static char character[4];
+    snprintf ( character, sizeof(character), "'%c'", token );
+    return character;
+}
+
+/* Prints every token in the input on its own line, so that the output of different scanners can be compared */
+static void dump_tokens ( void )
+{
+    yyscan_t scanner;
+    yylex_init ( &scanner );
+    YYSTYPE value;
+    int token;
+    while ( ( token = yylex ( &value, scanner ) ) != 0 )
+        printf ( "%d %s %.*s\n", yyget_lineno ( scanner ), token_name ( token ),
+                 (int) token_slice.length, SLICE_TEXT ( token_slice ) );
+    yylex_destroy ( scanner );
+}
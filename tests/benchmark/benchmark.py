@@ -0,0 +1,133 @@
+#!/usr/bin/env python3
+
+import sys
+import os
+import json
+import argparse
+import subprocess
+
+from generate import generate
+
+DIRECTORY = os.path.dirname(os.path.abspath(__file__))
+BASELINE_FILE = os.path.join(DIRECTORY, "baseline.json")
+GENERATED_DIRECTORY = os.path.join(DIRECTORY, "generated")
+
+# The programs compiled, as (shape, size). See generate.py
+PROGRAMS = [
+    ("functions", 5000),
+    ("globals", 20000),
+    ("nesting", 1024),
+    ("expression", 50000),
+    ("print", 50000),
+    ("parameters", 2000),
+]
+
+# Phases shorter than this are left out of the comparison, since their throughput is mostly noise
+MIN_PHASE_MS = 5.0
+
+parser = argparse.ArgumentParser(description="""
+Compiles generated programs of different shapes with vslc -c -ftime-report=json, and prints how many lines
+and syntax tree nodes each phase gets through per second. Fails if any phase is slower than in the baseline.
+""")
+parser.add_argument("vslc", help="the compiler to measure")
+parser.add_argument("--runs", type=int, default=5,
+                    help="compile each program this many times, and keep the fastest time of each phase")
+parser.add_argument("--tolerance", type=float, default=0.3,
+                    help="how much slower than the baseline a phase may be, as a fraction (default 0.3)")
+parser.add_argument("--update-baseline", action="store_true", help=f"write the results to {BASELINE_FILE} instead")
+arguments = parser.parse_args()
+
+
+def measure(vslc, path, runs):
+    """Returns the time report of the first compilation, with the time of each phase the fastest of any of them"""
+    reports = []
+    for _ in range(runs):
+        result = subprocess.run([vslc, "-c", "-ftime-report=json", path],
+                                stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+        if result.returncode != 0:
+            print(f"{path}: vslc failed:\n{result.stderr}")
+            sys.exit(1)
+        reports.append(json.loads(result.stderr.splitlines()[-1]))
+
+    best = reports[0]
+    for i, phase in enumerate(best["phases"]):
+        phase["wall_ms"] = min(report["phases"][i]["wall_ms"] for report in reports)
+    best["total"]["wall_ms"] = min(report["total"]["wall_ms"] for report in reports)
+    return best
+
+
+def throughputs(report, n_lines):
+    """Returns the lines and nodes per second of each phase, and of the whole compilation"""
+    n_nodes = report["nodes"]["total"]
+    phases = report["phases"] + [dict(report["total"], name="total")]
+    return {
+        phase["name"]: {
+            "ms": phase["wall_ms"],
+            "lines_per_s": round(n_lines / phase["wall_ms"] * 1e3) if phase["wall_ms"] > 0 else None,
+            "nodes_per_s": round(n_nodes / phase["wall_ms"] * 1e3) if phase["wall_ms"] > 0 else None,
+        }
+        for phase in phases
+    }
+
+
+def slower_phases(program, results, baseline):
+    """Returns the phases of the program that are slower than in the baseline, by more than the tolerance"""
+    slower = []
+    for phase, result in results.items():
+        expected = baseline.get(program, {}).get(phase, {}).get("nodes_per_s")
+        if (expected is not None and result["nodes_per_s"] is not None and result["ms"] >= MIN_PHASE_MS
+                and result["nodes_per_s"] < expected * (1 - arguments.tolerance)):
+            slower.append(phase)
+    return slower
+
+
+def main():
+    baseline = {}
+    if not arguments.update_baseline:
+        if not os.path.isfile(BASELINE_FILE):
+            print(f"no baseline in {BASELINE_FILE}, make one with --update-baseline")
+            sys.exit(1)
+        with open(BASELINE_FILE, "r", encoding="utf-8") as baseline_fd:
+            baseline = json.load(baseline_fd)["programs"]
+
+    os.makedirs(GENERATED_DIRECTORY, exist_ok=True)
+    results = {}
+    regressions = []
+    print(f"{'program':<18} {'phase':<10} {'ms':>10} {'lines/s':>12} {'nodes/s':>12} {'baseline':>12}")
+    for shape, size in PROGRAMS:
+        program = f"{shape}-{size}"
+        path = os.path.join(GENERATED_DIRECTORY, program + ".vsl")
+        source = generate(shape, size)
+        with open(path, "w", encoding="utf-8") as vsl_fd:
+            vsl_fd.write(source)
+
+        # Other work on the machine can slow down a few runs, so a program that seems slower is measured again
+        report = measure(arguments.vslc, path, arguments.runs)
+        if not arguments.update_baseline and slower_phases(program, throughputs(report, source.count("\n")), baseline):
+            retry = measure(arguments.vslc, path, arguments.runs)
+            for phase, retried in zip(report["phases"], retry["phases"]):
+                phase["wall_ms"] = min(phase["wall_ms"], retried["wall_ms"])
+            report["total"]["wall_ms"] = min(report["total"]["wall_ms"], retry["total"]["wall_ms"])
+
+        results[program] = throughputs(report, source.count("\n"))
+        slower = slower_phases(program, results[program], baseline)
+        for phase, result in results[program].items():
+            expected = baseline.get(program, {}).get(phase, {}).get("nodes_per_s")
+            if phase in slower:
+                regressions.append(f"{program} {phase}: {result['nodes_per_s']} nodes/s, the baseline is {expected}")
+            print(f"{program:<18} {phase:<10} {result['ms']:>10.3f} {result['lines_per_s'] or 0:>12} "
+                  f"{result['nodes_per_s'] or 0:>12} {expected or 0:>12}{'  SLOWER' if phase in slower else ''}")
+
+    if arguments.update_baseline:
+        with open(BASELINE_FILE, "w", encoding="utf-8") as baseline_fd:
+            json.dump({"compiler": report["compiler"], "programs": results}, baseline_fd, indent=2)
+            baseline_fd.write("\n")
+        print(f"Wrote the baseline to {BASELINE_FILE}")
+    elif regressions:
+        print(f"{len(regressions)} phases are more than {arguments.tolerance:.0%} slower than the baseline:")
+        print("\n".join(regressions))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
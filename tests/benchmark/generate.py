@@ -0,0 +1,119 @@
+#!/usr/bin/env python3
+
+import sys
+
+name, *args = sys.argv
+
+USAGE = f"""
+Usage: {name} <shape> <size>
+
+Prints a VSL program of the given shape on stdout, to measure how the compiler scales with size:
+  functions   <size> functions, each calling the next, with loops, branches, arrays and strings
+  globals     <size> global variables and arrays, all used by main
+  nesting     if and while blocks nested <size> deep
+  expression  one expression with <size> terms
+  print       one print statement with <size> items
+  parameters  functions with <size> parameters, and calls to them
+The same shape and size always give the same program.
+""".strip()
+
+
+def functions(size):
+    yield "var g, arr[100]"
+    yield "func main(n) begin"
+    yield "    print f0(n)"
+    yield "end"
+    for i in range(size):
+        yield f"func f{i}(x) begin"
+        yield "    var a, b, c"
+        yield f"    a := x * 3 + {i % 7} - (x / 2)"
+        yield "    b := a << 2"
+        yield "    while a > 0 do begin"
+        yield "        a := a - 1"
+        yield f"        if a = {i % 5} then break"
+        yield "        c := c + a * b - arr[a - a / 100 * 100]"
+        yield "    end"
+        yield f"    if c > 100 then print \"big \", c, \" in f{i}\" else print \"small\""
+        yield "    g := g + c"
+        yield f"    return f{i + 1}(x - 1)" if i + 1 < size else "    return g"
+        yield "end"
+
+
+def globals(size):
+    for i in range(0, size, 2):
+        yield f"var g{i}, a{i + 1}[{i % 10 + 1}]"
+    yield "func main(n) begin"
+    yield "    var sum"
+    for i in range(0, size, 2):
+        yield f"    g{i} := n + {i}"
+        yield f"    a{i + 1}[{i % (i % 10 + 1)}] := g{i} * 2"
+        yield f"    sum := sum + g{i} - a{i + 1}[0]"
+    yield "    return sum"
+    yield "end"
+
+
+def nesting(size):
+    yield "func main(n) begin"
+    yield "    var x"
+    yield "    x := n"
+    for depth in range(size):
+        indent = "    " * (depth + 1)
+        if depth % 2 == 0:
+            yield f"{indent}if x > {depth} then begin"
+        else:
+            yield f"{indent}while x > {depth} do begin"
+        yield f"{indent}    x := x - 1"
+    for depth in reversed(range(size)):
+        yield "    " * (depth + 1) + "end"
+    yield "    return x"
+    yield "end"
+
+
+def expression(size):
+    operators = ["+", "-", "*", "+", "/", "-"]
+    terms = ["n"]
+    for i in range(1, size):
+        terms.append(f" {operators[i % len(operators)]} " + (f"{i % 97 + 1}" if i % 3 else "n"))
+    yield "func main(n) begin"
+    yield "    return " + "".join(terms)
+    yield "end"
+
+
+def print_list(size):
+    items = [f"\"item {i}\"" if i % 2 else f"n + {i}" for i in range(size)]
+    yield "func main(n) begin"
+    yield "    print " + ", ".join(items)
+    yield "end"
+
+
+def parameters(size):
+    names = [f"p{i}" for i in range(size)]
+    yield "func main(n) begin"
+    yield "    return " + " + ".join(f"f{i}(" + ", ".join(f"n + {j}" for j in range(size)) + ")" for i in range(4))
+    yield "end"
+    for i in range(4):
+        yield f"func f{i}(" + ", ".join(names) + ") begin"
+        yield "    return " + " - ".join(names)
+        yield "end"
+
+
+SHAPES = {
+    "functions": functions,
+    "globals": globals,
+    "nesting": nesting,
+    "expression": expression,
+    "print": print_list,
+    "parameters": parameters,
+}
+
+
+def generate(shape, size):
+    """Returns the program as a string"""
+    return "".join(line + "\n" for line in SHAPES[shape](size))
+
+
+if __name__ == "__main__":
+    if len(args) != 2 or args[0] not in SHAPES or not args[1].isdigit() or int(args[1]) < 1:
+        print(USAGE)
+        sys.exit(1)
+    sys.stdout.write(generate(args[0], int(args[1])))
@@ -0,0 +1,47 @@
+// The C version of bubble_sort.vsl
+#include <stdint.h>
+#include <stdio.h>
+
+static int64_t array[4000], seed;
+
+static int64_t random_number ( void )
+{
+    seed = ( seed * 1103515245 + 12345 ) % 2147483648;
+    return seed;
+}
+
+static void fill ( int64_t n )
+{
+    for ( int64_t i = 0; i < n; i++ )
+        array[i] = random_number ( );
+}
+
+static void bubble_sort ( int64_t n )
+{
+    for ( int64_t i = 0; i < n - 1; i++ )
+        for ( int64_t j = 0; j < n - i - 1; j++ )
+            if ( array[j] > array[j + 1] )
+            {
+                int64_t temp = array[j];
+                array[j] = array[j + 1];
+                array[j + 1] = temp;
+            }
+}
+
+int main ( void )
+{
+    seed = 7;
+    for ( int round = 0; round < 3; round++ )
+    {
+        fill ( 4000 );
+        bubble_sort ( 4000 );
+    }
+
+    int64_t unsorted = 0;
+    for ( int64_t i = 0; i < 3999; i++ )
+        if ( array[i] > array[i + 1] )
+            unsorted++;
+    printf ( "Out of order: %ld, first: %ld, middle: %ld, last: %ld\n",
+             (long) unsorted, (long) array[0], (long) array[2000], (long) array[3999] );
+    return 0;
+}
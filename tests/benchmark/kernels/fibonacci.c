@@ -0,0 +1,16 @@
+// The C version of fibonacci.vsl
+#include <stdint.h>
+#include <stdio.h>
+
+static int64_t fibonacci ( int64_t n )
+{
+    if ( n < 2 )
+        return n;
+    return fibonacci ( n - 1 ) + fibonacci ( n - 2 );
+}
+
+int main ( void )
+{
+    printf ( "Fibonacci 35: %ld\n", (long) fibonacci ( 35 ) );
+    return 0;
+}
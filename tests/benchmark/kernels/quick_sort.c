@@ -0,0 +1,65 @@
+// The C version of quick_sort.vsl
+#include <stdint.h>
+#include <stdio.h>
+
+static int64_t array[200000], seed;
+
+static int64_t random_number ( void )
+{
+    seed = ( seed * 1103515245 + 12345 ) % 2147483648;
+    return seed;
+}
+
+static void fill ( int64_t n )
+{
+    for ( int64_t i = 0; i < n; i++ )
+        array[i] = random_number ( );
+}
+
+static int64_t partition ( int64_t low, int64_t high )
+{
+    int64_t pivot = array[high];
+    int64_t i = low - 1;
+    for ( int64_t j = low; j < high; j++ )
+    {
+        if ( array[j] < pivot )
+        {
+            i++;
+            int64_t temp = array[i];
+            array[i] = array[j];
+            array[j] = temp;
+        }
+    }
+    int64_t temp = array[i + 1];
+    array[i + 1] = array[high];
+    array[high] = temp;
+    return i + 1;
+}
+
+static void quick_sort ( int64_t low, int64_t high )
+{
+    if ( low < high )
+    {
+        int64_t pi = partition ( low, high );
+        quick_sort ( low, pi - 1 );
+        quick_sort ( pi + 1, high );
+    }
+}
+
+int main ( void )
+{
+    seed = 42;
+    for ( int round = 0; round < 5; round++ )
+    {
+        fill ( 200000 );
+        quick_sort ( 0, 199999 );
+    }
+
+    int64_t unsorted = 0;
+    for ( int64_t i = 0; i < 199999; i++ )
+        if ( array[i] > array[i + 1] )
+            unsorted++;
+    printf ( "Out of order: %ld, first: %ld, middle: %ld, last: %ld\n",
+             (long) unsorted, (long) array[0], (long) array[100000], (long) array[199999] );
+    return 0;
+}
@@ -0,0 +1,31 @@
+// The C version of sieve.vsl
+#include <stdint.h>
+#include <stdio.h>
+
+static int64_t notPrime[1000001];
+
+static int64_t sieve ( int64_t max )
+{
+    for ( int64_t i = 0; i < max + 1; i++ )
+        notPrime[i] = 0;
+
+    for ( int64_t i = 2; i * i < max + 1; i++ )
+        if ( notPrime[i] == 0 )
+            for ( int64_t j = i * i; j < max + 1; j += i )
+                notPrime[j] = 1;
+
+    int64_t count = 0;
+    for ( int64_t i = 2; i < max + 1; i++ )
+        if ( notPrime[i] == 0 )
+            count++;
+    return count;
+}
+
+int main ( void )
+{
+    int64_t count = 0;
+    for ( int round = 0; round < 20; round++ )
+        count = sieve ( 1000000 );
+    printf ( "Primes up to 1000000: %ld\n", (long) count );
+    return 0;
+}
@@ -0,0 +1,124 @@
+// Runs a program several times, and prints its wall time and hardware counters for each run, as one line of JSON.
+// The counters come from perf_event_open, and only count the program's own user space code and libraries.
+// A counter the kernel or the machine doesn't provide, such as the hardware counters in many virtual machines,
+// is printed as null. The CPU time, task_clock_ns, is counted by the kernel, and is always there.
+//
+// Usage: perf-stat <runs> <program> [<argument>...]
+// The program's output is discarded.
+
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <linux/perf_event.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+static const struct
+{
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} COUNTERS[] = {
+    { "task_clock_ns", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { "branch_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+#define N_COUNTERS ( sizeof(COUNTERS) / sizeof(COUNTERS[0]) )
+
+/* Counts the event in the process, from when it calls exec. Returns -1 if the event can't be counted */
+static int open_counter ( pid_t pid, uint32_t type, uint64_t config )
+{
+    struct perf_event_attr attr = {
+        .type = type,
+        .size = sizeof(attr),
+        .config = config,
+        .disabled = 1,
+        .enable_on_exec = 1,
+        .exclude_kernel = 1,
+        .exclude_hv = 1,
+    };
+    return (int) syscall ( SYS_perf_event_open, &attr, pid, -1, -1, PERF_FLAG_FD_CLOEXEC );
+}
+
+static double seconds_now ( void )
+{
+    struct timespec now;
+    clock_gettime ( CLOCK_MONOTONIC, &now );
+    return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+/* Runs the program once, and prints what it measured. Returns false if the program failed */
+static bool run ( char **argv )
+{
+    // The child waits for the counters to be opened before it calls exec
+    int ready[2];
+    if ( pipe ( ready ) != 0 )
+        return false;
+
+    pid_t child = fork ( );
+    if ( child == 0 )
+    {
+        char byte;
+        close ( ready[1] );
+        if ( read ( ready[0], &byte, 1 ) != 1 )
+            _exit ( 127 );
+        int null = open ( "/dev/null", O_WRONLY );
+        dup2 ( null, STDOUT_FILENO );
+        execv ( argv[0], argv );
+        _exit ( 127 );
+    }
+    close ( ready[0] );
+    if ( child < 0 )
+        return false;
+
+    int counters[N_COUNTERS];
+    for ( size_t i = 0; i < N_COUNTERS; i++ )
+        counters[i] = open_counter ( child, COUNTERS[i].type, COUNTERS[i].config );
+
+    double start = seconds_now ( );
+    if ( write ( ready[1], "", 1 ) != 1 )
+        return false;
+    close ( ready[1] );
+    int status;
+    waitpid ( child, &status, 0 );
+    double seconds = seconds_now ( ) - start;
+
+    printf ( "{\"wall_ms\": %.3f", seconds * 1e3 );
+    for ( size_t i = 0; i < N_COUNTERS; i++ )
+    {
+        uint64_t count;
+        if ( counters[i] >= 0 && read ( counters[i], &count, sizeof(count) ) == sizeof(count) )
+            printf ( ", \"%s\": %llu", COUNTERS[i].name, (unsigned long long) count );
+        else
+            printf ( ", \"%s\": null", COUNTERS[i].name );
+        if ( counters[i] >= 0 )
+            close ( counters[i] );
+    }
+    printf ( "}\n" );
+    return WIFEXITED ( status ) && WEXITSTATUS ( status ) == 0;
+}
+
+int main ( int argc, char **argv )
+{
+    if ( argc < 3 || atoi ( argv[1] ) < 1 )
+    {
+        fprintf ( stderr, "Usage: %s <runs> <program> [<argument>...]\n", argv[0] );
+        return EXIT_FAILURE;
+    }
+    for ( int i = 0; i < atoi ( argv[1] ); i++ )
+    {
+        if ( !run ( &argv[2] ) )
+        {
+            fprintf ( stderr, "%s: '%s' failed\n", argv[0], argv[2] );
+            return EXIT_FAILURE;
+        }
+    }
+    return EXIT_SUCCESS;
+}
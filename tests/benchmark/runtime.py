@@ -0,0 +1,150 @@
+#!/usr/bin/env python3
+
+import sys
+import os
+import json
+import argparse
+import subprocess
+
+DIRECTORY = os.path.dirname(os.path.abspath(__file__))
+KERNEL_DIRECTORY = os.path.join(DIRECTORY, "kernels")
+BASELINE_FILE = os.path.join(DIRECTORY, "runtime-baseline.json")
+GENERATED_DIRECTORY = os.path.join(DIRECTORY, "generated")
+PERF_STAT = os.path.join(DIRECTORY, "perf-stat")
+
+# What the speed is compared by, the first of these that was counted.
+# Virtual machines often have no hardware counters, but the kernel always counts the CPU time
+METRICS = ["cycles", "task_clock_ns", "wall_ms"]
+
+# The instructions run hardly change from run to run, so they are compared more strictly
+INSTRUCTIONS_TOLERANCE = 0.01
+
+parser = argparse.ArgumentParser(description=f"""
+Compiles the kernels in {KERNEL_DIRECTORY} with vslc, and their C versions with gcc -O2, checks that both print
+the same, and runs each several times under perf-stat. Prints the time and hardware counters of the fastest run,
+and fails if the code generated by vslc has become slower compared to the C version than in the baseline.
+""")
+parser.add_argument("vslc", help="the compiler to measure")
+parser.add_argument("--runs", type=int, default=5, help="run each program this many times, and keep the fastest")
+parser.add_argument("--tolerance", type=float, default=0.3,
+                    help="how much slower than the baseline a kernel may be, as a fraction (default 0.3)")
+parser.add_argument("--update-baseline", action="store_true", help=f"write the results to {BASELINE_FILE} instead")
+arguments = parser.parse_args()
+
+
+def run(command):
+    """Runs the command, and returns its output. Exits if it fails"""
+    result = subprocess.run(command, stdout=subprocess.PIPE, stderr=subprocess.PIPE, text=True)
+    if result.returncode != 0:
+        print(f"{' '.join(command)} failed:\n{result.stderr}")
+        sys.exit(1)
+    return result.stdout
+
+
+def measure(program, runs):
+    """Returns the smallest value of each counter over the runs of the program, or None if it wasn't counted"""
+    results = [json.loads(line) for line in run([PERF_STAT, str(runs), program]).splitlines()]
+    return {counter: min(result[counter] for result in results) if results[0][counter] is not None else None
+            for counter in results[0]}
+
+
+def metric(*results):
+    """Returns the first metric that was counted in all of the results"""
+    return next(m for m in METRICS if all(result.get(m) is not None for result in results))
+
+
+def build(kernel):
+    """Compiles the VSL and the C version of the kernel, and returns the paths of the two programs"""
+    vsl_source = os.path.join(KERNEL_DIRECTORY, kernel + ".vsl")
+    assembly = os.path.join(GENERATED_DIRECTORY, kernel + ".S")
+    vsl_program = os.path.join(GENERATED_DIRECTORY, kernel + ".out")
+    c_program = os.path.join(GENERATED_DIRECTORY, kernel + ".c.out")
+    with open(assembly, "w", encoding="utf-8") as assembly_fd:
+        assembly_fd.write(run([arguments.vslc, "-c", vsl_source]))
+    run(["gcc", assembly, "-o", vsl_program])
+    run(["gcc", "-O2", os.path.join(KERNEL_DIRECTORY, kernel + ".c"), "-o", c_program])
+
+    vsl_output, c_output = run([vsl_program]), run([c_program])
+    if vsl_output != c_output:
+        print(f"{kernel}: the VSL and C versions print different results:\n{vsl_output}{c_output}")
+        sys.exit(1)
+    return vsl_program, c_program
+
+
+def slower(result, c_result, expected):
+    """Returns a description of how the result is slower than expected, or None.
+    The time is compared relative to the C version, which was measured at the same time,
+    so that the rest of the machine being busier or idler doesn't count"""
+    m = metric(result, c_result, expected, expected["c"])
+    ratio, expected_ratio = result[m] / c_result[m], expected[m] / expected["c"][m]
+    if ratio > expected_ratio * (1 + arguments.tolerance):
+        return f"{ratio:.2f}x the {m} of gcc -O2, the baseline is {expected_ratio:.2f}x"
+    if (result.get("instructions") is not None and expected.get("instructions") is not None
+            and result["instructions"] > expected["instructions"] * (1 + INSTRUCTIONS_TOLERANCE)):
+        return f"instructions {result['instructions']}, the baseline is {expected['instructions']}"
+    return None
+
+
+def format_count(count):
+    return f"{count / 1e6:.1f}M" if count is not None else "-"
+
+
+def main():
+    baseline = {}
+    if not arguments.update_baseline:
+        if not os.path.isfile(BASELINE_FILE):
+            print(f"no baseline in {BASELINE_FILE}, make one with --update-baseline")
+            sys.exit(1)
+        with open(BASELINE_FILE, "r", encoding="utf-8") as baseline_fd:
+            baseline = json.load(baseline_fd)["kernels"]
+
+    os.makedirs(GENERATED_DIRECTORY, exist_ok=True)
+    kernels = sorted(name[:-len(".vsl")] for name in os.listdir(KERNEL_DIRECTORY) if name.endswith(".vsl"))
+    results = {}
+    regressions = []
+    print(f"{'kernel':<12} {'ms':>9} {'CPU ms':>9} {'cycles':>10} {'instr.':>10} {'IPC':>5} {'br. miss':>10} "
+          f"{'vs gcc -O2':>11} {'vs baseline':>12}")
+    for kernel in kernels:
+        vsl_program, c_program = build(kernel)
+        result = measure(vsl_program, arguments.runs)
+        c_result = measure(c_program, arguments.runs)
+
+        # Other work on the machine can slow down a few runs, so a kernel that seems slower is measured again
+        expected = baseline.get(kernel)
+        if expected is not None and slower(result, c_result, expected):
+            retry, c_retry = measure(vsl_program, arguments.runs), measure(c_program, arguments.runs)
+            result = {counter: min(value, retry[counter]) if value is not None else None
+                      for counter, value in result.items()}
+            c_result = {counter: min(value, c_retry[counter]) if value is not None else None
+                        for counter, value in c_result.items()}
+        results[kernel] = dict(result, c=c_result)
+
+        m = metric(result, c_result)
+        versus_c = f"{result[m] / c_result[m]:.2f}x"
+        versus_baseline = ""
+        if expected is not None:
+            baseline_metric = metric(result, expected)
+            versus_baseline = f"{result[baseline_metric] / expected[baseline_metric]:.2f}x"
+            problem = slower(result, c_result, expected)
+            if problem:
+                regressions.append(f"{kernel}: {problem}")
+                versus_baseline += "  SLOWER"
+        ipc = (f"{result['instructions'] / result['cycles']:.2f}"
+               if result["cycles"] is not None and result["instructions"] is not None else "-")
+        print(f"{kernel:<12} {result['wall_ms']:>9.1f} {result['task_clock_ns'] / 1e6:>9.1f} "
+              f"{format_count(result['cycles']):>10} {format_count(result['instructions']):>10} {ipc:>5} "
+              f"{format_count(result['branch_misses']):>10} {versus_c:>11} {versus_baseline:>12}")
+
+    if arguments.update_baseline:
+        with open(BASELINE_FILE, "w", encoding="utf-8") as baseline_fd:
+            json.dump({"kernels": results}, baseline_fd, indent=2)
+            baseline_fd.write("\n")
+        print(f"Wrote the baseline to {BASELINE_FILE}")
+    elif regressions:
+        print(f"{len(regressions)} kernels are slower than the baseline:")
+        print("\n".join(regressions))
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -7,11 +7,12 @@ import os.path
 name, *args = sys.argv
 
 USAGE = f"""
-Usage: {name} <file.vsl>
+Usage: {name} <file.vsl> [<file.out>]
 
 For each occurance of a VSL comment block starting with
 //TESTCASE: <args>
 The corresponding compiler executable file.out is executed with the given <args>.
+A different executable can be given as the second argument.
 Output is compared against the rest of the comment block.
 If they are different, the difference is printed and the test fails.
 """.strip()
@@ -24,15 +25,18 @@ def error(text, message=None):
         print(message)
     sys.exit(1)
 
-if len(args) != 1:
+if len(args) not in (1, 2):
     error("expected one input .vsl file", message=USAGE)
 
-vsl_file, = args
+vsl_file, *out_file = args
 
 if not os.path.isfile(vsl_file):
     error(f"file not found: {vsl_file}")
 
-out_file = vsl_file[:vsl_file.rindex(".")] + ".out"
+if out_file:
+    out_file, = out_file
+else:
+    out_file = vsl_file[:vsl_file.rindex(".")] + ".out"
 
 if not os.path.isfile(out_file):
     error(f"file not found: {out_file}")